@@ -0,0 +1,115 @@
+/*
+remote_mutex
+Copyright (C) 2015  Luke Fraser
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#ifndef MUTEX_METRICS_H_
+#define MUTEX_METRICS_H_
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/locks.hpp>
+#include <boost/date_time.hpp>
+#include <diagnostic_msgs/DiagnosticArray.h>
+#include <stdint.h>
+#include <map>
+#include <ostream>
+#include <string>
+
+// Histogram buckets end at 1 ms, 2 ms, ... 2^(HISTOGRAM_BUCKETS - 2) ms, the
+// last one takes everything longer
+#define HISTOGRAM_BUCKETS 18
+
+namespace mutex {
+
+typedef enum {
+  DENIED_LOCKED = 0,    // resource already held
+  DENIED_NOT_HIGHEST,   // not the highest activation potential of the tree
+  DENIED_NO_POTENTIAL,  // activation potential <= 0
+  DENIED_LOST_ROUND,    // another request won the arbitration round
+  DENIED_WAIT_TIMEOUT,  // queued until its wait ran out
+  DENIED_CANCELLED,     // queued and cancelled by the requester
+  DENIAL_REASONS
+} Denial_t;
+
+/*
+Class: Histogram
+Definition: Durations in power of two millisecond buckets, with count, sum
+            and maximum.
+*/
+class Histogram {
+ public:
+  Histogram();
+  void Add(double seconds);
+  // Upper bound of the bucket holding the fraction p of the samples
+  double Percentile(double p) const;
+  double Mean() const;
+  // "1ms:3 2ms:0 ... inf:1"
+  std::string Buckets() const;
+
+  uint64_t count;
+  double sum;
+  double max;
+  uint64_t buckets[HISTOGRAM_BUCKETS];
+};
+
+/*
+Class: MutexMetrics
+Definition: Lock wait, hold time, denials by reason and grant throughput of
+            a remote_mutex_service, per requester and in total. Published as
+            diagnostic_msgs on /diagnostics and written out as text on
+            shutdown.
+*/
+class MutexMetrics {
+ public:
+  MutexMetrics();
+
+  // wait is the time from the request to the decision
+  void Granted(const std::string &name, uint64_t token, double wait,
+    const boost::posix_time::ptime &now);
+  void Denied(const std::string &name, Denial_t reason, double wait);
+  // End of the hold of a grant, by release or by its lease running out
+  void Released(uint64_t token, const boost::posix_time::ptime &now,
+    bool expired);
+
+  diagnostic_msgs::DiagnosticArray Diagnostics(
+    const boost::posix_time::ptime &now);
+  void Dump(std::ostream &out, const boost::posix_time::ptime &now);
+
+ private:
+  struct Requester_t {
+    Requester_t();
+    Histogram wait;
+    Histogram hold;
+    uint64_t grants;
+    uint64_t expired;
+    uint64_t denials[DENIAL_REASONS];
+  };
+  struct Hold_t {
+    std::string name;
+    boost::posix_time::ptime since;
+  };
+  diagnostic_msgs::DiagnosticStatus Status(const std::string &name,
+    const Requester_t &stats);
+
+  boost::mutex mut_;
+  Requester_t total_;
+  std::map<std::string, Requester_t> requesters_;
+  // Grants not released yet, by fencing token
+  std::map<uint64_t, Hold_t> holds_;
+  // Grants at the last Diagnostics() call, for the grant rate
+  uint64_t last_grants_;
+  boost::posix_time::ptime last_report_;
+};
+}  // namespace mutex
+#endif  // MUTEX_METRICS_H_
@@ -17,25 +17,127 @@ along with remote_mutex.  If not, see <http://www.gnu.org/licenses/>.
 */
 #ifndef REMOTE_MUTEX_H_
 #define REMOTE_MUTEX_H_
+#include <boost/thread/thread.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/condition_variable.hpp>
+#include <boost/date_time.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/function.hpp>
+#include <deque>
 #include <string>
+#include <vector>
 #include "ros/ros.h"
 #include "remote_mutex/remote_mutex_msg.h"
 #include <robotics_task_tree_msgs/node_types.h>
-
 #define LOCK true
 #define RELEASE false
-
+// Default time a PollLock request waits in the service queue
+#define POLL_LOCK_TIMEOUT_MS 2000
 namespace mutex {
+/*
+Class: MutexFuture
+Definition: Outcome of one asynchronous Lock or Release call. The call has a
+            deadline: Get() gives up at the deadline and a lock granted after
+            it is handed back to the service by the client, so a caller that
+            timed out never holds the mutex.
+*/
+class MutexFuture {
+ public:
+  explicit MutexFuture(const boost::posix_time::ptime &deadline);
+
+  bool Done();
+  // Wait at most timeout for the outcome, true once it is there
+  bool WaitFor(boost::posix_time::time_duration timeout);
+  // Wait for the outcome, false on a failed call, a denied request or the
+  // deadline passing
+  bool Get();
+  // Set the outcome. Returns false when the deadline already passed or the
+  // call was cancelled, the outcome is then false.
+  bool Complete(bool success);
+  bool Expired();
+  // Drop the outcome. Returns true when the call had already succeeded.
+  bool Cancel();
+
+ private:
+  boost::posix_time::ptime deadline_;
+  bool done_;
+  bool success_;
+  bool cancelled_;
+  boost::mutex mut_;
+  boost::condition_variable cv_;
+};
+typedef boost::shared_ptr<MutexFuture> MutexFuturePtr;
+
+/*
+Class: RemoteMutex
+Definition: Client of a remote_mutex_service. Calls go through one persistent
+            service connection that is reopened when it drops, on a worker
+            thread in the order they were made. Lock and Release wait for
+            the outcome; LockAsync and ReleaseAsync return at once, a lock
+            request with a timeout waits in the service queue and is
+            granted as soon as the holder releases. A
+            mutex may cover several resources of the service, acquired
+            together, and renews the lease of a held lock on its own.
+*/
 class RemoteMutex {
  public:
   RemoteMutex(std::string name, std::string topic);
+  // Lock all of resources at once, leased for lease seconds (0 for the
+  // service default)
+  RemoteMutex(std::string name, std::string topic,
+    std::vector<std::string> resources, float lease);
   RemoteMutex();
+  ~RemoteMutex();
   bool Lock(float potential);
   bool Release();
-
+  MutexFuturePtr LockAsync(float potential,
+    boost::posix_time::time_duration timeout);
+  MutexFuturePtr ReleaseAsync(boost::posix_time::time_duration timeout);
+  // Give up on a lock: a queued request is taken out of the service queue
+  // and a granted lock released
+  void Cancel(MutexFuturePtr lock);
+  // Lock without blocking, for a caller that retries every tick from one
+  // thread: the first call queues a request of at most timeout, later calls
+  // return true once it is granted. The request is dropped, and a granted
+  // lock handed back, as soon as claimed() is true.
+  bool PollLock(float potential, boost::function<bool()> claimed,
+    boost::posix_time::time_duration timeout =
+    boost::posix_time::millisec(POLL_LOCK_TIMEOUT_MS));
+  // Fencing token of the held lock, 0 when not held
+  uint64_t Token();
  private:
-  remote_mutex::remote_mutex_msg msg;
+  struct Call_t {
+    bool request;
+    bool renew;
+    float activation_potential;
+    boost::posix_time::ptime deadline;
+    MutexFuturePtr future;
+  };
+  MutexFuturePtr Submit(bool request, float potential,
+    boost::posix_time::time_duration timeout);
+  static void CallThread(RemoteMutex *mutex);
+  // One service call, reconnecting once if the connection dropped
+  bool Call(remote_mutex::remote_mutex_msg *msg);
+
+  std::string name_;
   std::string topic_;
+  std::vector<std::string> resources_;
+  float lease_;
+  // Held lock, renewed at renew_at_
+  uint64_t token_;
+  // Token of the last grant until it is released, kept when the lease is
+  // lost so the release is still fenced and the service refuses it
+  uint64_t granted_;
+  boost::posix_time::ptime renew_at_;
+  // Outstanding PollLock request
+  MutexFuturePtr polled_;
+  ros::NodeHandle *nh_;
+  ros::ServiceClient client_;
+  std::deque<Call_t> calls_;
+  bool stopping_;
+  boost::thread *call_thread_;
+  boost::mutex mut_;
+  boost::condition_variable cv_;
 };
 }  // namespace mutex
 #endif // REMOTE_MUTEX_H_
@@ -0,0 +1,124 @@
+/*
+remote_mutex
+Copyright (C) 2015  Luke Fraser
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#ifndef SIM_CLOCK_H_
+#define SIM_CLOCK_H_
+#include <ros/ros.h>
+#include <ros/callback_queue.h>
+#include <rosgraph_msgs/Clock.h>
+#include <boost/thread/thread.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/condition_variable.hpp>
+#include <boost/thread/tss.hpp>
+#include <boost/date_time.hpp>
+#include <stdint.h>
+#include <set>
+#include <string>
+#include "robotics_task_tree_msgs/SimClockRequest.h"
+
+namespace mutex {
+
+/*
+Class: SimClock
+Definition: Sleeps and timed waits of the task tree, the remote mutex and the
+            table simulator. Without /use_sim_time they are the plain boost
+            calls on the wall clock. With /use_sim_time every wait is
+            announced to the sim_clock_server, which publishes /clock and
+            jumps straight to the earliest wakeup once all client threads
+            are waiting, so idle time is skipped.
+
+            Long running loop threads hold a Client for their lifetime: the
+            server does not advance the clock while such a thread is awake.
+            Waits from any other thread only count while they last. A client
+            that blocks on another process (a service call) holds a Blocked
+            so it does not stop the clock it is waiting for.
+
+            Timed condition variable waits are registered with the clock
+            and notified when /clock reaches their wakeup.
+*/
+class SimClock {
+ public:
+  class Client {
+   public:
+    Client();
+    ~Client();
+  };
+
+  class Blocked {
+   public:
+    Blocked();
+    ~Blocked();
+  };
+
+  // True once ros::init ran with /use_sim_time set
+  static bool Enabled();
+  // Current time of the clock in use
+  static boost::posix_time::ptime Now();
+  static void Sleep(boost::posix_time::time_duration duration);
+  static void Sleep(const ros::Duration &duration);
+  static void SleepUntil(const boost::posix_time::ptime &deadline);
+  // cv.timed_wait(lock, deadline) on the clock in use, false on timeout
+  static bool TimedWait(boost::condition_variable &cv,
+    boost::unique_lock<boost::mutex> &lock,
+    const boost::posix_time::ptime &deadline);
+  // cv.wait(lock) that lets the clock advance while waiting
+  static void Wait(boost::condition_variable &cv,
+    boost::unique_lock<boost::mutex> &lock);
+
+ private:
+  // A TimedWait in progress
+  struct Waiter_t {
+    boost::condition_variable *cv;
+    boost::mutex *mut;
+    ros::Time wakeup;
+    bool woken;
+  };
+
+  SimClock();
+  static SimClock* Instance();
+  static bool IsClient();
+  void Announce(uint8_t state, const ros::Time &wakeup);
+  // Announce the end of a wait: AWAKE for clients, LEFT for everyone else
+  void EndWait();
+  void ReceiveClock(const rosgraph_msgs::Clock::ConstPtr &msg);
+  // Notify the waits whose wakeup the clock reached
+  void WakeWaiters(const ros::Time &now);
+  void AddWaiter(Waiter_t *waiter);
+  void RemoveWaiter(Waiter_t *waiter);
+  ros::Time Current();
+
+  // /clock is handled on its own queue so waits inside callbacks of the
+  // global queue still see the clock advance
+  ros::CallbackQueue queue_;
+  ros::NodeHandle nh_;
+  ros::AsyncSpinner *spinner_;
+  ros::Publisher request_pub_;
+  ros::Subscriber clock_sub_;
+  std::string process_;
+  ros::Time now_;
+  boost::mutex mut_;
+  boost::condition_variable cv_;
+  std::set<Waiter_t*> waiters_;
+  boost::mutex waiters_mut_;
+
+  static boost::thread_specific_ptr<bool> client_;
+  static SimClock *instance_;
+  static bool checked_;
+  static boost::mutex instance_mut_;
+};
+}  // namespace mutex
+#endif  // SIM_CLOCK_H_
@@ -0,0 +1,202 @@
+/*
+remote_mutex
+Copyright (C) 2015  Luke Fraser
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#include "remote_mutex/mutex_metrics.h"
+#include <ros/ros.h>
+#include <algorithm>
+#include <sstream>
+#include <vector>
+
+namespace mutex {
+
+static const char *kDenialNames[DENIAL_REASONS] = {
+  "denied_locked",
+  "denied_not_highest",
+  "denied_no_potential",
+  "denied_lost_round",
+  "denied_wait_timeout",
+  "denied_cancelled",
+};
+
+// Upper bound of bucket i in seconds, infinite for the last one
+static double BucketBound(int i) {
+  if (i == HISTOGRAM_BUCKETS - 1)
+    return -1.0;
+  return (1 << i) / 1000.0;
+}
+
+template<typename T>
+static diagnostic_msgs::KeyValue KeyValue(const std::string &key, T value) {
+  std::stringstream ss;
+  ss << value;
+  diagnostic_msgs::KeyValue kv;
+  kv.key = key;
+  kv.value = ss.str();
+  return kv;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// HISTOGRAM
+////////////////////////////////////////////////////////////////////////////////
+Histogram::Histogram() : count(0), sum(0.0), max(0.0) {
+  std::fill(buckets, buckets + HISTOGRAM_BUCKETS, 0);
+}
+
+void Histogram::Add(double seconds) {
+  int i = 0;
+  while (i < HISTOGRAM_BUCKETS - 1 && seconds > BucketBound(i))
+    ++i;
+  buckets[i]++;
+  count++;
+  sum += seconds;
+  max = std::max(max, seconds);
+}
+
+double Histogram::Percentile(double p) const {
+  uint64_t seen = 0;
+  for (int i = 0; i < HISTOGRAM_BUCKETS; ++i) {
+    seen += buckets[i];
+    if (seen > 0 && seen >= p * count)
+      return i == HISTOGRAM_BUCKETS - 1 ? max : BucketBound(i);
+  }
+  return 0.0;
+}
+
+double Histogram::Mean() const {
+  return count ? sum / count : 0.0;
+}
+
+std::string Histogram::Buckets() const {
+  std::stringstream ss;
+  for (int i = 0; i < HISTOGRAM_BUCKETS; ++i) {
+    if (i)
+      ss << " ";
+    if (i == HISTOGRAM_BUCKETS - 1)
+      ss << "inf";
+    else
+      ss << (1 << i) << "ms";
+    ss << ":" << buckets[i];
+  }
+  return ss.str();
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// MUTEX METRICS
+////////////////////////////////////////////////////////////////////////////////
+MutexMetrics::Requester_t::Requester_t() : grants(0), expired(0) {
+  std::fill(denials, denials + DENIAL_REASONS, 0);
+}
+
+MutexMetrics::MutexMetrics() : last_grants_(0) {}
+
+void MutexMetrics::Granted(const std::string &name, uint64_t token,
+    double wait, const boost::posix_time::ptime &now) {
+  boost::lock_guard<boost::mutex> lock(mut_);
+  Requester_t &stats = requesters_[name];
+  stats.wait.Add(wait);
+  stats.grants++;
+  total_.wait.Add(wait);
+  total_.grants++;
+  Hold_t hold;
+  hold.name = name;
+  hold.since = now;
+  holds_[token] = hold;
+}
+
+void MutexMetrics::Denied(const std::string &name, Denial_t reason,
+    double wait) {
+  boost::lock_guard<boost::mutex> lock(mut_);
+  Requester_t &stats = requesters_[name];
+  stats.wait.Add(wait);
+  stats.denials[reason]++;
+  total_.wait.Add(wait);
+  total_.denials[reason]++;
+}
+
+void MutexMetrics::Released(uint64_t token,
+    const boost::posix_time::ptime &now, bool expired) {
+  boost::lock_guard<boost::mutex> lock(mut_);
+  // The resources of one grant share its token, the first release ends it
+  std::map<uint64_t, Hold_t>::iterator it = holds_.find(token);
+  if (it == holds_.end())
+    return;
+  double held = (now - it->second.since).total_microseconds() / 1e6;
+  Requester_t &stats = requesters_[it->second.name];
+  stats.hold.Add(held);
+  total_.hold.Add(held);
+  if (expired) {
+    stats.expired++;
+    total_.expired++;
+  }
+  holds_.erase(it);
+}
+
+diagnostic_msgs::DiagnosticStatus MutexMetrics::Status(
+    const std::string &name, const Requester_t &stats) {
+  diagnostic_msgs::DiagnosticStatus status;
+  status.level = diagnostic_msgs::DiagnosticStatus::OK;
+  status.name = name;
+  status.hardware_id = "remote_mutex";
+  std::vector<diagnostic_msgs::KeyValue> &values = status.values;
+  values.push_back(KeyValue("grants", stats.grants));
+  values.push_back(KeyValue("expired_leases", stats.expired));
+  for (int i = 0; i < DENIAL_REASONS; ++i)
+    values.push_back(KeyValue(kDenialNames[i], stats.denials[i]));
+  values.push_back(KeyValue("wait_mean_s", stats.wait.Mean()));
+  values.push_back(KeyValue("wait_p50_s", stats.wait.Percentile(0.5)));
+  values.push_back(KeyValue("wait_p90_s", stats.wait.Percentile(0.9)));
+  values.push_back(KeyValue("wait_max_s", stats.wait.max));
+  values.push_back(KeyValue("wait_histogram", stats.wait.Buckets()));
+  values.push_back(KeyValue("hold_mean_s", stats.hold.Mean()));
+  values.push_back(KeyValue("hold_p50_s", stats.hold.Percentile(0.5)));
+  values.push_back(KeyValue("hold_p90_s", stats.hold.Percentile(0.9)));
+  values.push_back(KeyValue("hold_max_s", stats.hold.max));
+  values.push_back(KeyValue("hold_histogram", stats.hold.Buckets()));
+  return status;
+}
+
+diagnostic_msgs::DiagnosticArray MutexMetrics::Diagnostics(
+    const boost::posix_time::ptime &now) {
+  boost::lock_guard<boost::mutex> lock(mut_);
+  diagnostic_msgs::DiagnosticArray array;
+  array.header.stamp = ros::Time::now();
+  diagnostic_msgs::DiagnosticStatus total = Status("remote_mutex", total_);
+  double period = last_report_.is_not_a_date_time() ? 0.0
+    : (now - last_report_).total_microseconds() / 1e6;
+  total.values.push_back(KeyValue("grants_per_s", period > 0.0
+    ? (total_.grants - last_grants_) / period : 0.0));
+  total.values.push_back(KeyValue("held", holds_.size()));
+  last_grants_ = total_.grants;
+  last_report_ = now;
+  array.status.push_back(total);
+  for (std::map<std::string, Requester_t>::iterator it = requesters_.begin();
+      it != requesters_.end(); ++it)
+    array.status.push_back(Status("remote_mutex: " + it->first, it->second));
+  return array;
+}
+
+void MutexMetrics::Dump(std::ostream &out,
+    const boost::posix_time::ptime &now) {
+  diagnostic_msgs::DiagnosticArray array = Diagnostics(now);
+  for (size_t i = 0; i < array.status.size(); ++i) {
+    out << array.status[i].name << "\n";
+    for (size_t j = 0; j < array.status[i].values.size(); ++j)
+      out << "  " << array.status[i].values[j].key << ": "
+        << array.status[i].values[j].value << "\n";
+  }
+}
+}  // namespace mutex
@@ -15,29 +15,306 @@ GNU General Public License for more details.
 You should have received a copy of the GNU General Public License
 along with remote_mutex.  If not, see <http://www.gnu.org/licenses/>.
 */
+#include <algorithm>
 #include <string>
 #include "remote_mutex/remote_mutex.h"
+#include "remote_mutex/sim_clock.h"
 #include <robotics_task_tree_msgs/node_types.h>
 #include "stdio.h"
 
+// How long a reconnect waits for the service to come back
+#define RECONNECT_TIMEOUT_MS 1000
+
 namespace mutex {
-RemoteMutex::RemoteMutex(std::string name, std::string topic) {
-  msg.request.name = name;
-  topic_ = topic;
+////////////////////////////////////////////////////////////////////////////////
+// MUTEX FUTURE
+////////////////////////////////////////////////////////////////////////////////
+MutexFuture::MutexFuture(const boost::posix_time::ptime &deadline)
+  : deadline_(deadline), done_(false), success_(false), cancelled_(false) {}
+
+bool MutexFuture::Done() {
+  boost::lock_guard<boost::mutex> lock(mut_);
+  return done_;
 }
-RemoteMutex::RemoteMutex() {}
-bool RemoteMutex::Lock(float potential) {
-  msg.request.request = LOCK;
-  msg.request.activation_potential = potential;
-  if (ros::service::call(topic_.c_str(), msg)) {
-    return msg.response.success;
+
+bool MutexFuture::WaitFor(boost::posix_time::time_duration timeout) {
+  boost::unique_lock<boost::mutex> lock(mut_);
+  boost::posix_time::ptime until = SimClock::Now() + timeout;
+  while (!done_ && SimClock::TimedWait(cv_, lock, until)) {}
+  return done_;
+}
+
+bool MutexFuture::Get() {
+  boost::unique_lock<boost::mutex> lock(mut_);
+  while (!done_) {
+    if (deadline_.is_pos_infinity()) {
+      SimClock::Wait(cv_, lock);
+    } else if (!SimClock::TimedWait(cv_, lock, deadline_) && !done_) {
+      // Timed out; a late grant is released by the call thread
+      done_ = true;
+      success_ = false;
+    }
+  }
+  return success_;
+}
+
+bool MutexFuture::Complete(bool success) {
+  boost::lock_guard<boost::mutex> lock(mut_);
+  bool accepted = !cancelled_ && (deadline_.is_pos_infinity()
+    || SimClock::Now() <= deadline_);
+  if (!done_) {
+    done_ = true;
+    success_ = accepted && success;
+  } else {
+    // Get() gave up before the outcome came in
+    accepted = false;
+  }
+  cv_.notify_all();
+  return accepted;
+}
+
+bool MutexFuture::Expired() {
+  boost::lock_guard<boost::mutex> lock(mut_);
+  return cancelled_ || (!deadline_.is_pos_infinity()
+    && SimClock::Now() > deadline_);
+}
+
+bool MutexFuture::Cancel() {
+  boost::lock_guard<boost::mutex> lock(mut_);
+  bool succeeded = done_ && success_;
+  cancelled_ = true;
+  if (!done_) {
+    done_ = true;
+    success_ = false;
+  }
+  cv_.notify_all();
+  return succeeded;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// REMOTE MUTEX
+////////////////////////////////////////////////////////////////////////////////
+RemoteMutex::RemoteMutex(std::string name, std::string topic)
+  : name_(name), topic_(topic), lease_(0.0f), token_(0), granted_(0),
+    nh_(NULL), stopping_(false), call_thread_(NULL) {}
+
+RemoteMutex::RemoteMutex(std::string name, std::string topic,
+    std::vector<std::string> resources, float lease)
+  : name_(name), topic_(topic), resources_(resources), lease_(lease),
+    token_(0), granted_(0), nh_(NULL), stopping_(false),
+    call_thread_(NULL) {}
+
+RemoteMutex::RemoteMutex()
+  : lease_(0.0f), token_(0), granted_(0), nh_(NULL), stopping_(false),
+    call_thread_(NULL) {}
+
+RemoteMutex::~RemoteMutex() {
+  {
+    boost::lock_guard<boost::mutex> lock(mut_);
+    stopping_ = true;
+    cv_.notify_all();
+  }
+  if (call_thread_) {
+    call_thread_->join();
+    delete call_thread_;
   }
+  delete nh_;
+}
+
+bool RemoteMutex::Lock(float potential) {
+  return Submit(LOCK, potential, boost::posix_time::pos_infin)->Get();
 }
+
 bool RemoteMutex::Release() {
-  msg.request.request = RELEASE;
-  // printf("\n\n\ttopic: %s \n\n", topic_.c_str());
-  if (ros::service::call(topic_.c_str(), msg)) {
-    return msg.response.success;
+  return Submit(RELEASE, 0.0f, boost::posix_time::pos_infin)->Get();
+}
+
+MutexFuturePtr RemoteMutex::LockAsync(float potential,
+    boost::posix_time::time_duration timeout) {
+  return Submit(LOCK, potential, timeout);
+}
+
+MutexFuturePtr RemoteMutex::ReleaseAsync(
+    boost::posix_time::time_duration timeout) {
+  return Submit(RELEASE, 0.0f, timeout);
+}
+
+void RemoteMutex::Cancel(MutexFuturePtr lock) {
+  if (!lock)
+    return;
+  bool pending = !lock->Done();
+  if (lock->Cancel()) {
+    ReleaseAsync(boost::posix_time::pos_infin);
+  } else if (pending) {
+    // The call thread is blocked on the queued request, so the cancel goes
+    // out on a connection of its own
+    remote_mutex::remote_mutex_msg msg;
+    msg.request.name = name_;
+    msg.request.cancel = true;
+    SimClock::Blocked blocked;
+    ros::service::call(topic_, msg);
+  }
+}
+
+bool RemoteMutex::PollLock(float potential, boost::function<bool()> claimed,
+    boost::posix_time::time_duration timeout) {
+  if (claimed()) {
+    Cancel(polled_);
+    polled_.reset();
+    return false;
+  }
+  if (!polled_) {
+    polled_ = LockAsync(potential, timeout);
+    return false;
+  }
+  if (!polled_->Done() && !polled_->Expired())
+    return false;
+  // Get() settles an expired request, a late grant is then handed back by
+  // the call thread
+  bool locked = polled_->Get();
+  polled_.reset();
+  if (locked && claimed()) {
+    // Claimed while the grant came in
+    ReleaseAsync(boost::posix_time::pos_infin);
+    return false;
+  }
+  return locked;
+}
+
+uint64_t RemoteMutex::Token() {
+  boost::lock_guard<boost::mutex> lock(mut_);
+  return token_;
+}
+
+MutexFuturePtr RemoteMutex::Submit(bool request, float potential,
+    boost::posix_time::time_duration timeout) {
+  boost::posix_time::ptime deadline = timeout.is_pos_infinity()
+    ? boost::posix_time::ptime(boost::posix_time::pos_infin)
+    : SimClock::Now() + timeout;
+  Call_t call;
+  call.request = request;
+  call.renew = false;
+  call.activation_potential = potential;
+  call.deadline = deadline;
+  call.future.reset(new MutexFuture(deadline));
+
+  boost::lock_guard<boost::mutex> lock(mut_);
+  // Started on first use, the mutex may be built before ros::init
+  if (!call_thread_)
+    call_thread_ = new boost::thread(&CallThread, this);
+  calls_.push_back(call);
+  cv_.notify_one();
+  return call.future;
+}
+
+void RemoteMutex::CallThread(RemoteMutex *mutex) {
+  while (true) {
+    Call_t call;
+    uint64_t token;
+    {
+      boost::unique_lock<boost::mutex> lock(mutex->mut_);
+      while (mutex->calls_.empty() && !mutex->stopping_) {
+        if (!mutex->token_ || mutex->renew_at_.is_pos_infinity()) {
+          mutex->cv_.wait(lock);
+        } else if (SimClock::Now() >= mutex->renew_at_) {
+          break;
+        } else {
+          SimClock::TimedWait(mutex->cv_, lock, mutex->renew_at_);
+        }
+      }
+      if (mutex->calls_.empty() && mutex->stopping_)
+        return;
+      if (mutex->calls_.empty()) {
+        // Nothing queued and the lease is half gone
+        call.request = LOCK;
+        call.renew = true;
+        call.activation_potential = 0.0f;
+      } else {
+        call = mutex->calls_.front();
+        mutex->calls_.pop_front();
+      }
+      token = call.request == RELEASE ? mutex->granted_ : mutex->token_;
+    }
+    // A lock nobody waits for anymore is not asked for
+    if (call.future && call.request == LOCK && call.future->Expired()) {
+      call.future->Complete(false);
+      continue;
+    }
+    // Nothing granted to release. Token 0 would release any holder.
+    if (call.request == RELEASE && !token) {
+      call.future->Complete(false);
+      continue;
+    }
+    remote_mutex::remote_mutex_msg msg;
+    msg.request.name = mutex->name_;
+    msg.request.request = call.request;
+    msg.request.activation_potential = call.activation_potential;
+    msg.request.resources = mutex->resources_;
+    msg.request.lease = mutex->lease_;
+    msg.request.renew = call.renew;
+    msg.request.token = call.request == LOCK && !call.renew ? 0 : token;
+    // A lock with a deadline queues at the service for what is left of it
+    if (call.request == LOCK && !call.renew
+        && !call.deadline.is_pos_infinity())
+      msg.request.wait = std::max(0.0,
+        (call.deadline - SimClock::Now()).total_microseconds() / 1e6);
+    bool success = mutex->Call(&msg) && msg.response.success;
+    {
+      boost::lock_guard<boost::mutex> lock(mutex->mut_);
+      if (call.request == RELEASE) {
+        mutex->token_ = 0;
+        mutex->granted_ = 0;
+      } else if (call.renew && !success) {
+        mutex->token_ = 0;
+      } else if (success) {
+        mutex->token_ = msg.response.token;
+        mutex->granted_ = msg.response.token;
+        // Renew halfway through the lease, a lease of 0 never runs out
+        mutex->renew_at_ = msg.response.lease > 0.0f
+          ? SimClock::Now() + boost::posix_time::microseconds(
+            static_cast<int64_t>(msg.response.lease * 0.5e6))
+          : boost::posix_time::ptime(boost::posix_time::pos_infin);
+      }
+    }
+    if (call.renew) {
+      if (!success)
+        ROS_WARN("[%s]: lease on %s could not be renewed, lock lost",
+          mutex->name_.c_str(), mutex->topic_.c_str());
+      continue;
+    }
+    if (!call.future->Complete(success) && success && call.request == LOCK) {
+      ROS_WARN("[%s]: lock on %s granted after the caller gave up, releasing",
+        mutex->name_.c_str(), mutex->topic_.c_str());
+      msg.request.request = RELEASE;
+      msg.request.token = msg.response.token;
+      mutex->Call(&msg);
+      boost::lock_guard<boost::mutex> lock(mutex->mut_);
+      mutex->token_ = 0;
+      mutex->granted_ = 0;
+    }
+  }
+}
+
+bool RemoteMutex::Call(remote_mutex::remote_mutex_msg *msg) {
+  // The service waits on the clock while it arbitrates
+  SimClock::Blocked blocked;
+  if (!nh_)
+    nh_ = new ros::NodeHandle();
+  for (int attempt = 0; attempt < 2; ++attempt) {
+    if (!client_.isValid()) {
+      if (attempt > 0 && !ros::service::waitForService(topic_,
+          ros::Duration(RECONNECT_TIMEOUT_MS / 1000.0)))
+        break;
+      client_ = nh_->serviceClient<remote_mutex::remote_mutex_msg>(topic_,
+        true);
+    }
+    if (client_.call(*msg))
+      return true;
+    // The persistent connection dropped, reopen it once
+    client_.shutdown();
   }
+  ROS_WARN("[%s]: mutex service %s not reachable", name_.c_str(),
+    topic_.c_str());
+  return false;
 }
 }  // namespace mutex
@@ -18,18 +18,28 @@ along with remote_mutex.  If not, see <http://www.gnu.org/licenses/>.
 #include <boost/thread/thread.hpp>
 #include <boost/date_time.hpp>
 #include <boost/algorithm/string.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/bind.hpp>
+#include <boost/function.hpp>
+#include <boost/thread/condition_variable.hpp>
+#include <algorithm>
+#include <map>
 #include <string>
+#include <sstream>
 #include <vector>
-#include <string>
 #include <fstream>
 #include "ros/ros.h"
 #include "remote_mutex/remote_mutex.h"
+#include "remote_mutex/sim_clock.h"
+#include "remote_mutex/mutex_metrics.h"
 #include "timeseries_recording_toolkit/record_timeseries_data_to_file.h"
+#include "timeseries_recording_toolkit/shared_memory_recorder.h"
 
 
 class RemoteMutexService;
 
 void Record(RemoteMutexService* mut);
+void Diagnose(RemoteMutexService* mut);
 
 task_net::NodeBitmask GetBitmask(std::string name) {
     // ROS_INFO("Node::GetBitmask was called!!!!\n");
@@ -45,55 +55,216 @@ task_net::NodeBitmask GetBitmask(std::string name) {
   return mask;
 }
 
+// Default time lock requests for a free mutex are collected before one of
+// them is granted
+#define DEFAULT_ARBITRATION_WINDOW_MS 50
+// Default lease of a granted lock. Clients renew at half the lease; a
+// holder that stops renewing loses its resources after one lease.
+#define DEFAULT_LEASE_S 10.0
+// Service calls handled at once; every queued lock request holds one
+#define SERVICE_THREADS 32
+// Lock requests queued at most. The other service threads stay free for
+// the releases, renewals and cancels that serve the queue.
+#define MAX_WAITERS (SERVICE_THREADS - 8)
+// Default period of the lock metrics on /diagnostics
+#define DEFAULT_DIAGNOSTICS_PERIOD_S 1.0
 
-class RemoteMutexService {
- public:
+// One named resource (an arm, a workspace zone, the human's reach)
+struct Resource_t {
   bool locked;
   std::string owner;
-  ros::ServiceServer service;
+  float activation_potential;
+  // Fencing token of the current grant, 0 when never granted
+  uint64_t token;
+  boost::posix_time::ptime expires;
+};
+
+// A lock request waiting for its arbitration round
+struct Candidate_t {
+  std::string name;
+  task_net::NodeBitmask mask;
+  float activation_potential;
+  std::vector<std::string> resources;
+  boost::posix_time::time_duration lease;
+  // How long a denied request waits in the queue, 0 for not at all
+  boost::posix_time::time_duration wait;
+};
+
+// Higher activation potential first, then the lower robot, then the lower
+// node, so every round has one deterministic outcome
+bool Outranks(const Candidate_t &a, const Candidate_t &b) {
+  if (a.activation_potential != b.activation_potential)
+    return a.activation_potential > b.activation_potential;
+  if (a.mask.robot != b.mask.robot)
+    return a.mask.robot < b.mask.robot;
+  if (a.mask.node != b.mask.node)
+    return a.mask.node < b.mask.node;
+  return a.name < b.name;
+}
+
+// Lock requests that reached free resources within one window
+struct ArbitrationRound_t {
+  boost::posix_time::ptime start;
+  boost::posix_time::ptime end;
+  std::vector<Candidate_t> candidates;
+  bool decided;
+  // Per candidate: fencing token of the grant, 0 when denied
+  std::vector<uint64_t> tokens;
+  // Per denied candidate: why
+  std::vector<mutex::Denial_t> reasons;
+};
+typedef boost::shared_ptr<ArbitrationRound_t> ArbitrationRoundPtr;
+
+// A lock request queued until its resources are released
+struct Waiter_t {
+  Candidate_t candidate;
+  boost::posix_time::ptime deadline;
+  bool done;
+  bool cancelled;
+  // Fencing token of the grant, 0 when denied or cancelled
+  uint64_t token;
+};
+typedef boost::shared_ptr<Waiter_t> WaiterPtr;
+
+typedef boost::function<bool(remote_mutex::remote_mutex_msg::Request&,
+  remote_mutex::remote_mutex_msg::Response&)> MutexCallback;
+
+class RemoteMutexService {
+ public:
+  std::vector<ros::ServiceServer> services;
   ros::NodeHandle ns;
   ros::Subscriber state_subscriber_;
   std::string root_topic_;
-  float activation_potential;
   boost::mutex mut;
   boost::thread* record_thread;
   std::ofstream file;
-  recording_toolkit::FilePrintRecorder record_object;
+  // Owner log, into the timeseries_recording_server with /recording_server
+  // set, into remote_mutex_<number>.csv segments with /record_segment_mb
+  // set and into remote_mutex.csv otherwise
+  recording_toolkit::PrintRecorder *record_object;
   int enum_robot_; 
+  // Every resource of this server, by name
+  std::map<std::string, Resource_t> resources_;
+  uint64_t last_token_;
+  boost::posix_time::time_duration default_lease_;
+  // Arbitration of competing lock requests
+  boost::posix_time::time_duration arbitration_window_;
+  ArbitrationRoundPtr round_;
+  boost::condition_variable round_cv_;
+  // Requests waiting for held resources, best first by Outranks
+  std::vector<WaiterPtr> waiters_;
+  boost::condition_variable waiters_cv_;
+  // Wait, hold and denial statistics
+  mutex::MutexMetrics metrics_;
+  ros::Publisher diagnostics_pub_;
+  boost::thread* diagnostics_thread;
+  double diagnostics_period_;
+  std::string metrics_file_;
 
   // ros info
   robotics_task_tree_msgs::State top_level_state_;
 
-  explicit RemoteMutexService(const char* name)
-      : record_object("/home/bashira/catkin_ws/src/Distributed_Collaborative_Task_Tree/Data/remote_mutex.csv",
-        100) {
-    locked = false;
-    owner = "";
-    activation_potential = 0.0f;
-    service = ns.advertiseService(
-      name,
-      &RemoteMutexService::MutexRequest,
-      this);
+  // Every name is advertised as a service whose requests default to the
+  // resource of the same name
+  explicit RemoteMutexService(const std::vector<std::string> &names) {
+    last_token_ = 0;
+    for (size_t i = 0; i < names.size(); ++i) {
+      Resource(names[i]);
+      MutexCallback callback = boost::bind(&RemoteMutexService::MutexRequest,
+        this, names[i], _1, _2);
+      services.push_back(ns.advertiseService(names[i], callback));
+    }
 
     ns.param<std::string>( "/topic", root_topic_, "AND_2_0_006_state");
     ns.param<int>( "/enum_robot", enum_robot_, 0);
+    int window_ms;
+    ns.param<int>( "/arbitration_window_ms", window_ms,
+      DEFAULT_ARBITRATION_WINDOW_MS);
+    arbitration_window_ = boost::posix_time::millisec(window_ms);
+    double lease_s;
+    ns.param<double>( "/lease_s", lease_s, DEFAULT_LEASE_S);
+    default_lease_ = boost::posix_time::microseconds(
+      static_cast<int64_t>(lease_s * 1e6));
+    ns.param<double>( "/diagnostics_period_s", diagnostics_period_,
+      DEFAULT_DIAGNOSTICS_PERIOD_S);
+    std::string record_dir;
+    ns.param<std::string>( "/record_dir", record_dir,
+      "/home/bashira/catkin_ws/src/Distributed_Collaborative_Task_Tree/Data");
+    ns.param<std::string>( "/metrics_file", metrics_file_,
+      record_dir + "/remote_mutex_metrics.txt");
+    bool recording_server;
+    double segment_mb, segment_age_s, retain_mb;
+    ns.param<bool>( "/recording_server", recording_server, false);
+    ns.param<double>( "/record_segment_mb", segment_mb, 0.0);
+    ns.param<double>( "/record_segment_age_s", segment_age_s, 0.0);
+    ns.param<double>( "/record_retain_mb", retain_mb, 0.0);
+    if (recording_server) {
+      record_object = new recording_toolkit::SharedMemoryRecorder(
+        "remote_mutex", DEFAULT_SHARED_RING_BYTES, 100);
+    } else if (segment_mb > 0.0) {
+      recording_toolkit::SegmentPolicy policy;
+      policy.max_bytes = segment_mb * (1 << 20);
+      policy.max_age_ns = segment_age_s * 1e9;
+      policy.retain_bytes = retain_mb * (1 << 20);
+      if (!recording_toolkit::SegmentWriter::Usable(record_dir))
+        ROS_ERROR("Mutex: /record_dir \"%s\" is not a writable directory, "
+          "not recording", record_dir.c_str());
+      record_object = new recording_toolkit::FilePrintRecorder(record_dir,
+        "remote_mutex", policy, 100);
+    } else {
+      record_object = new recording_toolkit::FilePrintRecorder(
+        (record_dir + "/remote_mutex.csv").c_str(), 100);
+    }
+    recording_toolkit::RecordSchema schema;
+    schema.Field<double>("time").Field<std::string>("owners");
+    record_object->SetSchema(schema);
     state_subscriber_ = ns.subscribe(root_topic_, 1000, &RemoteMutexService::RootStateCallback, this );
+    diagnostics_pub_ = ns.advertise<diagnostic_msgs::DiagnosticArray>(
+      "/diagnostics", 10);
 
     record_thread = new boost::thread(&Record, this);
-    record_object.StartRecord();
+    diagnostics_thread = new boost::thread(&Diagnose, this);
+    record_object->StartRecord();
   }
 
   ~RemoteMutexService() {
+    // Both threads use record_object and metrics_, stop them first. They
+    // leave at their next sleep.
+    record_thread->interrupt();
+    diagnostics_thread->interrupt();
+    record_thread->join();
+    diagnostics_thread->join();
     delete record_thread;
-    // record_object.WaitUntilFinishedWriting();
-    record_object.StopRecord();
+    delete diagnostics_thread;
+    record_object->StopRecord();
+    delete record_object;
+    // Final statistics of the run
+    std::stringstream metrics;
+    metrics_.Dump(metrics, mutex::SimClock::Now());
+    ROS_INFO("remote mutex metrics:\n%s", metrics.str().c_str());
+    std::ofstream out(metrics_file_.c_str());
+    out << metrics.str();
+  }
+
+  void PublishDiagnostics() {
+    diagnostics_pub_.publish(metrics_.Diagnostics(mutex::SimClock::Now()));
   }
 
   void RecordToFile() {
     boost::posix_time::ptime time_t_epoch(boost::gregorian::date(1970,1,1));
-    boost::posix_time::time_duration diff = boost::posix_time::microsec_clock::universal_time() - time_t_epoch;
+    boost::posix_time::time_duration diff = mutex::SimClock::Now() - time_t_epoch;
     double seconds = (double)diff.total_seconds() + (double)diff.fractional_seconds() / 1000000.0;
-    record_object.RecordPrintf("%f, %s\n", seconds, owner.c_str() );
+    std::string owners;
+    {
+      boost::lock_guard<boost::mutex> lock(mut);
+      for (std::map<std::string, Resource_t>::iterator it = resources_.begin();
+          it != resources_.end(); ++it) {
+        if (!owners.empty())
+          owners += ", ";
+        owners += it->second.locked ? it->second.owner : "";
+      }
+    }
+    record_object->Record(seconds, owners);
   }
 
   void RootStateCallback( robotics_task_tree_msgs::State msg)
@@ -103,112 +274,373 @@ class RemoteMutexService {
     top_level_state_ = msg;
   }
 
-  bool MutexRequest(remote_mutex::remote_mutex_msg::Request &req,
+  // The named resource, created free on first use. Called with mut held.
+  Resource_t& Resource(const std::string &name) {
+    std::map<std::string, Resource_t>::iterator it = resources_.find(name);
+    if (it == resources_.end()) {
+      Resource_t resource;
+      resource.locked = false;
+      resource.activation_potential = 0.0f;
+      resource.token = 0;
+      it = resources_.insert(std::make_pair(name, resource)).first;
+    }
+    return it->second;
+  }
+
+  // Whether the resource is held by a lease that has not run out. Expired
+  // leases are reclaimed here. Called with mut held.
+  bool Held(const std::string &name, const boost::posix_time::ptime &now) {
+    Resource_t &resource = Resource(name);
+    if (resource.locked && !resource.expires.is_pos_infinity()
+        && now > resource.expires) {
+      ROS_WARN("Lease of %s on %s expired, reclaiming", resource.owner.c_str(),
+        name.c_str());
+      metrics_.Released(resource.token, now, true);
+      resource.locked = false;
+      resource.owner = "";
+      resource.activation_potential = 0.0f;
+    }
+    return resource.locked;
+  }
+
+  // The resources a request names, the service's own one when none
+  std::vector<std::string> RequestedResources(
+      const std::string &service_resource,
+      const remote_mutex::remote_mutex_msg::Request &req) {
+    std::vector<std::string> names(req.resources.begin(),
+      req.resources.end());
+    if (names.empty())
+      names.push_back(service_resource);
+    std::sort(names.begin(), names.end());
+    names.erase(std::unique(names.begin(), names.end()), names.end());
+    return names;
+  }
+
+  // Whether the request may hold the mutex at all, reason tells why not
+  bool Eligible(const Candidate_t &candidate, mutex::Denial_t *reason) {
+    if (candidate.activation_potential <= 0.001) {
+      *reason = mutex::DENIED_NO_POTENTIAL;
+      ROS_INFO( "Activation Potential <= 0, no lock granted: %s",
+        candidate.name.c_str());
+      return false;
+    }
+    // ------------------------------------------------------
+    // HACK THE HUMAN FOR NOW!
+    if( enum_robot_ == 0 )
+      return true;
+    // ------------------------------------------------------
+    // is this node the node that has the higest activation potential
+    if( is_eq(candidate.mask, top_level_state_.highest)
+        && (top_level_state_.highest.type == 3) )
+      return true;
+    ROS_INFO("Not Highest Activation Potential - Denied Access: [%d %d %d/ %s]", top_level_state_.highest.type, top_level_state_.highest.robot, top_level_state_.highest.node, candidate.name.c_str());
+    *reason = mutex::DENIED_NOT_HIGHEST;
+    return false;
+  }
+
+  // Close the round. Eligible candidates are served best first, each one
+  // gets all of its resources or none of them. Called with mut held.
+  void Decide(ArbitrationRoundPtr round) {
+    std::vector<size_t> order;
+    round->reasons.assign(round->candidates.size(), mutex::DENIED_LOST_ROUND);
+    for (size_t i = 0; i < round->candidates.size(); ++i) {
+      if (Eligible(round->candidates[i], &round->reasons[i]))
+        order.push_back(i);
+    }
+    for (size_t i = 1; i < order.size(); ++i) {
+      for (size_t j = i; j > 0 && Outranks(round->candidates[order[j]],
+          round->candidates[order[j - 1]]); --j)
+        std::swap(order[j], order[j - 1]);
+    }
+    boost::posix_time::ptime now = mutex::SimClock::Now();
+    round->tokens.assign(round->candidates.size(), 0);
+    for (size_t i = 0; i < order.size(); ++i)
+      round->tokens[order[i]] = Grant(round->candidates[order[i]], now);
+    round->decided = true;
+    if (round_ == round)
+      round_.reset();
+    round_cv_.notify_all();
+  }
+
+  // Hand all of the candidate's resources over if every one is free.
+  // Returns the fencing token, 0 when a resource is held. Called with mut
+  // held.
+  uint64_t Grant(const Candidate_t &candidate,
+      const boost::posix_time::ptime &now) {
+    for (size_t r = 0; r < candidate.resources.size(); ++r) {
+      if (Held(candidate.resources[r], now))
+        return 0;
+    }
+    uint64_t token = ++last_token_;
+    for (size_t r = 0; r < candidate.resources.size(); ++r) {
+      Resource_t &resource = Resource(candidate.resources[r]);
+      resource.locked = true;
+      resource.owner = candidate.name;
+      resource.activation_potential = candidate.activation_potential;
+      resource.token = token;
+      resource.expires = candidate.lease.is_pos_infinity()
+        ? boost::posix_time::ptime(boost::posix_time::pos_infin)
+        : now + candidate.lease;
+    }
+    return token;
+  }
+
+  // Hand freed resources to the queue, best waiter first. The woken
+  // waiter answers its own blocked call, so a release reaches the next
+  // holder within one round trip. Called with mut held.
+  void Serve() {
+    boost::posix_time::ptime now = mutex::SimClock::Now();
+    bool served = false;
+    for (size_t i = 0; i < waiters_.size();) {
+      WaiterPtr waiter = waiters_[i];
+      uint64_t token = 0;
+      mutex::Denial_t reason;
+      if (now <= waiter->deadline && Eligible(waiter->candidate, &reason))
+        token = Grant(waiter->candidate, now);
+      if (!token) {
+        ++i;
+        continue;
+      }
+      waiter->token = token;
+      waiter->done = true;
+      waiters_.erase(waiters_.begin() + i);
+      served = true;
+    }
+    if (served)
+      waiters_cv_.notify_all();
+  }
+
+  // Earliest lease expiry among the resources, the waiter checks again
+  // then. Called with mut held.
+  boost::posix_time::ptime NextExpiry(const Candidate_t &candidate) {
+    boost::posix_time::ptime next(boost::posix_time::pos_infin);
+    for (size_t r = 0; r < candidate.resources.size(); ++r) {
+      Resource_t &resource = Resource(candidate.resources[r]);
+      if (resource.locked && resource.expires < next)
+        next = resource.expires;
+    }
+    return next;
+  }
+
+  // Queue a denied request until its resources are handed to it, its
+  // wait runs out or it is cancelled. Returns the fencing token, 0 when
+  // not granted or when the queue is full.
+  uint64_t Enqueue(const Candidate_t &candidate,
+      boost::unique_lock<boost::mutex> &lock, mutex::Denial_t *reason) {
+    if (waiters_.size() >= MAX_WAITERS) {
+      ROS_WARN("Mutex Queue Full - Denied Access: %s (%zu waiting)",
+        candidate.name.c_str(), waiters_.size());
+      *reason = mutex::DENIED_LOCKED;
+      return 0;
+    }
+    WaiterPtr waiter(new Waiter_t);
+    waiter->candidate = candidate;
+    waiter->deadline = mutex::SimClock::Now() + candidate.wait;
+    waiter->done = false;
+    waiter->cancelled = false;
+    waiter->token = 0;
+    std::vector<WaiterPtr>::iterator it = waiters_.begin();
+    while (it != waiters_.end() && !Outranks(candidate, (*it)->candidate))
+      ++it;
+    ROS_INFO("Mutex Locked - Queued: %s at %zu", candidate.name.c_str(),
+      static_cast<size_t>(it - waiters_.begin()));
+    waiters_.insert(it, waiter);
+
+    while (!waiter->done) {
+      boost::posix_time::ptime now = mutex::SimClock::Now();
+      boost::posix_time::ptime expiry = NextExpiry(candidate);
+      if (now > waiter->deadline) {
+        waiters_.erase(std::find(waiters_.begin(), waiters_.end(), waiter));
+        waiter->done = true;
+      } else if (now > expiry) {
+        // a holder stopped renewing, reclaim and pass on its resources
+        Serve();
+      } else {
+        mutex::SimClock::TimedWait(waiters_cv_, lock,
+          std::min(waiter->deadline, expiry));
+      }
+    }
+    *reason = waiter->cancelled ? mutex::DENIED_CANCELLED
+      : mutex::DENIED_WAIT_TIMEOUT;
+    return waiter->token;
+  }
+
+  // Drop every queued request of the requester
+  bool Cancel(remote_mutex::remote_mutex_msg::Request &req,
       remote_mutex::remote_mutex_msg::Response &res) {
+    boost::lock_guard<boost::mutex> lock(mut);
+    res.success = false;
+    for (size_t i = 0; i < waiters_.size();) {
+      if (waiters_[i]->candidate.name != req.name) {
+        ++i;
+        continue;
+      }
+      waiters_[i]->done = true;
+      waiters_[i]->cancelled = true;
+      waiters_.erase(waiters_.begin() + i);
+      res.success = true;
+    }
+    if (res.success) {
+      ROS_INFO("Mutex Wait Cancelled: %s", req.name.c_str());
+      waiters_cv_.notify_all();
+    }
+    return true;
+  }
 
-    boost::this_thread::sleep(boost::posix_time::millisec(200));
-    if (req.request) {
+  // Fill in the outcome of a lock request and count it. Called with mut
+  // held.
+  void Report(const Candidate_t &candidate,
+      const boost::posix_time::ptime &arrived, mutex::Denial_t reason,
+      remote_mutex::remote_mutex_msg::Response *res) {
+    boost::posix_time::ptime now = mutex::SimClock::Now();
+    res->success = res->token != 0;
+    res->arbitration_latency = (now - arrived).total_microseconds() / 1e6;
+    if (res->success)
+      metrics_.Granted(candidate.name, res->token, res->arbitration_latency,
+        now);
+    else
+      metrics_.Denied(candidate.name, reason, res->arbitration_latency);
+  }
 
-      // sleep diff rates between pr2 and baxter to offset them activating nodes at the same time...
-      int offset = 75*enum_robot_;
-      boost::this_thread::sleep(boost::posix_time::millisec(200+offset));
-      ROS_INFO("\tWAITED %d", 200+offset);
+  // Lock requests for free resources open an arbitration round, requests
+  // arriving within the window join it, and the round is decided once the
+  // window has passed. A request for a held resource, or one losing the
+  // round, is queued for as long as it asked to wait.
+  bool Arbitrate(const std::string &service_resource,
+      remote_mutex::remote_mutex_msg::Request &req,
+      remote_mutex::remote_mutex_msg::Response &res) {
+    boost::unique_lock<boost::mutex> lock(mut);
+    boost::posix_time::ptime arrived = mutex::SimClock::Now();
+    Candidate_t candidate;
+    candidate.name = req.name;
+    candidate.mask = GetBitmask(req.name);
+    candidate.activation_potential = req.activation_potential;
+    candidate.resources = RequestedResources(service_resource, req);
+    candidate.lease = req.lease > 0.0f
+      ? boost::posix_time::microseconds(static_cast<int64_t>(req.lease * 1e6))
+      : default_lease_;
+    candidate.wait = boost::posix_time::microseconds(
+      static_cast<int64_t>(std::max(req.wait, 0.0f) * 1e6));
+    res.lease = candidate.lease.is_pos_infinity() ? 0.0f
+      : candidate.lease.total_microseconds() / 1e6;
+    ROS_INFO("asking for mutex lock [%f] %s on %s (+%zu)", req.activation_potential, req.name.c_str(), candidate.resources[0].c_str(), candidate.resources.size() - 1);
+    for (size_t r = 0; r < candidate.resources.size(); ++r) {
+      if (Held(candidate.resources[r], arrived)) {
+        ROS_INFO("Mutex Already Locked - Denied Access: %s (%s held by %s)", req.name.c_str(), candidate.resources[r].c_str(), Resource(candidate.resources[r]).owner.c_str());
+        mutex::Denial_t reason = mutex::DENIED_LOCKED, ineligible;
+        if (candidate.wait.total_microseconds() > 0
+            && Eligible(candidate, &ineligible))
+          res.token = Enqueue(candidate, lock, &reason);
+        Report(candidate, arrived, reason, &res);
+        return true;
+      }
+    }
+    if (!round_) {
+      round_.reset(new ArbitrationRound_t);
+      round_->start = arrived;
+      round_->end = arrived + arbitration_window_;
+      round_->decided = false;
+    }
+    ArbitrationRoundPtr round = round_;
+    size_t index = round->candidates.size();
+    round->candidates.push_back(candidate);
 
+    while (!round->decided) {
+      if (mutex::SimClock::Now() >= round->end)
+        Decide(round);
+      else
+        mutex::SimClock::TimedWait(round_cv_, lock, round->end);
+    }
+
+    res.token = round->tokens[index];
+    mutex::Denial_t reason = round->reasons[index];
+    if (!res.token && candidate.wait.total_microseconds() > 0
+        && reason == mutex::DENIED_LOST_ROUND)
+      res.token = Enqueue(candidate, lock, &reason);
+    Report(candidate, arrived, reason, &res);
+    if (res.success)
+      ROS_INFO("Mutex Locked - Granted Access: %s token %lu (%zu competing, %.3f s)",
+        req.name.c_str(), (unsigned long)res.token, round->candidates.size(),
+        res.arbitration_latency);
+    else
+      ROS_INFO("Mutex Arbitration Lost - Denied Access: %s (%zu competing, %.3f s)",
+        req.name.c_str(), round->candidates.size(), res.arbitration_latency);
+    return true;
+  }
 
-      ROS_INFO("asking for mutex lock [%f / %f] %s", activation_potential, req.activation_potential, req.name.c_str());
+  // A token of 0 comes from a client without fencing and matches any holder
+  bool Matches(const Resource_t &resource,
+      const remote_mutex::remote_mutex_msg::Request &req) {
+    return req.token == 0 || req.token == resource.token;
+  }
 
-      if (locked) {
+  // Extend the lease of every named resource the token holds
+  bool Renew(const std::string &service_resource,
+      remote_mutex::remote_mutex_msg::Request &req,
+      remote_mutex::remote_mutex_msg::Response &res) {
+    boost::lock_guard<boost::mutex> lock(mut);
+    boost::posix_time::ptime now = mutex::SimClock::Now();
+    std::vector<std::string> names = RequestedResources(service_resource, req);
+    boost::posix_time::time_duration lease = req.lease > 0.0f
+      ? boost::posix_time::microseconds(static_cast<int64_t>(req.lease * 1e6))
+      : default_lease_;
+    res.success = true;
+    for (size_t r = 0; r < names.size(); ++r) {
+      Resource_t &resource = Resource(names[r]);
+      if (!Held(names[r], now) || !Matches(resource, req)) {
+        ROS_WARN("Lease renewal of %s by %s denied, lock lost", names[r].c_str(), req.name.c_str());
         res.success = false;
-        ROS_INFO("Mutex Already Locked - Denied Access: %s", req.name.c_str());
-      } 
-      else {
-
-        // TODO: Remove this line!
-        ROS_INFO("top_level_state_.highest.node: %d ", top_level_state_.highest.node);
-        std::cout<< req.name;
-
-        // is this node the node that has the higest activation potential
-        printf("owner.type %d\n\n\n\n\n",top_level_state_.highest.type);
-
-        // ------------------------------------------------------
-        // HACK THE HUMAN FOR NOW!
-        if( enum_robot_ == 0 ) {
-          ROS_WARN("BUT WE ARE LOCKING ANYWAY!");
-          mut.lock();
-          activation_potential = req.activation_potential;
-          mut.unlock();
-          if( activation_potential > 0.001 )
-          {
-            ROS_INFO("Mutex Locked - Granted Access: %s", req.name.c_str());
-            mut.lock();
-            locked = true;
-            owner = req.name;
-            mut.unlock();
-            res.success = true;        
-          }
-          else
-          {
-            ROS_INFO( "Activation Potential <= 0, no lock granted");
-            res.success = false;
-          }
-        }
-        // ------------------------------------------------------
-
-        else if( is_eq(GetBitmask(req.name), top_level_state_.highest) && (top_level_state_.highest.type == 3) )
-        //if( is_eq(GetBitmask(req.name), top_level_state_.highest) )
-        {
-
-          mut.lock();
-          activation_potential = req.activation_potential;
-          mut.unlock();
-          if( activation_potential > 0.001 )
-          {
-            ROS_INFO("Mutex Locked - Granted Access: %s", req.name.c_str());
-            mut.lock();
-            locked = true;
-            owner = req.name;
-            mut.unlock();
-            res.success = true;        
-          }
-          else
-          {
-            ROS_INFO( "Activation Potential <= 0, no lock granted");
-            res.success = false;
-          }
-        }
-        else {
-          ROS_INFO("Not Highest Activation Potential - Denied Access: [%d %d %d/ %s]", top_level_state_.highest.type, top_level_state_.highest.robot, top_level_state_.highest.node, req.name.c_str());
-          res.success = false;
-        }
+        continue;
       }
-    } 
-    else 
-    {
-      ROS_INFO( "asking for mutex release: [%s / %s]", owner.c_str(), req.name.c_str());
-      if (locked) 
+      resource.expires = now + lease;
+      res.token = resource.token;
+    }
+    res.lease = lease.total_microseconds() / 1e6;
+    return true;
+  }
+
+  bool MutexRequest(const std::string &service_resource,
+      remote_mutex::remote_mutex_msg::Request &req,
+      remote_mutex::remote_mutex_msg::Response &res) {
+    res.arbitration_latency = 0.0f;
+    res.token = 0;
+    res.lease = 0.0f;
+    if (req.cancel)
+      return Cancel(req, res);
+    if (req.request && req.renew)
+      return Renew(service_resource, req, res);
+    if (req.request)
+      return Arbitrate(service_resource, req, res);
+
+    boost::lock_guard<boost::mutex> lock(mut);
+    boost::posix_time::ptime now = mutex::SimClock::Now();
+    std::vector<std::string> names = RequestedResources(service_resource, req);
+    res.success = false;
+    for (size_t r = 0; r < names.size(); ++r) {
+      Resource_t &resource = Resource(names[r]);
+      ROS_INFO( "asking for mutex release: [%s / %s] %s", resource.owner.c_str(), req.name.c_str(), names[r].c_str());
+      if (!Held(names[r], now))
       {
-        //if (req.name == owner) 
-        //{
-          mut.lock();
-          locked = false;
-          owner = "";
-          activation_potential = 0.0f;
-          mut.unlock();
-          res.success = true;
-          ROS_INFO("Mutex Unlocked - Granted Access: %s", req.name.c_str());
-       // } 
-        //else 
-        //{
-         // res.success = false;
-       //   ROS_INFO("Mutex Locked - Denied Access: %s", req.name.c_str());
-      //  }
+        ROS_INFO("Mutex Already Unlocked: %s", req.name.c_str());
       }
-      else 
+      else if (!Matches(resource, req))
       {
-        res.success = false;
-        ROS_INFO("Mutex Already Unlocked: %s", req.name.c_str());
+        // a holder whose lease ran out must not free the next grant
+        ROS_WARN("Stale token %lu of %s - Release Denied: %s",
+          (unsigned long)req.token, req.name.c_str(), names[r].c_str());
+      }
+      else
+      {
+        resource.locked = false;
+        resource.owner = "";
+        resource.activation_potential = 0.0f;
+        metrics_.Released(resource.token, now, false);
+        res.success = true;
+        ROS_INFO("Mutex Unlocked - Granted Access: %s", req.name.c_str());
       }
     }
+    if (res.success)
+      Serve();
 
     return true;
   }
@@ -216,16 +648,28 @@ class RemoteMutexService {
 };
 
 void Record(RemoteMutexService* mut) {
+  mutex::SimClock::Client client;
   while (true) {
     mut->RecordToFile();
-    boost::this_thread::sleep(boost::posix_time::millisec(50));
+    mutex::SimClock::Sleep(boost::posix_time::millisec(50));
+  }
+}
+// Lock metrics on /diagnostics for as long as the server runs
+void Diagnose(RemoteMutexService* mut) {
+  mutex::SimClock::Client client;
+  while (true) {
+    mutex::SimClock::Sleep(boost::posix_time::microseconds(
+      static_cast<int64_t>(mut->diagnostics_period_ * 1e6)));
+    mut->PublishDiagnostics();
   }
 }
 int main(int argc, char **argv) {
   ros::init(argc, argv, "remote_mutex_server");
   if (argc >= 2) {
-    RemoteMutexService mutex(argv[1]);
-    ros::AsyncSpinner spinner(8);
+    // One server for every resource named on the command line
+    std::vector<std::string> names(argv + 1, argv + argc);
+    RemoteMutexService mutex(names);
+    ros::AsyncSpinner spinner(SERVICE_THREADS);
     spinner.start();
     ros::waitForShutdown();
   } else {
@@ -233,4 +677,4 @@ int main(int argc, char **argv) {
     return -1;
   }
   return 0;
-}
\ No newline at end of file
+}
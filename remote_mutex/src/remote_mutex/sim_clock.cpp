@@ -0,0 +1,264 @@
+/*
+remote_mutex
+Copyright (C) 2015  Luke Fraser
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#include "remote_mutex/sim_clock.h"
+#include <sstream>
+
+#define SIM_CLOCK_REQUEST_TOPIC "/sim_clock/request"
+// Wall time the clock tries to take the mutex of a wait it wakes
+#define SIM_WAKE_LOCK_MS 10
+
+namespace mutex {
+
+boost::thread_specific_ptr<bool> SimClock::client_;
+SimClock *SimClock::instance_ = NULL;
+bool SimClock::checked_ = false;
+boost::mutex SimClock::instance_mut_;
+
+SimClock::Client::Client() {
+  SimClock::client_.reset(new bool(true));
+  SimClock *clock = SimClock::Instance();
+  if (clock)
+    clock->Announce(robotics_task_tree_msgs::SimClockRequest::AWAKE,
+      ros::Time());
+}
+
+SimClock::Client::~Client() {
+  SimClock *clock = SimClock::Instance();
+  if (clock)
+    clock->Announce(robotics_task_tree_msgs::SimClockRequest::LEFT,
+      ros::Time());
+  SimClock::client_.reset();
+}
+
+SimClock::Blocked::Blocked() {
+  SimClock *clock = SimClock::Instance();
+  if (clock && SimClock::IsClient())
+    clock->Announce(robotics_task_tree_msgs::SimClockRequest::SLEEPING,
+      ros::Time());
+}
+
+SimClock::Blocked::~Blocked() {
+  SimClock *clock = SimClock::Instance();
+  if (clock && SimClock::IsClient())
+    clock->Announce(robotics_task_tree_msgs::SimClockRequest::AWAKE,
+      ros::Time());
+}
+
+SimClock::SimClock() : spinner_(NULL) {
+  process_ = ros::this_node::getName();
+  nh_.setCallbackQueue(&queue_);
+  request_pub_ = nh_.advertise<robotics_task_tree_msgs::SimClockRequest>(
+    SIM_CLOCK_REQUEST_TOPIC, 1000);
+  clock_sub_ = nh_.subscribe("/clock", 10, &SimClock::ReceiveClock, this,
+    ros::TransportHints().tcpNoDelay());
+  spinner_ = new ros::AsyncSpinner(1, &queue_);
+  spinner_->start();
+}
+
+SimClock* SimClock::Instance() {
+  boost::lock_guard<boost::mutex> lock(instance_mut_);
+  if (!checked_ && ros::isInitialized()) {
+    checked_ = true;
+    bool use_sim_time = false;
+    ros::param::get("/use_sim_time", use_sim_time);
+    if (use_sim_time) {
+      instance_ = new SimClock();
+      ROS_INFO("SimClock: waiting on the simulated clock");
+    }
+  }
+  return instance_;
+}
+
+bool SimClock::IsClient() {
+  return client_.get() && *client_;
+}
+
+bool SimClock::Enabled() {
+  return Instance() != NULL;
+}
+
+boost::posix_time::ptime SimClock::Now() {
+  SimClock *clock = Instance();
+  if (!clock)
+    return boost::posix_time::microsec_clock::universal_time();
+  return clock->Current().toBoost();
+}
+
+void SimClock::Sleep(boost::posix_time::time_duration duration) {
+  if (!Instance()) {
+    boost::this_thread::sleep(duration);
+    return;
+  }
+  SleepUntil(Now() + duration);
+}
+
+void SimClock::Sleep(const ros::Duration &duration) {
+  Sleep(boost::posix_time::microseconds(duration.toNSec() / 1000));
+}
+
+void SimClock::SleepUntil(const boost::posix_time::ptime &deadline) {
+  SimClock *clock = Instance();
+  if (!clock) {
+    boost::this_thread::sleep(deadline);
+    return;
+  }
+  ros::Time wakeup = ros::Time::fromBoost(deadline);
+  if (clock->Current() >= wakeup)
+    return;
+  clock->Announce(robotics_task_tree_msgs::SimClockRequest::SLEEPING, wakeup);
+  try {
+    boost::unique_lock<boost::mutex> lock(clock->mut_);
+    while (clock->now_ < wakeup)
+      clock->cv_.wait(lock);
+  }
+  catch (boost::thread_interrupted&) {
+    clock->EndWait();
+    throw;
+  }
+  // The server marks a client awake itself when it reaches the wakeup
+  if (!IsClient())
+    clock->EndWait();
+}
+
+bool SimClock::TimedWait(boost::condition_variable &cv,
+    boost::unique_lock<boost::mutex> &lock,
+    const boost::posix_time::ptime &deadline) {
+  SimClock *clock = Instance();
+  if (!clock)
+    return cv.timed_wait(lock, deadline);
+  ros::Time wakeup = ros::Time::fromBoost(deadline);
+  if (clock->Current() >= wakeup)
+    return false;
+  clock->Announce(robotics_task_tree_msgs::SimClockRequest::SLEEPING, wakeup);
+  Waiter_t waiter = {&cv, lock.mutex(), wakeup, false};
+  clock->AddWaiter(&waiter);
+  bool notified = false;
+  try {
+    // Checked after registering, so a clock reaching the wakeup in between
+    // is seen here or notifies the wait
+    if (clock->Current() < wakeup) {
+      cv.wait(lock);
+      notified = clock->Current() < wakeup;
+    }
+  }
+  catch (boost::thread_interrupted&) {
+    clock->RemoveWaiter(&waiter);
+    clock->EndWait();
+    throw;
+  }
+  clock->RemoveWaiter(&waiter);
+  if (notified || !IsClient())
+    clock->EndWait();
+  return notified;
+}
+
+void SimClock::Wait(boost::condition_variable &cv,
+    boost::unique_lock<boost::mutex> &lock) {
+  SimClock *clock = Instance();
+  if (!clock) {
+    cv.wait(lock);
+    return;
+  }
+  clock->Announce(robotics_task_tree_msgs::SimClockRequest::SLEEPING,
+    ros::Time());
+  try {
+    cv.wait(lock);
+  }
+  catch (boost::thread_interrupted&) {
+    clock->EndWait();
+    throw;
+  }
+  clock->EndWait();
+}
+
+void SimClock::Announce(uint8_t state, const ros::Time &wakeup) {
+  std::ostringstream client;
+  client << process_ << "/" << boost::this_thread::get_id();
+  robotics_task_tree_msgs::SimClockRequest msg;
+  msg.client = client.str();
+  msg.state = state;
+  msg.wakeup = wakeup;
+  request_pub_.publish(msg);
+}
+
+void SimClock::EndWait() {
+  Announce(IsClient() ? robotics_task_tree_msgs::SimClockRequest::AWAKE
+    : robotics_task_tree_msgs::SimClockRequest::LEFT, ros::Time());
+}
+
+void SimClock::ReceiveClock(const rosgraph_msgs::Clock::ConstPtr &msg) {
+  {
+    boost::lock_guard<boost::mutex> lock(mut_);
+    if (msg->clock <= now_)
+      return;
+    now_ = msg->clock;
+  }
+  cv_.notify_all();
+  WakeWaiters(msg->clock);
+}
+
+// The mutex of a wait is taken to notify it, so a waiter between its clock
+// check and cv.wait does not miss the notification. The waiter holds it only
+// briefly; a mutex still taken after SIM_WAKE_LOCK_MS is held by another
+// thread while the waiter waits, and it is notified without.
+void SimClock::WakeWaiters(const ros::Time &now) {
+  boost::posix_time::ptime give_up =
+    boost::posix_time::microsec_clock::universal_time()
+    + boost::posix_time::millisec(SIM_WAKE_LOCK_MS);
+  bool pending = true;
+  while (pending) {
+    pending = false;
+    bool force = boost::posix_time::microsec_clock::universal_time()
+      > give_up;
+    {
+      boost::lock_guard<boost::mutex> lock(waiters_mut_);
+      for (std::set<Waiter_t*>::iterator it = waiters_.begin();
+          it != waiters_.end(); ++it) {
+        Waiter_t *waiter = *it;
+        if (waiter->woken || waiter->wakeup > now)
+          continue;
+        boost::unique_lock<boost::mutex> waiter_lock(*waiter->mut,
+          boost::try_to_lock);
+        if (!waiter_lock.owns_lock() && !force) {
+          pending = true;
+          continue;
+        }
+        waiter->woken = true;
+        waiter->cv->notify_all();
+      }
+    }
+    if (pending)
+      boost::this_thread::yield();
+  }
+}
+
+void SimClock::AddWaiter(Waiter_t *waiter) {
+  boost::lock_guard<boost::mutex> lock(waiters_mut_);
+  waiters_.insert(waiter);
+}
+
+void SimClock::RemoveWaiter(Waiter_t *waiter) {
+  boost::lock_guard<boost::mutex> lock(waiters_mut_);
+  waiters_.erase(waiter);
+}
+
+ros::Time SimClock::Current() {
+  boost::lock_guard<boost::mutex> lock(mut_);
+  return now_;
+}
+}  // namespace mutex
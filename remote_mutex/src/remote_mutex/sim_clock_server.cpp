@@ -0,0 +1,144 @@
+/*
+remote_mutex
+Copyright (C) 2015  Luke Fraser
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+// Discrete-event /clock for runs with /use_sim_time. Every SimClock client
+// announces its waits on /sim_clock/request. Once all clients wait and no
+// request arrived for ~settle_ms, the clock jumps to the earliest wakeup.
+// A client that stays awake for ~stall_ms (e.g. blocked on something that
+// is not a SimClock wait) no longer holds the clock back.
+#include <boost/thread/thread.hpp>
+#include <boost/date_time.hpp>
+#include <map>
+#include <string>
+#include "ros/ros.h"
+#include "rosgraph_msgs/Clock.h"
+#include "robotics_task_tree_msgs/SimClockRequest.h"
+
+#define SETTLE_MS 1.0
+#define STALL_MS 500.0
+#define REPUBLISH_MS 100.0
+#define SERVER_POLL_US 200
+
+typedef robotics_task_tree_msgs::SimClockRequest Request_t;
+
+struct Client_t {
+  uint8_t state;
+  ros::Time wakeup;
+};
+
+std::map<std::string, Client_t> clients;
+boost::mutex clients_mut;
+ros::WallTime last_request;
+ros::Time sim_now;
+
+void ReceiveRequest(const Request_t::ConstPtr &msg) {
+  boost::lock_guard<boost::mutex> lock(clients_mut);
+  last_request = ros::WallTime::now();
+  if (msg->state == Request_t::LEFT) {
+    clients.erase(msg->client);
+    return;
+  }
+  Client_t &client = clients[msg->client];
+  client.state = msg->state;
+  client.wakeup = msg->wakeup;
+  // Already due, the client does not wait on the clock
+  if (client.state == Request_t::SLEEPING && !client.wakeup.isZero()
+      && client.wakeup <= sim_now)
+    client.state = Request_t::AWAKE;
+}
+
+int main(int argc, char **argv) {
+  ros::init(argc, argv, "sim_clock_server");
+  ros::NodeHandle nh;
+  ros::NodeHandle local("~");
+
+  bool use_sim_time = false;
+  ros::param::get("/use_sim_time", use_sim_time);
+  if (!use_sim_time)
+    ROS_WARN("sim_clock_server: /use_sim_time is not set, clients keep "
+      "running on the wall clock");
+
+  double settle_ms, stall_ms, start_time;
+  local.param<double>("settle_ms", settle_ms, SETTLE_MS);
+  local.param<double>("stall_ms", stall_ms, STALL_MS);
+  // Simulated time starts at the wall time by default so recorded
+  // timestamps stay comparable to real runs
+  local.param<double>("start_time", start_time, ros::WallTime::now().toSec());
+  ros::WallDuration settle(settle_ms / 1000.0);
+  ros::WallDuration stall(stall_ms / 1000.0);
+  ros::WallDuration republish(REPUBLISH_MS / 1000.0);
+
+  ros::Publisher clock_pub = nh.advertise<rosgraph_msgs::Clock>("/clock", 10);
+  ros::Subscriber request_sub = nh.subscribe("/sim_clock/request", 10000,
+    &ReceiveRequest, ros::TransportHints().tcpNoDelay());
+  ros::AsyncSpinner spinner(1);
+  spinner.start();
+
+  sim_now = ros::Time(start_time);
+  last_request = ros::WallTime::now();
+  ros::WallTime wall_start = ros::WallTime::now();
+  ros::WallTime last_publish;
+  uint64_t steps = 0;
+  uint64_t stalls = 0;
+  rosgraph_msgs::Clock clock;
+  while (ros::ok()) {
+    bool advanced = false;
+    {
+      boost::lock_guard<boost::mutex> lock(clients_mut);
+      ros::WallDuration quiet = ros::WallTime::now() - last_request;
+      bool all_waiting = !clients.empty();
+      ros::Time next;
+      std::map<std::string, Client_t>::iterator it;
+      for (it = clients.begin(); it != clients.end(); ++it) {
+        if (it->second.state != Request_t::SLEEPING)
+          all_waiting = false;
+        else if (!it->second.wakeup.isZero()
+            && (next.isZero() || it->second.wakeup < next))
+          next = it->second.wakeup;
+      }
+      if (!next.isZero()
+          && ((all_waiting && quiet >= settle) || quiet >= stall)) {
+        if (!all_waiting && ++stalls == 1)
+          ROS_WARN("sim_clock_server: a client stayed awake for %.0f ms, "
+            "advancing anyway", stall_ms);
+        sim_now = next;
+        for (it = clients.begin(); it != clients.end(); ++it) {
+          if (it->second.state == Request_t::SLEEPING
+              && !it->second.wakeup.isZero() && it->second.wakeup <= sim_now)
+            it->second.state = Request_t::AWAKE;
+        }
+        last_request = ros::WallTime::now();
+        advanced = true;
+        ++steps;
+      }
+      clock.clock = sim_now;
+    }
+    // Republish now and then so late subscribers get the current time
+    if (advanced || ros::WallTime::now() - last_publish > republish) {
+      clock_pub.publish(clock);
+      last_publish = ros::WallTime::now();
+    }
+    boost::this_thread::sleep(boost::posix_time::microseconds(SERVER_POLL_US));
+  }
+
+  double wall_s = (ros::WallTime::now() - wall_start).toSec();
+  double sim_s = (sim_now - ros::Time(start_time)).toSec();
+  ROS_INFO("sim_clock_server: %lu steps, %.1f s simulated in %.1f s (x%.1f), "
+    "%lu stalls", static_cast<unsigned long>(steps), sim_s, wall_s,
+    wall_s > 0 ? sim_s / wall_s : 0.0, static_cast<unsigned long>(stalls));
+  return 0;
+}
@@ -0,0 +1,87 @@
+/*
+robotics-task-tree-eval
+Copyright (C) 2015  Luke Fraser
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#ifndef INCLUDE_BATCH_TRANSPORT_H_
+#define INCLUDE_BATCH_TRANSPORT_H_
+#include <ros/ros.h>
+#include <boost/thread/thread.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/date_time.hpp>
+#include <stdint.h>
+#include <string>
+#include "robotics_task_tree_msgs/ControlBatch.h"
+#include "robotics_task_tree_eval/local_transport.h"
+
+namespace task_net {
+
+class NodeExecutor;
+
+/*
+Class: BatchTransport
+Definition: Packs every ControlMessage that a behavior_network process sends
+            to nodes in other processes into one ControlBatch per batch
+            period, published on a single tree wide topic. Incoming batches
+            from the other processes are split up again and handed to the
+            local nodes through the LocalTransport. All processes of a tree
+            must run with the same ~batch_period_ms setting.
+*/
+class BatchTransport {
+ public:
+  // Create the shared batcher. Only the first call creates it; later calls
+  // return the existing instance regardless of period.
+  static BatchTransport* Configure(boost::posix_time::time_duration period);
+  // Returns NULL when batching is not enabled for this process.
+  static BatchTransport* Instance();
+
+  virtual ~BatchTransport();
+
+  void Queue(const NodeBitmask &dest, LocalTransport::Channel channel,
+    ConstControlMessagePtr_t msg);
+  void Flush();
+
+  // True once another process subscribes to the batch topic
+  bool Connected();
+  uint64_t BatchesSent();
+  uint64_t MessagesSent();
+
+ private:
+  explicit BatchTransport(boost::posix_time::time_duration period);
+  static void FlushThread(BatchTransport *batcher);
+  static void FlushTask(BatchTransport *batcher);
+  void ReceiveBatch(const robotics_task_tree_msgs::ControlBatch::ConstPtr
+    &batch);
+
+  ros::NodeHandle nh_;
+  ros::Publisher batch_pub_;
+  ros::Subscriber batch_sub_;
+  std::string sender_;
+  uint32_t seq_;
+  boost::posix_time::time_duration period_;
+
+  robotics_task_tree_msgs::ControlBatch::Ptr pending_;
+  uint64_t batches_sent_;
+  uint64_t messages_sent_;
+
+  NodeExecutor *executor_;
+  boost::thread *flush_thread_;
+  boost::mutex mut_;
+
+  static BatchTransport *instance_;
+  static boost::mutex instance_mut_;
+};
+}  // namespace task_net
+#endif  // INCLUDE_BATCH_TRANSPORT_H_
@@ -0,0 +1,101 @@
+/*
+robotics-task-tree-eval
+Copyright (C) 2015  Luke Fraser
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#ifndef INCLUDE_LOCAL_TRANSPORT_H_
+#define INCLUDE_LOCAL_TRANSPORT_H_
+#include <boost/thread/thread.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/condition_variable.hpp>
+#include <boost/function.hpp>
+#include <boost/shared_ptr.hpp>
+#include <stdint.h>
+#include <deque>
+#include <vector>
+#include "robotics_task_tree_msgs/node_types.h"
+#include "robotics_task_tree_msgs/ControlMessage.h"
+#include "robotics_task_tree_eval/node_table.h"
+
+namespace task_net {
+
+typedef boost::shared_ptr<ControlMessage_t const>
+  ConstControlMessagePtr_t;
+
+class NodeExecutor;
+
+/*
+Class: LocalTransport
+Definition: In-process mailbox for ControlMessages between nodes that live in
+            the same behavior_network process. Messages are handed over as
+            shared pointers, skipping serialization and the TCPROS loopback.
+            Deliveries are processed in order on one dispatcher (a thread,
+            or a strand on the NodeExecutor when one is configured), like a
+            single threaded ros::spin().
+*/
+class LocalTransport {
+ public:
+  // Which of the receiving node's subscriptions a message is meant for
+  typedef enum {
+    CHILD_CHANNEL = 0,  // <topic>          -> ReceiveFromChildren
+    PARENT_CHANNEL,     // <topic>_parent   -> ReceiveFromParent
+    PEER_CHANNEL,       // <topic>_peer     -> ReceiveFromPeers
+    NUM_CHANNELS
+  } Channel;
+  typedef boost::function<void(ConstControlMessagePtr_t)> Handler;
+
+  static LocalTransport* Instance();
+  virtual ~LocalTransport();
+
+  // Endpoints are addressed by their NodeTable handle
+  void Register(NodeHandle_t node, Channel channel, Handler handler);
+  bool IsLocal(NodeHandle_t node);
+  // Returns false when the destination is not in this process; the caller
+  // then falls back to publishing on the ROS topic.
+  bool Deliver(NodeHandle_t node, Channel channel,
+    ConstControlMessagePtr_t msg);
+
+  uint64_t Delivered();
+
+ private:
+  LocalTransport();
+  static void DispatchThread(LocalTransport *transport);
+  static void DrainTask(LocalTransport *transport);
+  bool DispatchOne(boost::unique_lock<boost::mutex> *lock);
+
+  struct Endpoint {
+    Handler handlers[NUM_CHANNELS];
+  };
+  struct Delivery {
+    Handler handler;
+    ConstControlMessagePtr_t msg;
+  };
+
+  std::vector<Endpoint> endpoints_;
+  std::deque<Delivery> mailbox_;
+  bool draining_;
+  uint64_t delivered_;
+  NodeExecutor *executor_;
+  boost::thread *dispatch_thread_;
+
+  boost::mutex endpoint_mut_;
+  boost::mutex mailbox_mut_;
+  boost::condition_variable mailbox_cv_;
+
+  static LocalTransport *instance_;
+  static boost::mutex instance_mut_;
+};
+}  // namespace task_net
+#endif  // INCLUDE_LOCAL_TRANSPORT_H_
@@ -19,18 +19,33 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>.
 #define INCLUDE_NODE_H_
 #include <ros/ros.h>
 #include <ros/callback_queue.h>
+#include <boost/shared_ptr.hpp>
+#include <boost/thread/mutex.hpp>
 #include <stdint.h>
 #include <std_msgs/String.h>
 #include <std_msgs/Bool.h>
 #include <vector>
 #include <string>
 #include <map>
+#include <set>
+#include <utility>
+#include <atomic>
 #include <fstream>
 #include "robotics_task_tree_msgs/node_types.h"
 #include "robotics_task_tree_msgs/ControlMessage.h"
 #include "robotics_task_tree_msgs/hold_status.h"
 #include "dialogue/Issue.h"
 #include "dialogue/Resolution.h"
+#include "robotics_task_tree_eval/node_executor.h"
+#include "robotics_task_tree_eval/local_transport.h"
+#include "robotics_task_tree_eval/node_table.h"
+#include "robotics_task_tree_eval/batch_transport.h"
+#include "robotics_task_tree_eval/seqlock.h"
+#include "robotics_task_tree_eval/work_handle.h"
+#include "robotics_task_tree_eval/work_executor.h"
+#include "robotics_task_tree_eval/node_recorder.h"
+#include "robotics_task_tree_eval/readiness_barrier.h"
+#include "timeseries_recording_toolkit/record_timeseries_data_to_file.h"
 //#include <pause_pkg/Stop.h>
 //typedef robotics_task_tree_msgs::hold_status holdPtr;
 namespace task_net {
@@ -47,6 +62,15 @@ typedef boost::shared_ptr<ControlMessage_t>
 // Pre-declare
 class Node;
 void WorkThread(Node* node);
+
+// Held by the record thread or task of a node while it records, so ~Node
+// can stop it without the task touching the node afterwards
+struct RecordControl {
+  RecordControl() : stopped(false) {}
+  boost::mutex mut;
+  bool stopped;
+};
+typedef boost::shared_ptr<RecordControl> RecordControlPtr;
 /*
 Class: Node
 Definition: Base class for behavior network nodes. All nodes will inherit from
@@ -74,6 +98,15 @@ class Node {
   virtual bool CheckWork();
   virtual void UndoWork();
   virtual void PublishStateToPeers();
+  // ControlMessages sent by all nodes of this process, however delivered
+  static uint64_t MessagesSent();
+  // ROS messages published for all nodes of this process: control and state
+  // messages on their own topics plus control batches. Local deliveries
+  // and batched control messages are not in it.
+  static uint64_t MessagesPublished();
+  // PublishStatus calls of all nodes of this process skipped because
+  // nothing changed
+  static uint64_t PublishesSuppressed();
 
  protected:
   virtual void Activate();
@@ -83,6 +116,9 @@ class Node {
   virtual void DeactivatePeer();
   virtual void DialogueCallback(const dialogue::Resolution::ConstPtr &msg);
   virtual void Dialogue();
+  // Executor mode: runs Dialogue() off the shared pool once the object was
+  // dropped, true until it is resolved
+  bool DialogueRunning();
 
   virtual void Finish();
   virtual State GetState();
@@ -118,15 +154,60 @@ class Node {
 
   friend void WorkThread(Node* node);
   friend void RecordThread(Node* node);
-  friend void CheckThread(Node* node);
   friend void PeerCheckThread(Node *node);
+  friend void WorkTask(Node *node, uint32_t generation);
+  friend void UpdateTask(Node *node);
+  friend void RecordTask(Node *node, RecordControlPtr control);
+  friend void EventUpdateTask(Node *node);
+  friend void HeartbeatTask(Node *node);
+  friend void UpdateThread(Node *node, boost::posix_time::millisec mtime);
+  friend void StartUpdateTask(Node *node);
+
+  // Event driven update: request a re-evaluation as soon as possible
+  virtual void MarkDirty();
+
+  // Work supervision. Long running Work() implementations should poll
+  // WorkCancelled() (optionally sleeping on it) and return early once it is
+  // true; UndoWork() is then called for them.
+  virtual bool WorkCancelled(boost::posix_time::time_duration wait =
+    boost::posix_time::time_duration());
+  virtual void ReportProgress(float progress);
+  virtual WorkHandlePtr CurrentWork();
+
+  // Child bookkeeping kept up to date by RefreshChildStates(), so the
+  // composite behaviors answer without scanning children_
+  bool AllChildrenDone() const;
+  // done or peer_done
+  bool AllChildrenFinished() const;
+  bool AnyChildFinished() const;
+  bool AnyChildActive() const;
+  // Any child whose peer is active or done
+  bool AnyChildClaimed() const;
+  bool AllChildrenClaimed() const;
+  // First child that is not done and not taken by a peer, NULL if none
+  NodeId_t* FirstOpenChild() const;
+  // Highest potential child that nobody works on, ties go to the first
+  // child. NULL if none.
+  NodeId_t* HighestOpenChild() const;
+  void SetChildPeerActive(size_t index, bool peer_active);
+  // A peer of this node is active or done
+  bool Claimed() const;
 
   virtual void RecordToFile();
+  // Number of PublishStatus calls skipped because nothing changed
+  virtual uint64_t SuppressedPublishes();
  private:
   virtual void NodeInit(boost::posix_time::millisec mtime);
   virtual void PublishStatus();
   virtual void PublishActivationPotential();
+  virtual void SendActivationPotential();
   virtual void UpdateActivationPotential();
+  virtual bool StateChanged();
+  virtual void InitializeChildSlots();
+  virtual void RefreshChildStates();
+  void CountChild(size_t index, bool add);
+  virtual void PublishSnapshot();
+  virtual bool ConnectionsReady(std::vector<std::string> *waiting);
   virtual void PublishDoneParent();
   virtual void InitializeSubscriber(NodeId_t *node);
   virtual void InitializePublishers(NodeListPtr nodes, PubList *pub,
@@ -137,12 +218,21 @@ class Node {
     const char * topic_addition = "");
   virtual NodeBitmask GetBitmask(std::string name);
   virtual NodeId_t GetNodeId(NodeBitmask id);
+  virtual NodeId_t* LookupNode(const NodeBitmask &mask);
   virtual void GenerateNodeBitmaskMap();
   virtual void InitializeBitmask(NodeId_t* node);
   virtual void InitializeBitmasks(NodeListPtr nodes);
   virtual bool ActivationPrecondition();
   virtual void ActivationFalloff();
   virtual void PublishStateToChildren();
+  virtual void StartWorkThreads();
+  virtual WorkHandlePtr BeginWork();
+  virtual WorkHandle::Result RunWork(uint32_t generation);
+  virtual void SubmitWork();
+  virtual void CancelWork();
+  virtual void Transmit(NodeId_t *node, LocalTransport::Channel channel,
+    ros::Publisher *pub, const ControlMessagePtr_t msg);
+  virtual void WaitForUpdate();
 
   virtual void ReleaseMutexLocs();
 
@@ -151,12 +241,13 @@ class Node {
 
 
  protected:
-  std::ofstream record_file;
   NodeId_t *name_;
   State state_;
   robotics_task_tree_msgs::hold_status hold_status_;//sd
   bool parent_done_;
-  std::map<NodeBitmask, NodeId_t*, BitmaskLessThan> node_dict_;
+  // Indexed by NodeTable handle
+  std::vector<NodeId_t*> node_dict_;
+  NodeTable *node_table_;
   std::string name_id_;
   NodeBitmask mask_;
   NodeListPtr peers_;
@@ -193,8 +284,9 @@ class Node {
   // Threads
   boost::thread *update_thread;
   boost::thread *work_thread;
-  boost::thread *check_thread;
   boost::thread *peer_check_thread;
+  // Dialogue in executor mode, NULL when none runs
+  boost::thread *dialogue_thread_;
 
   // Mutex
   boost::mutex mut;
@@ -203,12 +295,77 @@ class Node {
 
   // Recording Mutex
   boost::thread *record_thread;
+  boost::posix_time::time_duration record_period_;
+  // Process wide binary log (~record_dir), NULL when writing typed records
+  NodeRecorder *recorder_;
+  // Process wide typed records: the ring drained by the
+  // timeseries_recording_server (~recording_server), CSV segments
+  // (~record_segment_mb) or one CSV file. NULL with the binary log.
+  recording_toolkit::PrintRecorder *print_recorder_;
+  RecordControlPtr record_control_;
+  // Startup handshake (~readiness_barrier), NULL to start after a fixed delay
+  ReadinessBarrier *barrier_;
+
+  // Shared executor (NULL when every node owns its own threads)
+  NodeExecutor *executor_;
+  boost::posix_time::time_duration update_period_;
+
+  // Hand messages to nodes in this process directly (~intra_process)
+  bool intra_process_;
+  // Pack remote messages into one batch per period (~batch_period_ms)
+  BatchTransport *batch_;
+
+  // Event driven update (~event_driven_update)
+  bool event_driven_;
+  bool update_started_;
+  bool update_dirty_;
+  bool update_scheduled_;
+  boost::posix_time::time_duration heartbeat_period_;
+  boost::mutex update_mut_;
+  boost::condition_variable update_cv_;
+
+  // Lock free child reports, written by the receive callbacks and copied
+  // into children_[i]->state at the start of every Update()
+  SeqLock<ChildSample> *child_slots_;
+  std::vector<int> child_index_;  // NodeTable handle -> children_ index
+  // One bit per child with a report not yet refreshed
+  std::atomic<uint64_t> *child_reported_;
+  size_t child_report_words_;
+  // Counts over children_[i]->state
+  size_t children_done_;
+  size_t children_finished_;
+  size_t children_active_;
+  size_t children_claimed_;
+  // Children not done and not peer claimed, by index
+  std::set<int> open_children_;
+  // Open children that are not active either, by (potential, -index)
+  std::set<std::pair<float, int> > open_potentials_;
+  // Own state as of the last Update(), for readers outside the update path
+  SeqLock<SelfSample> self_snapshot_;
+
+  // Change only publishing (~change_only_publish)
+  bool change_only_publish_;
+  float publish_epsilon_;
+  boost::posix_time::time_duration publish_heartbeat_;
+  boost::posix_time::ptime last_publish_time_;
+  bool published_once_;
+  State published_state_;
+  uint64_t publishes_sent_;
+  uint64_t publishes_suppressed_;
 
   // Conditional Variable
   boost::condition_variable cv;
 
   // Working state
   bool working;
+  WorkHandlePtr work_handle_;
+  boost::mutex work_handle_mut_;
+  // Shared bounded pool for Work() (~max_concurrent_work), NULL when every
+  // node runs its own work thread
+  WorkExecutor *work_executor_;
+  bool work_pending_;
+  // Bumped by Deactivate() so a replaced work thread knows to exit
+  uint32_t work_generation_;
   bool thread_running_;
 
 };
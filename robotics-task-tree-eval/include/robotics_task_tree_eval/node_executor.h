@@ -0,0 +1,91 @@
+/*
+robotics-task-tree-eval
+Copyright (C) 2015  Luke Fraser
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#ifndef INCLUDE_NODE_EXECUTOR_H_
+#define INCLUDE_NODE_EXECUTOR_H_
+#include <boost/thread/thread.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/condition_variable.hpp>
+#include <boost/date_time.hpp>
+#include <boost/function.hpp>
+#include <stdint.h>
+#include <deque>
+#include <queue>
+#include <vector>
+
+namespace task_net {
+/*
+Class: NodeExecutor
+Definition: Process wide pool of worker threads and timers shared by every
+            Node in a behavior_network process. Nodes post short tasks
+            (update ticks, recording, peer checks) instead of owning a
+            sleeping thread for each of them. Tasks must not block: a
+            node's Update() runs here, so its ActivationPrecondition() has
+            to poll (RemoteMutex::PollLock) rather than wait, and the drop
+            dialogue gets a thread of its own.
+*/
+class NodeExecutor {
+ public:
+  typedef boost::function<void()> Task;
+
+  // Create the shared executor. Only the first call creates the pool; later
+  // calls return the existing instance regardless of num_threads.
+  static NodeExecutor* Configure(uint32_t num_threads);
+  // Returns NULL when no executor has been configured for this process.
+  static NodeExecutor* Instance();
+
+  virtual ~NodeExecutor();
+
+  void Post(Task task);
+  void PostAfter(boost::posix_time::time_duration delay, Task task);
+  void Stop();
+
+  uint32_t NumThreads() const;
+  size_t PendingTasks();
+
+ private:
+  explicit NodeExecutor(uint32_t num_threads);
+  static void WorkerLoop(NodeExecutor *executor);
+
+  struct TimedTask {
+    boost::posix_time::ptime deadline;
+    uint64_t sequence;
+    Task task;
+    bool operator>(const TimedTask &other) const {
+      if (deadline == other.deadline)
+        return sequence > other.sequence;
+      return deadline > other.deadline;
+    }
+  };
+  typedef std::priority_queue<TimedTask, std::vector<TimedTask>,
+    std::greater<TimedTask> > TimerQueue;
+
+  std::deque<Task> ready_;
+  TimerQueue timers_;
+  uint64_t timer_sequence_;
+  bool running_;
+  uint32_t num_threads_;
+
+  boost::mutex mut_;
+  boost::condition_variable cv_;
+  boost::thread_group workers_;
+
+  static NodeExecutor *instance_;
+  static boost::mutex instance_mut_;
+};
+}  // namespace task_net
+#endif  // INCLUDE_NODE_EXECUTOR_H_
@@ -0,0 +1,139 @@
+/*
+robotics-task-tree-eval
+Copyright (C) 2015  Luke Fraser
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#ifndef INCLUDE_NODE_RECORDER_H_
+#define INCLUDE_NODE_RECORDER_H_
+#include <boost/thread/thread.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/date_time.hpp>
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include "robotics_task_tree_eval/node_table.h"
+#include "robotics_task_tree_eval/seqlock.h"
+
+namespace task_net {
+
+class NodeExecutor;
+
+// On disk layout of a node recording, little endian as written by the host:
+//   RecordFileHeader
+//   node_count names, RECORD_NAME_LENGTH bytes each, NUL padded, by handle
+//   RecordEntry records starting at header.data_offset
+#define RECORD_MAGIC "TTREC01"
+#define RECORD_VERSION 1
+#define RECORD_NAME_LENGTH 64
+
+struct RecordFileHeader {
+  char magic[8];
+  uint32_t version;
+  uint32_t header_size;     // sizeof(RecordFileHeader)
+  uint32_t record_size;     // sizeof(RecordEntry)
+  uint32_t node_count;
+  uint32_t name_length;     // RECORD_NAME_LENGTH
+  uint32_t rate_hz;
+  uint64_t data_offset;     // first RecordEntry
+  uint64_t wall_start_ns;   // epoch time matching monotonic_start_ns
+  uint64_t monotonic_start_ns;
+  uint64_t record_count;    // complete records, updated after every sample
+};
+
+// One sample of one node
+struct RecordEntry {
+  uint64_t monotonic_ns;    // CLOCK_MONOTONIC
+  uint32_t node;            // NodeTable handle
+  float activation_level;
+  float activation_potential;
+  float suitability;
+  uint8_t active;
+  uint8_t done;
+  uint8_t working;
+  uint8_t reserved[5];
+};
+
+/*
+Class: NodeRecorder
+Definition: One binary log per behavior_network process holding every node
+            of the process. Nodes register their self snapshot and a single
+            sampler copies all of them into a memory mapped file of fixed
+            size records at ~record_rate_hz. Timestamps are monotonic; the
+            wall clock at start is kept in the header so the converter can
+            give epoch times. The file grows in mapped chunks so sampling
+            costs no system calls between chunk boundaries, and nothing is
+            flushed per record: the page cache writes the data back.
+            scripts/convert_node_recording.py turns a log into the per node
+            CSV files graph_node_activation.py reads.
+*/
+class NodeRecorder {
+ public:
+  // Create the process recorder. Only the first call creates it; later
+  // calls return the existing instance. Returns NULL if the log could not
+  // be created.
+  static NodeRecorder* Configure(const std::string &directory,
+    double rate_hz, NodeTable *table);
+  // Returns NULL when no recorder has been configured.
+  static NodeRecorder* Instance();
+  // ROS node name of this process for file names, '/' turned into '_'
+  static std::string ProcessName();
+
+  virtual ~NodeRecorder();
+
+  void Register(NodeHandle_t handle, const SeqLock<SelfSample> *snapshot);
+  const std::string& Filename() const;
+  uint64_t RecordCount();
+
+ private:
+  NodeRecorder(const std::string &filename, double rate_hz, NodeTable *table);
+  bool Open(NodeTable *table);
+  bool MapChunk(uint64_t offset);
+  void Close();
+  void Sample();
+  static void RecordThread(NodeRecorder *recorder);
+  static void RecordTask(NodeRecorder *recorder);
+
+  struct Source_t {
+    NodeHandle_t handle;
+    const SeqLock<SelfSample> *snapshot;
+  };
+
+  std::string filename_;
+  boost::posix_time::time_duration period_;
+  uint64_t period_ns_;
+  uint32_t rate_hz_;
+  int fd_;
+  RecordFileHeader *header_;
+  size_t header_map_size_;
+  // Currently mapped chunk of records
+  char *chunk_;
+  uint64_t chunk_offset_;
+  uint64_t chunk_size_;
+  uint64_t write_offset_;
+  uint64_t file_size_;
+  std::vector<Source_t> sources_;
+  boost::mutex mut_;
+
+  NodeExecutor *executor_;
+  boost::thread *record_thread_;
+
+  static NodeRecorder *instance_;
+  static boost::mutex instance_mut_;
+};
+
+// CLOCK_MONOTONIC in nanoseconds
+uint64_t MonotonicNs();
+}  // namespace task_net
+#endif  // INCLUDE_NODE_RECORDER_H_
@@ -0,0 +1,87 @@
+/*
+robotics-task-tree-eval
+Copyright (C) 2015  Luke Fraser
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#ifndef INCLUDE_NODE_TABLE_H_
+#define INCLUDE_NODE_TABLE_H_
+#include <boost/thread/mutex.hpp>
+#include <stdint.h>
+#include <map>
+#include <string>
+#include <vector>
+#include "robotics_task_tree_msgs/node_types.h"
+
+namespace task_net {
+
+typedef uint32_t NodeHandle_t;
+
+inline uint32_t BitmaskKey(const NodeBitmask &mask) {
+  return (static_cast<uint32_t>(mask.type) << 24)
+    | (static_cast<uint32_t>(mask.robot) << 16)
+    | static_cast<uint32_t>(mask.node);
+}
+
+inline NodeBitmask KeyBitmask(uint32_t key) {
+  NodeBitmask mask;
+  mask.type = static_cast<uint8_t>(key >> 24);
+  mask.robot = static_cast<uint8_t>((key >> 16) & 0xff);
+  mask.node = static_cast<uint16_t>(key & 0xffff);
+  return mask;
+}
+
+/*
+Class: NodeTable
+Definition: Tree wide table of every node in the NodeList parameter, built
+            once per process. Each node gets a dense handle (its index in
+            the NodeList) so per node data can live in plain vectors. The
+            names and bitmasks are parsed here once; the mask to handle
+            lookup is an open addressed array so the messaging path never
+            walks a tree or splits a topic string.
+*/
+class NodeTable {
+ public:
+  static const NodeHandle_t INVALID_HANDLE = 0xffffffff;
+
+  // Build the table from the NodeList. Only the first call builds it; later
+  // calls return the existing table.
+  static NodeTable* Load(const std::vector<std::string> &names);
+  // Returns NULL until the table has been loaded.
+  static NodeTable* Instance();
+  // Parse a "<TYPE>_<type>_<robot>_<node>" topic name into its bitmask.
+  static NodeBitmask ParseBitmask(const std::string &name);
+
+  NodeHandle_t Handle(const NodeBitmask &mask) const;
+  NodeHandle_t Handle(const std::string &name) const;
+  const std::string& Name(NodeHandle_t handle) const;
+  const NodeBitmask& Mask(NodeHandle_t handle) const;
+  size_t Size() const;
+
+ private:
+  explicit NodeTable(const std::vector<std::string> &names);
+
+  std::vector<std::string> names_;
+  std::vector<NodeBitmask> masks_;
+  std::map<std::string, NodeHandle_t> name_index_;
+  // Open addressed mask -> handle index, power of two sized
+  std::vector<uint32_t> slot_keys_;
+  std::vector<NodeHandle_t> slot_handles_;
+  uint32_t slot_mask_;
+
+  static NodeTable *instance_;
+  static boost::mutex instance_mut_;
+};
+}  // namespace task_net
+#endif  // INCLUDE_NODE_TABLE_H_
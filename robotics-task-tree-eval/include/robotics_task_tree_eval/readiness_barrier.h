@@ -0,0 +1,118 @@
+/*
+robotics-task-tree-eval
+Copyright (C) 2015  Luke Fraser
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#ifndef INCLUDE_READINESS_BARRIER_H_
+#define INCLUDE_READINESS_BARRIER_H_
+#include <ros/ros.h>
+#include <boost/thread/thread.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/condition_variable.hpp>
+#include <boost/date_time.hpp>
+#include <boost/function.hpp>
+#include <stdint.h>
+#include <map>
+#include <set>
+#include <string>
+#include <vector>
+#include "robotics_task_tree_msgs/ReadinessReport.h"
+#include "robotics_task_tree_eval/node_table.h"
+
+namespace task_net {
+
+class NodeExecutor;
+
+/*
+Class: ReadinessBarrier
+Definition: Startup handshake for the whole tree, one per behavior_network
+            process. Every node registers a check that tells whether its
+            publishers reached their subscribers. Once the executable has
+            created all of its nodes (NodesCreated) and every check passes,
+            the process reports itself ready on the latched task_tree_ready
+            topic. The barrier releases when every expected robot has a
+            ready process, or when the timeout expires, in which case the
+            nodes still waiting are listed. Node updates start on release
+            instead of after a fixed startup sleep.
+*/
+class ReadinessBarrier {
+ public:
+  // Appends the topics that are not connected yet and returns true when
+  // there are none
+  typedef boost::function<bool(std::vector<std::string>*)> Check;
+  typedef boost::function<void()> Callback;
+
+  // Create the process barrier. robots lists the robot ids that must report
+  // ready; when empty every robot owning a non ROOT node in the table is
+  // expected. Only the first call creates the barrier.
+  static ReadinessBarrier* Configure(NodeTable *table,
+    const std::vector<int> &robots, boost::posix_time::time_duration timeout);
+  // Returns NULL when the barrier is not enabled for this process.
+  static ReadinessBarrier* Instance();
+  // Called by the executable once all nodes of the process are constructed.
+  // Safe to call when no barrier is configured.
+  static void NodesCreated();
+
+  virtual ~ReadinessBarrier();
+
+  void Register(const std::string &name, uint8_t robot, Check check);
+  // Runs the callback on release, or right away if already released
+  void OnReady(Callback callback);
+  void WaitReady();
+  bool Released();
+
+ private:
+  ReadinessBarrier(NodeTable *table, const std::vector<int> &robots,
+    boost::posix_time::time_duration timeout);
+  static void PollThread(ReadinessBarrier *barrier);
+  static void PollTask(ReadinessBarrier *barrier);
+  // Returns false once released
+  bool Poll();
+  void Release(bool timed_out);
+  void ReceiveReport(
+    const robotics_task_tree_msgs::ReadinessReport::ConstPtr &msg);
+
+  struct Node_t {
+    std::string name;
+    uint8_t robot;
+    Check check;
+  };
+
+  ros::NodeHandle nh_;
+  ros::Publisher ready_pub_;
+  ros::Subscriber ready_sub_;
+  std::string process_;
+  std::vector<Node_t> nodes_;
+  std::set<uint8_t> expected_robots_;
+  // process name -> last report
+  std::map<std::string, robotics_task_tree_msgs::ReadinessReport> reports_;
+  bool local_ready_;
+  bool reported_;
+  bool released_;
+  std::vector<Callback> callbacks_;
+  boost::posix_time::ptime start_;
+  boost::posix_time::time_duration timeout_;
+  boost::mutex mut_;
+  boost::condition_variable cv_;
+
+  NodeExecutor *executor_;
+  boost::thread *poll_thread_;
+
+  static bool nodes_created_;
+  static ReadinessBarrier *instance_;
+  static boost::mutex instance_mut_;
+};
+}  // namespace task_net
+#endif  // INCLUDE_READINESS_BARRIER_H_
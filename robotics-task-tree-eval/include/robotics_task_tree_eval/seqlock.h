@@ -0,0 +1,112 @@
+/*
+robotics-task-tree-eval
+Copyright (C) 2015  Luke Fraser
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#ifndef INCLUDE_SEQLOCK_H_
+#define INCLUDE_SEQLOCK_H_
+#include <stdint.h>
+#include <string.h>
+#include <atomic>
+
+namespace task_net {
+
+// Sample of the fields a child reports to its parent
+struct ChildSample {
+  float activation_level;
+  float activation_potential;
+  uint32_t highest;  // BitmaskKey() of the child's highest node
+  uint8_t done;
+  uint8_t active;
+};
+
+// Sample of a node's own state for readers outside the update path
+struct SelfSample {
+  float activation_level;
+  float activation_potential;
+  float suitability;
+  uint8_t active;
+  uint8_t done;
+  uint8_t working;
+};
+
+/*
+Class: SeqLock
+Definition: Versioned single value for plain old data. Writers bump the
+            version to odd, store the words, and bump it back to even; they
+            never wait on readers. Readers copy the words and retry when the
+            version was odd or moved underneath them, so they always see one
+            complete write. Concurrent writers serialize on the version.
+*/
+template <typename T>
+class SeqLock {
+ public:
+  SeqLock() : version_(0) {
+    T empty;
+    memset(&empty, 0, sizeof(empty));
+    Write(empty);
+  }
+
+  void Write(const T &value) {
+    uint32_t buffer[kWords];
+    memset(buffer, 0, sizeof(buffer));
+    memcpy(buffer, &value, sizeof(T));
+
+    uint32_t version = version_.load(std::memory_order_relaxed);
+    while ((version & 1)
+        || !version_.compare_exchange_weak(version, version + 1,
+          std::memory_order_acquire, std::memory_order_relaxed)) {
+      version = version_.load(std::memory_order_relaxed);
+    }
+    std::atomic_thread_fence(std::memory_order_release);
+    for (size_t i = 0; i < kWords; ++i)
+      words_[i].store(buffer[i], std::memory_order_relaxed);
+    version_.store(version + 2, std::memory_order_release);
+  }
+
+  T Read(uint32_t *version_out = NULL) const {
+    uint32_t buffer[kWords];
+    uint32_t before, after;
+    do {
+      before = version_.load(std::memory_order_acquire);
+      for (size_t i = 0; i < kWords; ++i)
+        buffer[i] = words_[i].load(std::memory_order_relaxed);
+      std::atomic_thread_fence(std::memory_order_acquire);
+      after = version_.load(std::memory_order_relaxed);
+    } while ((before & 1) || before != after);
+
+    T value;
+    memcpy(&value, buffer, sizeof(T));
+    if (version_out)
+      *version_out = before;
+    return value;
+  }
+
+  // Even number that grows by two with every write
+  uint32_t Version() const {
+    return version_.load(std::memory_order_acquire) & ~1u;
+  }
+
+ private:
+  SeqLock(const SeqLock&);
+  SeqLock& operator=(const SeqLock&);
+
+  static const size_t kWords = (sizeof(T) + sizeof(uint32_t) - 1)
+    / sizeof(uint32_t);
+  std::atomic<uint32_t> version_;
+  std::atomic<uint32_t> words_[kWords];
+};
+}  // namespace task_net
+#endif  // INCLUDE_SEQLOCK_H_
@@ -0,0 +1,146 @@
+/*
+robotics-task-tree-eval
+Copyright (C) 2015  Luke Fraser
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#ifndef INCLUDE_TREE_EVALUATOR_H_
+#define INCLUDE_TREE_EVALUATOR_H_
+#include <stdint.h>
+#include <map>
+#include <string>
+#include <vector>
+#include "robotics_task_tree_msgs/node_types.h"
+#include "robotics_task_tree_msgs/State.h"
+
+namespace task_net {
+
+/*
+Class: TreeEvaluator
+Definition: Offline, single threaded evaluator of a whole task tree (all
+            robots) loaded from a NodeList/Nodes YAML file. Nodes live in
+            one flat array in breadth first order with index links instead
+            of threads and topics. Each Step() is one Update() of every
+            node: a top down pass runs the THEN/AND/OR/leaf decisions and
+            spreads activation, then a bottom up pass updates the activation
+            potentials and delivers what PublishStatus() would send to the
+            parent, peers and children. Messages arrive within the step, so
+            a run is deterministic and needs no ROS master.
+
+            Leaves have a fixed activation potential (the "potential" key
+            of the node, or the default) and finish their work a fixed
+            number of steps after they activate. ActivationPrecondition()
+            is the base one, no remote mutex is taken.
+*/
+class TreeEvaluator {
+ public:
+  // What a parent knows about a child, as in Node::children_[i]->state
+  struct ChildView_t {
+    float activation_level;
+    float activation_potential;
+    NodeBitmask highest;
+    bool done;
+    bool active;
+    bool peer_active;
+    bool peer_done;
+  };
+
+  struct Node_t {
+    std::string name;
+    NodeBitmask mask;
+    State state;
+    int32_t parent;  // -1 when the parent is ROOT or not in the tree
+    uint32_t parent_slot;  // own entry in the parent's child_views_
+    uint32_t first_child;  // into child_index_ / child_views_
+    uint32_t num_children;
+    uint32_t first_peer;  // into peer_index_
+    uint32_t num_peers;
+    bool parent_done;
+    // ThenBehavior activation queue front, an index into the children
+    uint32_t then_next;
+    // Leaves: peer check ran last call, activation decided on this one
+    bool peer_checked;
+    float leaf_potential;
+    // leaf_potential came from the file or SetLeafPotential()
+    bool own_potential;
+    // Steps of work left, 0 when no work runs
+    uint32_t work_left;
+    // First step the node was active / done, -1 if never
+    int32_t active_step;
+    int32_t done_step;
+  };
+
+  TreeEvaluator();
+
+  // Load the NodeList/Nodes parameters. Returns false and prints why when
+  // the file cannot be used.
+  bool Load(const std::string &filename);
+  // Back to the state right after Load()
+  void Reset();
+
+  // What-if knobs, apply before stepping
+  void SetDefaultLeafPotential(float potential);
+  bool SetLeafPotential(const std::string &name, float potential);
+  void SetWorkSteps(uint32_t steps);
+  // Activation level the (not running) ROOT gives the top nodes each step
+  void SetTopActivation(float level);
+
+  void Step();
+  // Step until every top node is done or max_steps ran. Returns the steps
+  // taken by this call.
+  uint32_t Run(uint32_t max_steps);
+  bool Done() const;
+  uint32_t Steps() const;
+
+  size_t Size() const;
+  int32_t Find(const std::string &name) const;
+  const Node_t& GetNode(size_t index) const;
+  // The message the node would publish on <name>_state after this step
+  robotics_task_tree_msgs::State StateMessage(size_t index) const;
+
+ private:
+  void Update(uint32_t index);
+  bool IsDone(uint32_t index);
+  bool IsActive(uint32_t index) const;
+  bool Precondition(uint32_t index);
+  void Activate(uint32_t index);
+  void SpreadActivation(uint32_t index);
+  void UpdateActivationPotential(uint32_t index);
+  void PublishStatus(uint32_t index);
+  void SendToParent(uint32_t index);
+  void SendToPeers(uint32_t index);
+  void SendToChildren(uint32_t index);
+  void ReceiveFromParent(uint32_t index, const ControlMessage_t &msg);
+  void ReceiveFromChild(uint32_t index, const ControlMessage_t &msg);
+  void ReceiveFromPeer(uint32_t index, const ControlMessage_t &msg);
+  ControlMessage_t Message(uint32_t index, int type) const;
+  void PeerCheck(uint32_t index);
+  void FinishWork(uint32_t index);
+  bool IsLeaf(uint32_t index) const;
+
+  std::vector<Node_t> nodes_;
+  std::vector<Node_t> initial_;
+  std::vector<uint32_t> child_index_;
+  std::vector<ChildView_t> child_views_;
+  std::vector<ChildView_t> initial_views_;
+  std::vector<uint32_t> peer_index_;
+  std::vector<uint32_t> tops_;
+  std::map<std::string, uint32_t> name_index_;
+  float default_leaf_potential_;
+  float top_activation_;
+  uint32_t work_steps_;
+  uint32_t steps_;
+};
+}  // namespace task_net
+#endif  // INCLUDE_TREE_EVALUATOR_H_
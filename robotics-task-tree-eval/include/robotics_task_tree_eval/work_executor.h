@@ -0,0 +1,103 @@
+/*
+robotics-task-tree-eval
+Copyright (C) 2015  Luke Fraser
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#ifndef INCLUDE_WORK_EXECUTOR_H_
+#define INCLUDE_WORK_EXECUTOR_H_
+#include <boost/thread/thread.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/condition_variable.hpp>
+#include <boost/date_time.hpp>
+#include <boost/function.hpp>
+#include <stdint.h>
+#include <deque>
+
+#define WORK_REPORT_PERIOD_S 10
+
+namespace task_net {
+/*
+Class: WorkExecutor
+Definition: Bounded pool that runs the Work() of activated nodes for one
+            behavior_network process, i.e. one robot. At most
+            max_concurrent jobs run at once and the rest wait in FIFO order.
+            Work blocks for seconds at a time, so it gets its own threads
+            rather than sharing the NodeExecutor. Queue depth, wait and run
+            times are logged every report period.
+*/
+class WorkExecutor {
+ public:
+  typedef boost::function<void()> Job;
+
+  struct Stats {
+    size_t queued;       // jobs waiting for a worker
+    size_t running;      // jobs currently executing
+    uint64_t submitted;
+    uint64_t completed;
+    double mean_wait_ms;
+    double max_wait_ms;
+    double mean_run_ms;
+    double max_run_ms;
+  };
+
+  // Create the shared executor. Only the first call creates the pool; later
+  // calls return the existing instance regardless of max_concurrent.
+  // A report_period of 0 turns the periodic log off.
+  static WorkExecutor* Configure(uint32_t max_concurrent,
+    boost::posix_time::time_duration report_period =
+    boost::posix_time::seconds(WORK_REPORT_PERIOD_S));
+  // Returns NULL when no work executor has been configured.
+  static WorkExecutor* Instance();
+
+  virtual ~WorkExecutor();
+
+  void Submit(Job job);
+  size_t QueueDepth();
+  Stats GetStats();
+  uint32_t MaxConcurrent() const;
+  // Log the current Stats at INFO level
+  void Report();
+
+ private:
+  WorkExecutor(uint32_t max_concurrent,
+    boost::posix_time::time_duration report_period);
+  static void WorkerLoop(WorkExecutor *executor);
+  static void ReportLoop(WorkExecutor *executor);
+
+  struct QueuedJob {
+    Job job;
+    boost::posix_time::ptime submitted;
+  };
+
+  std::deque<QueuedJob> queue_;
+  size_t running_;
+  uint64_t submitted_;
+  uint64_t completed_;
+  double total_wait_ms_;
+  double max_wait_ms_;
+  double total_run_ms_;
+  double max_run_ms_;
+  uint32_t max_concurrent_;
+  boost::posix_time::time_duration report_period_;
+
+  boost::mutex mut_;
+  boost::condition_variable cv_;
+  boost::thread_group workers_;
+
+  static WorkExecutor *instance_;
+  static boost::mutex instance_mut_;
+};
+}  // namespace task_net
+#endif  // INCLUDE_WORK_EXECUTOR_H_
@@ -0,0 +1,143 @@
+/*
+robotics-task-tree-eval
+Copyright (C) 2015  Luke Fraser
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#ifndef INCLUDE_WORK_HANDLE_H_
+#define INCLUDE_WORK_HANDLE_H_
+#include <boost/thread/thread.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/condition_variable.hpp>
+#include <boost/date_time.hpp>
+#include <boost/function.hpp>
+#include <boost/shared_ptr.hpp>
+#include <vector>
+
+namespace task_net {
+
+class NodeExecutor;
+
+/*
+Class: CancellationToken
+Definition: Cooperative cancellation flag shared between whoever supervises a
+            piece of work and the Work() that polls it.
+*/
+class CancellationToken {
+ public:
+  CancellationToken();
+
+  void Cancel();
+  bool IsCancelled();
+  // Sleep for at most duration. Returns true as soon as the token is
+  // cancelled, false if the full duration passed.
+  bool WaitFor(boost::posix_time::time_duration duration);
+
+ private:
+  bool cancelled_;
+  boost::mutex mut_;
+  boost::condition_variable cv_;
+};
+typedef boost::shared_ptr<CancellationToken> CancellationTokenPtr;
+
+/*
+Class: WorkHandle
+Definition: Completion handle for one run of a node's Work(). Carries the
+            cancellation token, the last reported progress and the result,
+            and runs the registered callbacks on progress and completion.
+*/
+class WorkHandle {
+ public:
+  typedef enum {
+    WORK_RUNNING = 0,
+    WORK_SUCCEEDED,
+    WORK_CANCELLED,
+    WORK_FAILED
+  } Result;
+  typedef boost::function<void(float)> ProgressCallback;
+  typedef boost::function<void(Result)> CompletionCallback;
+
+  WorkHandle();
+
+  CancellationTokenPtr Token();
+  void Cancel();
+  bool IsCancelled();
+
+  void ReportProgress(float progress);
+  float Progress();
+  void OnProgress(ProgressCallback callback);
+  // Runs immediately when the work has already completed
+  void OnComplete(CompletionCallback callback);
+
+  void Complete(Result result);
+  bool Done();
+  Result GetResult();
+  Result Wait();
+  // Returns false if the work is still running after duration
+  bool WaitFor(boost::posix_time::time_duration duration);
+
+ private:
+  CancellationTokenPtr token_;
+  Result result_;
+  float progress_;
+  std::vector<ProgressCallback> progress_callbacks_;
+  std::vector<CompletionCallback> completion_callbacks_;
+  boost::mutex mut_;
+  boost::condition_variable cv_;
+};
+typedef boost::shared_ptr<WorkHandle> WorkHandlePtr;
+
+/*
+Class: WorkSupervisor
+Definition: One process wide watcher for all running work. Every period it
+            runs the check function of each running WorkHandle (a node's
+            CheckWork) and cancels the ones whose check fails. It sleeps
+            while nothing is running, so idle nodes cost nothing.
+*/
+class WorkSupervisor {
+ public:
+  typedef boost::function<bool()> CheckFunction;
+
+  static WorkSupervisor* Instance();
+
+  virtual ~WorkSupervisor();
+
+  void Watch(WorkHandlePtr handle, CheckFunction check);
+  size_t Watched();
+
+ private:
+  WorkSupervisor();
+  static void SuperviseThread(WorkSupervisor *supervisor);
+  static void SuperviseTask(WorkSupervisor *supervisor);
+  // Returns false once nothing is left to watch
+  bool CheckAll();
+
+  struct Watch_t {
+    WorkHandlePtr handle;
+    CheckFunction check;
+  };
+
+  std::vector<Watch_t> watched_;
+  bool task_scheduled_;
+  boost::posix_time::time_duration period_;
+  NodeExecutor *executor_;
+  boost::thread *supervise_thread_;
+  boost::mutex mut_;
+  boost::condition_variable cv_;
+
+  static WorkSupervisor *instance_;
+  static boost::mutex instance_mut_;
+};
+}  // namespace task_net
+#endif  // INCLUDE_WORK_HANDLE_H_
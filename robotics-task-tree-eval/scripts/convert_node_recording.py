@@ -0,0 +1,142 @@
+#!/usr/bin/env python
+'''
+Description: Convert a binary node recording (~record_dir, *.ttrec) written by
+NodeRecorder into one CSV file per node, in the <node>_state_Data_.csv layout
+that table_setting_demo/scripts/graph_node_activation.py reads:
+
+  seconds, active, done, activation_level, activation_potential,working,suitability
+
+Timestamps are converted from the monotonic clock to epoch seconds with the
+wall clock time stored in the log header.
+
+CSV recordings of a whole process (<process>_Data_.csv or its segments),
+whose lines start with the node's topic, are split up the same way.
+'''
+import argparse
+import logging
+import os
+import struct
+import sys
+
+# Must match RecordFileHeader / RecordEntry in node_recorder.h
+RECORD_MAGIC = b'TTREC01\x00'
+HEADER_FORMAT = '<8s6I4Q'
+ENTRY_FORMAT = '<QI3f3B5x'
+
+
+def ReadHeader(data):
+  fields = struct.unpack_from(HEADER_FORMAT, data, 0)
+  header = dict(zip(['magic', 'version', 'header_size', 'record_size',
+                     'node_count', 'name_length', 'rate_hz', 'data_offset',
+                     'wall_start_ns', 'monotonic_start_ns', 'record_count'],
+                    fields))
+  if header['magic'] != RECORD_MAGIC:
+    raise ValueError('not a node recording (bad magic)')
+  if header['record_size'] != struct.calcsize(ENTRY_FORMAT):
+    raise ValueError('unsupported record size %d' % header['record_size'])
+  return header
+
+
+def ReadNames(data, header):
+  names = list()
+  offset = header['header_size']
+  for i in range(header['node_count']):
+    raw = data[offset:offset + header['name_length']]
+    names.append(raw.split(b'\x00')[0].decode('ascii'))
+    offset += header['name_length']
+  return names
+
+
+def Convert(filename, out_dir, suffix):
+  with open(filename, 'rb') as f:
+    data = f.read()
+  header = ReadHeader(data)
+  names = ReadNames(data, header)
+
+  # A log cut short by a crash still has every record up to record_count
+  available = (len(data) - header['data_offset']) // header['record_size']
+  count = min(header['record_count'], available)
+  logging.info('%s: %d nodes, %d records at %d Hz', filename,
+               header['node_count'], count, header['rate_hz'])
+
+  outputs = dict()
+  try:
+    offset = header['data_offset']
+    for i in range(count):
+      (stamp, node, level, potential, suitability, active, done,
+       working) = struct.unpack_from(ENTRY_FORMAT, data, offset)
+      offset += header['record_size']
+      if node >= len(names):
+        continue
+      if node not in outputs:
+        path = os.path.join(out_dir, names[node] + suffix)
+        print('Writing [%s]' % path)
+        outputs[node] = open(path, 'w')
+      seconds = (header['wall_start_ns']
+                 + (stamp - header['monotonic_start_ns'])) / 1e9
+      outputs[node].write('%.15f, %d, %d, %.15f, %.15f,%d,%.15f\n' % (
+          seconds, active != 0, done != 0, level, potential, working != 0,
+          suitability))
+  finally:
+    for output in outputs.values():
+      output.close()
+  return len(outputs)
+
+
+def SplitCsv(filenames, out_dir, suffix):
+  outputs = dict()
+  try:
+    for filename in filenames:
+      with open(filename) as f:
+        for line in f:
+          topic, _, record = line.partition(', ')
+          if not record:
+            continue
+          name = topic[:-len('_state')] if topic.endswith('_state') else topic
+          if name not in outputs:
+            path = os.path.join(out_dir, name + suffix)
+            print('Writing [%s]' % path)
+            outputs[name] = open(path, 'w')
+          outputs[name].write(record)
+  finally:
+    for output in outputs.values():
+      output.close()
+  return len(outputs)
+
+
+def main():
+  parser = argparse.ArgumentParser(
+      description='Convert binary node recordings to per node CSV files')
+  parser.add_argument('recordings', nargs='+',
+                      help='*.ttrec files, or process *.csv files in order')
+  parser.add_argument('-o', '--out', type=str, default='.',
+                      help='Directory for the CSV files')
+  parser.add_argument('-s', '--suffix', type=str, default='_state_Data_.csv',
+                      help='Appended to each node name')
+  parser.add_argument('-v', '--verbose', action='store_true')
+  args = parser.parse_args()
+  logging.basicConfig(level=logging.INFO if args.verbose else logging.WARNING)
+
+  if not os.path.isdir(args.out):
+    logging.error('Output directory not found - [%s]' % os.path.abspath(args.out))
+    return -1
+  csv = [recording for recording in args.recordings
+         if recording.endswith('.csv')]
+  try:
+    if csv:
+      SplitCsv(csv, args.out, args.suffix)
+  except IOError as e:
+    logging.error('%s' % e)
+    return -1
+  for recording in args.recordings:
+    if recording.endswith('.csv'):
+      continue
+    try:
+      Convert(recording, args.out, args.suffix)
+    except (IOError, ValueError, struct.error) as e:
+      logging.error('%s: %s' % (recording, e))
+      return -1
+  return 0
+
+if __name__ == '__main__':
+  sys.exit(main())
@@ -0,0 +1,163 @@
+#!/usr/bin/env python
+'''
+Description: Generate synthetic THEN/AND/OR task trees for scalability tests.
+Output => a NodeList/Nodes parameter YAML in the same format as the
+test_network_*.yaml files read by behavior_network.cc and
+task_tree_benchmark.cc.
+
+Every robot gets its own copy of the tree below its own ROOT node, and the
+nodes at the same position in each copy are peers, as in the hand written
+multi robot trees. Leaves are PLACE nodes.
+'''
+import argparse
+import random
+import sys
+
+# Must match NodeTypes_t in robotics_task_tree_msgs/node_types.h
+NODE_TYPES = {'THEN': 0, 'OR': 1, 'AND': 2, 'ROOT': 4, 'PLACE': 5}
+MAX_NODE_ID = 0xffff
+
+
+def BuildShape(depth, fanout, max_nodes, types, rng):
+  '''
+  Breadth first tree shape shared by all robots. Returns a list of
+  (type, parent index, level); index 0 is the top node. max_nodes caps the
+  number of nodes, the nodes that cannot get children become leaves.
+  '''
+  shape = [[None, None, 0]]
+  queue = [0]
+  while queue:
+    index = queue.pop(0)
+    level = shape[index][2]
+    count = fanout if level < depth else 0
+    if max_nodes > 0:
+      count = min(count, max_nodes - len(shape))
+    if count <= 0:
+      shape[index][0] = 'PLACE'
+      continue
+    if rng:
+      shape[index][0] = rng.choice(types)
+    else:
+      shape[index][0] = types[level % len(types)]
+    for i in range(count):
+      shape.append([None, index, level + 1])
+      queue.append(len(shape) - 1)
+  return shape
+
+
+def NodeName(node_type, robot, node_id):
+  return '%s_%d_%d_%03d' % (node_type, NODE_TYPES[node_type], robot, node_id)
+
+
+def GenerateTree(shape, robots):
+  '''
+  Returns the NodeList and a dict of node name -> description.
+  '''
+  node_list = list()
+  nodes = dict()
+  next_id = 0
+  names = list()
+  roots = list()
+  for robot in range(robots):
+    roots.append(NodeName('ROOT', robot, next_id))
+    next_id += 1
+    robot_names = list()
+    for node in shape:
+      robot_names.append(NodeName(node[0], robot, next_id))
+      next_id += 1
+    names.append(robot_names)
+  if next_id > MAX_NODE_ID:
+    raise ValueError('%d nodes do not fit the 16 bit node id' % next_id)
+
+  for robot in range(robots):
+    root = roots[robot]
+    node_list.append(root)
+    nodes[root] = {'type': NODE_TYPES['ROOT'], 'robot': robot,
+                   'node': int(root.split('_')[-1]),
+                   'parent': 'NONE', 'children': [names[robot][0]],
+                   'peers': ['NONE']}
+    for index, node in enumerate(shape):
+      name = names[robot][index]
+      node_list.append(name)
+      parent = root if node[1] is None else names[robot][node[1]]
+      children = [names[robot][i] for i, child in enumerate(shape)
+                  if child[1] == index]
+      peers = [names[other][index] for other in range(robots)
+               if other != robot]
+      nodes[name] = {'type': NODE_TYPES[node[0]], 'robot': robot,
+                     'node': int(name.split('_')[-1]), 'parent': parent,
+                     'children': children, 'peers': peers or ['NONE']}
+  return node_list, nodes
+
+
+def QuoteList(names):
+  return '[' + ', '.join("'%s'" % name for name in names) + ']'
+
+
+def WriteYaml(out, node_list, nodes, description):
+  out.write('# %s\n\n' % description)
+  out.write('NodeList: [' + ',\n        '.join(
+      "'%s'" % name for name in node_list) + ']\n\n')
+  out.write('Nodes:\n')
+  for name in node_list:
+    node = nodes[name]
+    out.write('  %s:\n' % name)
+    out.write('    mask:\n')
+    out.write('      type: %d\n' % node['type'])
+    out.write('      robot: %d\n' % node['robot'])
+    out.write('      node: %d\n' % node['node'])
+    out.write("    parent: '%s'\n" % node['parent'])
+    if node['children']:
+      out.write('    children: %s\n' % QuoteList(node['children']))
+    out.write('    peers: %s\n\n' % QuoteList(node['peers']))
+
+
+def main():
+  parser = argparse.ArgumentParser(
+      description='Generate a synthetic task tree parameter file')
+  parser.add_argument('-d', '--depth', type=int, default=3,
+                      help='Levels below the top node')
+  parser.add_argument('-f', '--fanout', type=int, default=3,
+                      help='Children of every THEN/AND/OR node')
+  parser.add_argument('-r', '--robots', type=int, default=1,
+                      help='Robots, each with a copy of the tree')
+  parser.add_argument('-n', '--nodes', type=int, default=0,
+                      help='Maximum nodes per robot, 0 for a full tree')
+  parser.add_argument('-t', '--types', type=str, default='THEN,AND,OR',
+                      help='Internal node types, used per level in order')
+  parser.add_argument('-s', '--seed', type=int, default=None,
+                      help='Pick internal node types at random with this seed')
+  parser.add_argument('-o', '--out', type=str, default=None,
+                      help='Output YAML file, stdout if not given')
+  args = parser.parse_args()
+
+  types = [t.strip().upper() for t in args.types.split(',') if t.strip()]
+  for node_type in types:
+    if node_type not in ('THEN', 'AND', 'OR'):
+      sys.stderr.write('Unknown node type [%s]\n' % node_type)
+      return -1
+  if args.depth < 0 or args.fanout < 1 or args.robots < 1:
+    sys.stderr.write('depth >= 0, fanout >= 1 and robots >= 1 required\n')
+    return -1
+
+  rng = random.Random(args.seed) if args.seed is not None else None
+  shape = BuildShape(args.depth, args.fanout, args.nodes, types, rng)
+  try:
+    node_list, nodes = GenerateTree(shape, args.robots)
+  except ValueError as e:
+    sys.stderr.write('%s\n' % e)
+    return -1
+
+  description = ('generate_task_tree.py depth=%d fanout=%d robots=%d '
+                 'nodes=%d types=%s seed=%s: %d nodes per robot' % (
+                     args.depth, args.fanout, args.robots, args.nodes,
+                     ','.join(types), args.seed, len(shape)))
+  if args.out:
+    with open(args.out, 'w') as out:
+      WriteYaml(out, node_list, nodes, description)
+  else:
+    WriteYaml(sys.stdout, node_list, nodes, description)
+  return 0
+
+if __name__ == '__main__':
+  sys.exit(main())
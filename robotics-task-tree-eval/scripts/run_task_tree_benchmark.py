@@ -0,0 +1,102 @@
+#!/usr/bin/env python
+'''
+Description: Run the task_tree_benchmark executable once per robot on a
+generated (or given) task tree and collect the results. Needs a running
+roscore.
+
+  run_task_tree_benchmark.py -d 4 -f 3 -r 2 -- _executor_threads:=4
+
+Arguments after -- are passed to every benchmark process, so the node
+params (executor_threads, event_driven_update, readiness_barrier, ...) can
+be compared on the same tree. Each process appends one CSV line to the
+results file:
+
+  robot, nodes, depth, completed, seconds, messages/s, published/s,
+  threads, rss kB, cpu %, mean decision latency per level in ms (';'
+  separated)
+
+messages/s counts the control messages the nodes send, published/s the ROS
+messages that go out for them (own topics, state topics and batches).
+'''
+import argparse
+import os
+import subprocess
+import sys
+import tempfile
+
+RESULT_FIELDS = ['robot', 'nodes', 'depth', 'completed', 'seconds',
+                 'msgs/s', 'pub/s', 'threads', 'rss_kb', 'cpu%',
+                 'level_ms']
+
+
+def GenerateTree(args, filename):
+  script = os.path.join(os.path.dirname(os.path.abspath(__file__)),
+                        'generate_task_tree.py')
+  command = [sys.executable, script, '-d', str(args.depth), '-f',
+             str(args.fanout), '-r', str(args.robots), '-n', str(args.nodes),
+             '-t', args.types, '-o', filename]
+  if args.seed is not None:
+    command += ['-s', str(args.seed)]
+  subprocess.check_call(command)
+
+
+def PrintResults(filename):
+  with open(filename) as f:
+    rows = [line.strip().split(',') for line in f if line.strip()]
+  print(' '.join('%10s' % field for field in RESULT_FIELDS))
+  for row in rows:
+    print(' '.join('%10s' % value for value in row))
+
+
+def main():
+  parser = argparse.ArgumentParser(
+      description='Run the task tree scalability benchmark')
+  parser.add_argument('-y', '--yaml', type=str, default=None,
+                      help='Existing tree, otherwise one is generated')
+  parser.add_argument('-d', '--depth', type=int, default=3)
+  parser.add_argument('-f', '--fanout', type=int, default=3)
+  parser.add_argument('-r', '--robots', type=int, default=1)
+  parser.add_argument('-n', '--nodes', type=int, default=0)
+  parser.add_argument('-t', '--types', type=str, default='THEN,AND,OR')
+  parser.add_argument('-s', '--seed', type=int, default=None)
+  parser.add_argument('-o', '--results', type=str,
+                      default='task_tree_benchmark.csv',
+                      help='CSV file the processes append to')
+  parser.add_argument('params', nargs='*',
+                      help='_param:=value passed to every process')
+  args = parser.parse_args()
+
+  tree = args.yaml
+  if not tree:
+    handle, tree = tempfile.mkstemp(prefix='task_tree_', suffix='.yaml')
+    os.close(handle)
+    GenerateTree(args, tree)
+    print('Generated [%s]' % tree)
+
+  results = os.path.abspath(args.results)
+  if os.path.exists(results):
+    os.remove(results)
+
+  processes = list()
+  try:
+    for robot in range(args.robots):
+      name = 'bench_%d' % robot
+      subprocess.check_call(['rosparam', 'load', tree, '/' + name])
+      command = ['rosrun', 'robotics_task_tree_eval', 'task_tree_benchmark',
+                 '__name:=' + name, '_robot:=%d' % robot,
+                 '_results_file:=' + results] + args.params
+      processes.append(subprocess.Popen(command))
+    status = 0
+    for process in processes:
+      status = process.wait() or status
+  except KeyboardInterrupt:
+    for process in processes:
+      process.terminate()
+    return -1
+
+  if os.path.exists(results):
+    PrintResults(results)
+  return status
+
+if __name__ == '__main__':
+  sys.exit(main())
@@ -193,6 +193,8 @@ int main(int argc, char *argv[]) {
       // printf("MADE 5\n");
     }
   }
+  // All nodes of this process exist, let the readiness barrier report
+  task_net::ReadinessBarrier::NodesCreated();
   printf("now spinning\n");
   ros::spin();
   return 0;
@@ -0,0 +1,191 @@
+/*
+robotics-task-tree-eval
+Copyright (C) 2015  Luke Fraser
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#include "robotics_task_tree_eval/batch_transport.h"
+#include <boost/bind.hpp>
+#include "remote_mutex/sim_clock.h"
+#include "robotics_task_tree_eval/node_executor.h"
+#include "robotics_task_tree_eval/node_table.h"
+
+#define BATCH_TOPIC "task_tree_batch"
+#define BATCH_QUEUE_SIZE 100
+
+namespace task_net {
+
+BatchTransport *BatchTransport::instance_ = NULL;
+boost::mutex BatchTransport::instance_mut_;
+
+BatchTransport* BatchTransport::Configure(
+    boost::posix_time::time_duration period) {
+  boost::lock_guard<boost::mutex> lock(instance_mut_);
+  if (!instance_) {
+    instance_ = new BatchTransport(period);
+    ROS_INFO("BatchTransport publishing every %ld ms",
+      static_cast<long>(period.total_milliseconds()));
+  }
+  return instance_;
+}
+
+BatchTransport* BatchTransport::Instance() {
+  boost::lock_guard<boost::mutex> lock(instance_mut_);
+  return instance_;
+}
+
+BatchTransport::BatchTransport(boost::posix_time::time_duration period)
+    : seq_(0), period_(period), batches_sent_(0), messages_sent_(0),
+      flush_thread_(NULL) {
+  sender_ = ros::this_node::getName();
+  pending_.reset(new robotics_task_tree_msgs::ControlBatch);
+  batch_pub_ = nh_.advertise<robotics_task_tree_msgs::ControlBatch>(
+    BATCH_TOPIC, BATCH_QUEUE_SIZE);
+  batch_sub_ = nh_.subscribe(BATCH_TOPIC, BATCH_QUEUE_SIZE,
+    &BatchTransport::ReceiveBatch, this);
+
+  executor_ = NodeExecutor::Instance();
+  if (executor_)
+    executor_->PostAfter(period_, boost::bind(&FlushTask, this));
+  else
+    flush_thread_ = new boost::thread(&FlushThread, this);
+}
+
+BatchTransport::~BatchTransport() {
+  if (flush_thread_) {
+    flush_thread_->interrupt();
+    flush_thread_->join();
+    delete flush_thread_;
+  }
+}
+
+void BatchTransport::Queue(const NodeBitmask &dest,
+    LocalTransport::Channel channel, ConstControlMessagePtr_t msg) {
+  robotics_task_tree_msgs::RoutedControlMessage routed;
+  routed.dest.type = dest.type;
+  routed.dest.robot = dest.robot;
+  routed.dest.node = dest.node;
+  routed.channel = static_cast<uint8_t>(channel);
+  routed.msg.sender.type = msg->sender.type;
+  routed.msg.sender.robot = msg->sender.robot;
+  routed.msg.sender.node = msg->sender.node;
+  routed.msg.type = msg->type;
+  routed.msg.activation_level = msg->activation_level;
+  routed.msg.activation_potential = msg->activation_potential;
+  routed.msg.done = msg->done;
+  routed.msg.active = msg->active;
+  routed.msg.highest.type = msg->highest.type;
+  routed.msg.highest.robot = msg->highest.robot;
+  routed.msg.highest.node = msg->highest.node;
+  routed.msg.parent_type = msg->parent_type;
+  routed.msg.collision = msg->collision;
+  routed.msg.peerPlacing = msg->peerPlacing;
+  routed.msg.selfPlacing = msg->selfPlacing;
+  routed.msg.peerUndone = msg->peerUndone;
+
+  boost::lock_guard<boost::mutex> lock(mut_);
+  pending_->messages.push_back(routed);
+}
+
+// Publish everything queued since the last flush as one message. Empty
+// periods publish nothing.
+void BatchTransport::Flush() {
+  robotics_task_tree_msgs::ControlBatch::Ptr batch;
+  {
+    boost::lock_guard<boost::mutex> lock(mut_);
+    if (pending_->messages.empty())
+      return;
+    batch = pending_;
+    pending_.reset(new robotics_task_tree_msgs::ControlBatch);
+    batch->sender = sender_;
+    batch->seq = seq_++;
+    batches_sent_++;
+    messages_sent_ += batch->messages.size();
+  }
+  batch_pub_.publish(batch);
+}
+
+// Our own subscriber counts too, so a remote peer makes it more than one
+bool BatchTransport::Connected() {
+  return batch_pub_.getNumSubscribers() > 1;
+}
+
+uint64_t BatchTransport::BatchesSent() {
+  boost::lock_guard<boost::mutex> lock(mut_);
+  return batches_sent_;
+}
+
+uint64_t BatchTransport::MessagesSent() {
+  boost::lock_guard<boost::mutex> lock(mut_);
+  return messages_sent_;
+}
+
+void BatchTransport::ReceiveBatch(
+    const robotics_task_tree_msgs::ControlBatch::ConstPtr &batch) {
+  // Our own batches only carry messages for other processes
+  if (batch->sender == sender_)
+    return;
+  NodeTable *table = NodeTable::Instance();
+  if (!table)
+    return;
+  LocalTransport *transport = LocalTransport::Instance();
+  for (size_t i = 0; i < batch->messages.size(); ++i) {
+    const robotics_task_tree_msgs::RoutedControlMessage &routed =
+      batch->messages[i];
+    if (routed.channel >= LocalTransport::NUM_CHANNELS)
+      continue;
+    NodeBitmask dest;
+    dest.type = routed.dest.type;
+    dest.robot = routed.dest.robot;
+    dest.node = routed.dest.node;
+    NodeHandle_t handle = table->Handle(dest);
+    if (handle == NodeTable::INVALID_HANDLE || !transport->IsLocal(handle))
+      continue;
+
+    boost::shared_ptr<ControlMessage_t> msg(new ControlMessage_t);
+    msg->sender.type = routed.msg.sender.type;
+    msg->sender.robot = routed.msg.sender.robot;
+    msg->sender.node = routed.msg.sender.node;
+    msg->type = routed.msg.type;
+    msg->activation_level = routed.msg.activation_level;
+    msg->activation_potential = routed.msg.activation_potential;
+    msg->done = routed.msg.done;
+    msg->active = routed.msg.active;
+    msg->highest.type = routed.msg.highest.type;
+    msg->highest.robot = routed.msg.highest.robot;
+    msg->highest.node = routed.msg.highest.node;
+    msg->parent_type = routed.msg.parent_type;
+    msg->collision = routed.msg.collision;
+    msg->peerPlacing = routed.msg.peerPlacing;
+    msg->selfPlacing = routed.msg.selfPlacing;
+    msg->peerUndone = routed.msg.peerUndone;
+    transport->Deliver(handle,
+      static_cast<LocalTransport::Channel>(routed.channel), msg);
+  }
+}
+
+void BatchTransport::FlushThread(BatchTransport *batcher) {
+  mutex::SimClock::Client client;
+  while (true) {
+    mutex::SimClock::Sleep(batcher->period_);
+    batcher->Flush();
+  }
+}
+
+void BatchTransport::FlushTask(BatchTransport *batcher) {
+  batcher->Flush();
+  batcher->executor_->PostAfter(batcher->period_,
+    boost::bind(&FlushTask, batcher));
+}
+}  // namespace task_net
@@ -74,46 +74,23 @@ void AndBehavior::UpdateActivationPotential() {
     return;
   }
 
-  // this should choose bubble up child with highest potential
+  // this should choose bubble up child with highest potential, out of the
+  // children that are not done, active or taken by a peer
   float highest = -1;
   NodeBitmask nbm = mask_;
-  //ROS_INFO( "default mask (%02d_%1d_%03d)", mask_.type, mask_.robot, mask_.node );
-  float sum = 0;
-  for (NodeListPtrIterator it = children_.begin();
-      it != children_.end(); ++it) {
-    sum += (*it)->state.activation_potential;
-    if( (*it)->state.activation_potential > highest && !(*it)->state.done && !(*it)->state.peer_done && !(*it)->state.peer_active && !(*it)->state.active )
-    {
-      //sum += (*it)->state.activation_potential;
-      // save as the highest potential
-      highest = (*it)->state.activation_potential;
-      nbm.type = (*it)->state.highest.type;
-      nbm.robot = (*it)->state.highest.robot;
-      nbm.node = (*it)->state.highest.node;
-      //ROS_INFO( "nbm mask (%02d_%1d_%03d)", nbm.type, nbm.robot, nbm.node );
-      //nbm = (*it)->state.highest;
-      
-    }
+  NodeId_t *child = HighestOpenChild();
+  if (child && child->state.activation_potential > highest) {
+    highest = child->state.activation_potential;
+    nbm = child->state.highest;
   }
   state_.activation_potential = highest;
-  //state_.activation_potential = sum /children_.size();
   state_.highest_potential = highest;
-  state_.highest.type = nbm.type;
-  state_.highest.robot = nbm.robot;
-  state_.highest.node = nbm.node;
-  //ROS_INFO( "highest mask (%02d_%1d_%03d)", state_.highest.type, state_.highest.robot, state_.highest.node );
+  state_.highest = nbm;
 }
 
 bool AndBehavior::Precondition() {
     // ROS_INFO("AndBehavior::Precondition was called!!!!\n");
-  bool satisfied = true;
-  for (NodeListPtrIterator it = children_.begin();
-      it != children_.end(); ++it) {
-    satisfied = satisfied && (*it)->state.done;
-  }
-  if (satisfied)
-    return true;
-  return false;
+  return AllChildrenDone();
 }
 
 uint32_t AndBehavior::SpreadActivation() {
@@ -132,14 +109,10 @@ uint32_t AndBehavior::SpreadActivation() {
 
 bool AndBehavior::IsDone() {
   ROS_DEBUG("[%s]: AndBehavior::IsDone was called", name_->topic.c_str() );
-  for( int i = 0; i < children_.size(); i++ )
+  if( !AllChildrenFinished() )
   {
-    if( !(children_[i]->state.done || children_[i]->state.peer_done) ) 
-    {
-      ROS_DEBUG( "[%s]: state not done: %d", name_->topic.c_str(), children_[i]->state.owner.node);
-      state_.done = 0;
-      return false;
-    }
+    state_.done = 0;
+    return false;
   }
 
   state_.done = 1;
@@ -188,19 +161,10 @@ void ThenBehavior::UpdateActivationPotential() {
   // this should bubble up first not done child
   float highest = 0;
   NodeBitmask nbm = mask_;
-
-
-  for (NodeListPtrIterator it = children_.begin();
-      it != children_.end(); ++it) {
-    //ROS_INFO( "\t[%s]: checking [%d]: [%d|%d|%d|%d]", name_->topic.c_str(), (*it)->state.owner.node, (*it)->state.done, (*it)->state.peer_done, (*it)->state.active, (*it)->state.peer_active );
-    // find the first not done/active node
-    if( !(*it)->state.done && !(*it)->state.peer_done && !(*it)->state.peer_active )
-    {
-      // save as the highest potential
-      highest = (*it)->state.activation_potential;
-      nbm = (*it)->state.highest;
-      break;
-    }
+  NodeId_t *child = FirstOpenChild();
+  if (child) {
+    highest = child->state.activation_potential;
+    nbm = child->state.highest;
   }
 
   state_.activation_potential = highest; //sum / children_.size();
@@ -211,14 +175,7 @@ void ThenBehavior::UpdateActivationPotential() {
 
 bool ThenBehavior::Precondition() {
     // ROS_INFO("ThenBehavior::Precondition was called!!!!\n");
-  bool satisfied = true;
-  for (NodeListPtrIterator it = children_.begin();
-      it != children_.end(); ++it) {
-    satisfied = satisfied && (*it)->state.done;
-  }
-  if (satisfied)
-    return true;
-  return false;
+  return AllChildrenDone();
 }
 
 uint32_t ThenBehavior::SpreadActivation() {
@@ -243,14 +200,10 @@ uint32_t ThenBehavior::SpreadActivation() {
 
 bool ThenBehavior::IsDone() {
   ROS_DEBUG("[%s]: ThenBehavior::IsDone was called", name_->topic.c_str() );
-  for( int i = 0; i < children_.size(); i++ )
+  if( !AllChildrenFinished() )
   {
-    if( !(children_[i]->state.done || children_[i]->state.peer_done) ) 
-    {
-      ROS_DEBUG( "[%s]: state not done: %d", name_->topic.c_str(), children_[i]->state.owner.node);
-      state_.done = 0;
-      return false;
-    }
+    state_.done = 0;
+    return false;
   }
 
   state_.done = 1;
@@ -284,7 +237,6 @@ OrBehavior::~OrBehavior() {}
 void OrBehavior::UpdateActivationPotential() {
     // ROS_INFO("OrBehavior::UpdateActivationPotential was called!!!!\n");
   float max = 0;
-  int max_child_index = 0, index = 0;
 
   // this should choose bubble up child with highest potential
   NodeBitmask nbm = mask_;
@@ -297,81 +249,43 @@ void OrBehavior::UpdateActivationPotential() {
     return;
   }
 
-  // first check if any children's peers are active or done....
-  bool descendant_active = false;
-  for (NodeListPtrIterator it = children_.begin();
-      it != children_.end(); ++it) {
-
-    if((*it)->state.peer_done || (*it)->state.peer_active )
-    {
-      descendant_active = true;
-      // ROS_INFO("XXXXXXXXXXXX    CASE 1: peer active or done %d XXXXXXXXXXXX", (*it)->mask.node);
-    }
-  }
-
   // if any children's peers were active or done, propagate peer_active to other children,
   // set activation to 0, and return from function
   // TODO: this logic for setting peer to active might not belong here since this runs asynch to other logic!!!
-  if ( descendant_active ) {
-   for (NodeListPtrIterator it = children_.begin();
-        it != children_.end(); ++it) {
-
-        (*it)->state.peer_active = true;
-        state_.highest_potential = 0;
-        state_.highest = mask_;
-        // ROS_INFO("XXXXXXXXXXXX    CASE 1: peer active or done %d XXXXXXXXXXXX", (*it)->mask.node);
-    }
+  if ( AnyChildClaimed() ) {
+    for (size_t i = 0; i < children_.size() && !AllChildrenClaimed(); ++i)
+      SetChildPeerActive(i, true);
+    state_.highest_potential = 0;
+    state_.highest = mask_;
     return;
   }
 
+  // a child is already done or being worked on
+  if ( AnyChildFinished() || AnyChildActive() ) {
+    state_.highest_potential = 0;
+    state_.highest = mask_;
+    return;
+  }
 
-  // go thorugh children and get highest activation
-  for (NodeListPtrIterator it = children_.begin();
-      it != children_.end(); ++it) {
-    float value = (*it)->state.activation_potential;
-
-    if((*it)->state.peer_done || (*it)->state.peer_active )
-    {
-      state_.highest_potential = 0;
-      state_.highest = mask_;
-      // ROS_INFO("XXXXXXXXXXXX    CASE 1: peer active or done %d XXXXXXXXXXXX", (*it)->mask.node);
-      return;
-    }
-    else if((*it)->state.done || (*it)->state.active )
-    {
-      state_.highest_potential = 0;
-      state_.highest = mask_;
-      // ROS_INFO("XXXXXXXXXXXX    CASE 2: me active or done %d XXXXXXXXXXXX", (*it)->mask.node);
-      return;
-    }
-    else if (value > max && !(*it)->state.done && !(*it)->state.peer_done && !(*it)->state.peer_active && !(*it)->state.active) {
-      max = value;
-      max_child_index = index;
-      nbm = (*it)->state.highest;
-      // ROS_INFO("XXXXXXXXXXXX    CASE 3: value>max  %d XXXXXXXXXXXX", (*it)->mask.node);
-    }
-    else {
-      // ROS_INFO("XXXXXXXXXXXX    CASE 4: value < max  %d XXXXXXXXXXXX", (*it)->mask.node);
-    }
-    index++;
+  // otherwise every child is open, bubble up the highest activation
+  NodeId_t *child = HighestOpenChild();
+  if (child && child->state.activation_potential > max) {
+    max = child->state.activation_potential;
+    nbm = child->state.highest;
   }
   state_.activation_potential = max;
   state_.highest_potential = max;
   state_.highest = nbm;
-  //random_child_selection = max_child_index;
 }
 
 bool OrBehavior::Precondition() {
   ROS_DEBUG("OrBehavior::Precondition was called!!!!\n");
-  
-  for( int i = 0; i < children_.size(); i++ )
+
+  if( AnyChildFinished() )
   {
-    if( children_[i]->state.done || children_[i]->state.peer_done) 
-    {
-      ROS_INFO( "[%s]: state done: %d", name_->topic.c_str(), children_[i]->state.owner.node);
-      state_.done = 1;
-      return true;
-    }
+    ROS_INFO( "[%s]: child state done", name_->topic.c_str());
+    state_.done = 1;
+    return true;
   }
 
   return false;
@@ -394,14 +308,10 @@ uint32_t OrBehavior::SpreadActivation() {
 
 bool OrBehavior::IsDone() {
   ROS_DEBUG("[%s]: OrBehavior::IsDone was called", name_->topic.c_str() );
-  for( int i = 0; i < children_.size(); i++ )
+  if( AnyChildFinished() )
   {
-    if( children_[i]->state.done || children_[i]->state.peer_done ) 
-    {
-      ROS_DEBUG( "[%s]: state done: %d", name_->topic.c_str(), children_[i]->state.owner.node);
-      state_.done = 1;
-      return true;
-    }
+    state_.done = 1;
+    return true;
   }
 
   state_.done = false;
@@ -0,0 +1,143 @@
+/*
+robotics-task-tree-eval
+Copyright (C) 2015  Luke Fraser
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#include "robotics_task_tree_eval/local_transport.h"
+#include <ros/ros.h>
+#include "robotics_task_tree_eval/node_executor.h"
+
+#define DRAIN_BATCH_SIZE 64
+
+namespace task_net {
+
+LocalTransport *LocalTransport::instance_ = NULL;
+boost::mutex LocalTransport::instance_mut_;
+
+LocalTransport* LocalTransport::Instance() {
+  boost::lock_guard<boost::mutex> lock(instance_mut_);
+  if (!instance_)
+    instance_ = new LocalTransport();
+  return instance_;
+}
+
+LocalTransport::LocalTransport()
+    : draining_(false), delivered_(0), dispatch_thread_(NULL) {
+  // Nodes configure the executor before they register with the transport
+  executor_ = NodeExecutor::Instance();
+  if (!executor_)
+    dispatch_thread_ = new boost::thread(&LocalTransport::DispatchThread, this);
+}
+
+LocalTransport::~LocalTransport() {
+  if (dispatch_thread_) {
+    dispatch_thread_->interrupt();
+    dispatch_thread_->join();
+    delete dispatch_thread_;
+  }
+}
+
+void LocalTransport::Register(NodeHandle_t node, Channel channel,
+    Handler handler) {
+  if (node == NodeTable::INVALID_HANDLE)
+    return;
+  boost::lock_guard<boost::mutex> lock(endpoint_mut_);
+  if (node >= endpoints_.size())
+    endpoints_.resize(node + 1);
+  endpoints_[node].handlers[channel] = handler;
+}
+
+bool LocalTransport::IsLocal(NodeHandle_t node) {
+  boost::lock_guard<boost::mutex> lock(endpoint_mut_);
+  if (node >= endpoints_.size())
+    return false;
+  for (int i = 0; i < NUM_CHANNELS; ++i) {
+    if (endpoints_[node].handlers[i])
+      return true;
+  }
+  return false;
+}
+
+bool LocalTransport::Deliver(NodeHandle_t node, Channel channel,
+    ConstControlMessagePtr_t msg) {
+  Delivery delivery;
+  {
+    boost::lock_guard<boost::mutex> lock(endpoint_mut_);
+    if (node >= endpoints_.size() || !endpoints_[node].handlers[channel])
+      return false;
+    delivery.handler = endpoints_[node].handlers[channel];
+  }
+  delivery.msg = msg;
+
+  bool post_drain = false;
+  {
+    boost::lock_guard<boost::mutex> lock(mailbox_mut_);
+    mailbox_.push_back(delivery);
+    if (executor_ && !draining_) {
+      draining_ = true;
+      post_drain = true;
+    }
+  }
+  if (post_drain)
+    executor_->Post(boost::bind(&LocalTransport::DrainTask, this));
+  else if (!executor_)
+    mailbox_cv_.notify_one();
+  return true;
+}
+
+uint64_t LocalTransport::Delivered() {
+  boost::lock_guard<boost::mutex> lock(mailbox_mut_);
+  return delivered_;
+}
+
+// Pops and runs one delivery with the mailbox unlocked. Returns false when the
+// mailbox is empty.
+bool LocalTransport::DispatchOne(boost::unique_lock<boost::mutex> *lock) {
+  if (mailbox_.empty())
+    return false;
+  Delivery delivery = mailbox_.front();
+  mailbox_.pop_front();
+  delivered_++;
+  lock->unlock();
+  delivery.handler(delivery.msg);
+  lock->lock();
+  return true;
+}
+
+void LocalTransport::DispatchThread(LocalTransport *transport) {
+  boost::unique_lock<boost::mutex> lock(transport->mailbox_mut_);
+  while (true) {
+    while (transport->mailbox_.empty())
+      transport->mailbox_cv_.wait(lock);
+    transport->DispatchOne(&lock);
+  }
+}
+
+// Executor strand: only one drain task exists at a time, which keeps the
+// per-sender message order that the node callbacks expect. A busy mailbox is
+// drained in batches so it cannot hold a worker forever.
+void LocalTransport::DrainTask(LocalTransport *transport) {
+  boost::unique_lock<boost::mutex> lock(transport->mailbox_mut_);
+  for (int i = 0; i < DRAIN_BATCH_SIZE; ++i) {
+    if (!transport->DispatchOne(&lock)) {
+      transport->draining_ = false;
+      return;
+    }
+  }
+  lock.unlock();
+  transport->executor_->Post(boost::bind(&LocalTransport::DrainTask,
+    transport));
+}
+}  // namespace task_net
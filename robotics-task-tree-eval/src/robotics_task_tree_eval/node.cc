@@ -18,15 +18,19 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>.
 #include "robotics_task_tree_eval/node.h"
 #include <boost/thread/thread.hpp>
 #include <boost/date_time.hpp>
-#include <boost/algorithm/string/split.hpp>
-#include <boost/algorithm/string/classification.hpp>
 #include <boost/bind.hpp>
 #include <boost/shared_ptr.hpp>
 #include <boost/function.hpp>
+#include <stdio.h>
 #include <stdlib.h>
+#include <math.h>
+#include <algorithm>
+#include <atomic>
 #include <string>
 #include <vector>
 #include "robotics_task_tree_msgs/State.h"
+#include "remote_mutex/sim_clock.h"
+#include "timeseries_recording_toolkit/shared_memory_recorder.h"
 #include "log.h"
 #include "vision_manip_pipeline/VisionManip.h"
 #include "table_setting_demo/pick_and_place.h"
@@ -39,13 +43,34 @@ namespace task_net {
 #define STATE_MSG_LEN (sizeof(State))
 #define ACTIVATION_THESH 0.1
 #define ACTIVATION_FALLOFF 0.999f
+#define STARTUP_DELAY_MS 5000
+#define READY_TIMEOUT_MS 30000
+#define RECORD_PERIOD_MS 100
+// Digits after the point of recorded values
+#define RECORD_PRECISION 15
+// Directory of the process CSV file in the default recording mode
+#define RECORD_DATA_DIR \
+  "/home/bashira/catkin_ws/src/Distributed_Collaborative_Task_Tree/Data"
+#define UPDATE_HEARTBEAT_MS 500
+#define PUBLISH_HEARTBEAT_MS 1000
+#define PUBLISH_EPSILON 0.001f
+// How often Dialogue() looks for the resolution
+#define DIALOGUE_POLL_MS 10
+// How often the suppressed state publishes are logged
+#define SUPPRESSED_REPORT_PERIOD_S 10
 
 int APPLEHACK = 0;
 
+static std::atomic<uint64_t> messages_sent(0);
+static std::atomic<uint64_t> messages_published(0);
+static std::atomic<uint64_t> publishes_suppressed(0);
+
 bool RESP_RECEIVED = false;
 bool FAILED_PICK = false;
 
 void PeerCheckThread(Node *node);
+void EventUpdateTask(Node *node);
+void UpdateTask(Node *node);
 
 
 //---------------
@@ -172,6 +197,26 @@ Node::Node() {
   state_.done = false;
   thread_running_ = false;
   parent_done_ = false;
+  executor_ = NULL;
+  event_driven_ = false;
+  intra_process_ = false;
+  batch_ = NULL;
+  node_table_ = NULL;
+  child_slots_ = NULL;
+  child_reported_ = NULL;
+  child_report_words_ = 0;
+  work_generation_ = 0;
+  work_executor_ = NULL;
+  work_pending_ = false;
+  recorder_ = NULL;
+  print_recorder_ = NULL;
+  record_thread = NULL;
+  dialogue_thread_ = NULL;
+  barrier_ = NULL;
+  change_only_publish_ = false;
+  published_once_ = false;
+  publishes_sent_ = 0;
+  publishes_suppressed_ = 0;
 }
 
 Node::Node(NodeId_t name, NodeList peers, NodeList children, NodeId_t parent,
@@ -192,11 +237,11 @@ Node::Node(NodeId_t name, NodeList peers, NodeList children, NodeId_t parent,
 
   // Generate reverse map
   GenerateNodeBitmaskMap();
-  name_   = node_dict_[GetBitmask(name.topic)];
+  name_   = LookupNode(GetBitmask(name.topic));
 
   for (NodeListIterator it = peers.begin(); it != peers.end(); ++it) {
     if(strcmp(it->topic.c_str(), "NONE") != 0) {
-      peers_.push_back(node_dict_[GetBitmask(it->topic)]);
+      peers_.push_back(LookupNode(GetBitmask(it->topic)));
       // NOTE: THIS IS PROBABLY IN THE WRONG SPOT NOW BUT IT WAS CAUSING ISSUES BELOW!
       ROS_WARN( "PEER OKAY" );
     }
@@ -204,11 +249,12 @@ Node::Node(NodeId_t name, NodeList peers, NodeList children, NodeId_t parent,
 
   for (NodeListIterator it = children.begin(); it != children.end(); ++it) {
     if(strcmp(it->topic.c_str(), "NONE") != 0) {
-      children_.push_back(node_dict_[GetBitmask(it->topic)]);
+      children_.push_back(LookupNode(GetBitmask(it->topic)));
       ROS_WARN( "CHILD IS FOUND" );
     }
   }
-  parent_ = node_dict_[GetBitmask(parent.topic)];
+  parent_ = LookupNode(GetBitmask(parent.topic));
+  InitializeChildSlots();
   // Setup bitmasks
   InitializeBitmask(name_);
   InitializeBitmasks(peers_);
@@ -265,6 +311,21 @@ Node::Node(NodeId_t name, NodeList peers, NodeList children, NodeId_t parent,
   // printf("name: %s\n", name_->topic.c_str());
   mask_ = GetBitmask(name_->topic);
 
+  // Opt-in shared executor: all nodes of this process share a fixed pool.
+  // Configured before the subscribers so the local transport can use it.
+  int executor_threads;
+  local_.param<int>("executor_threads", executor_threads, 0);
+  executor_ = NULL;
+  if (executor_threads > 0)
+    executor_ = NodeExecutor::Configure(executor_threads);
+  local_.param<bool>("intra_process", intra_process_, false);
+  int batch_period_ms;
+  local_.param<int>("batch_period_ms", batch_period_ms, 0);
+  batch_ = NULL;
+  if (batch_period_ms > 0)
+    batch_ = BatchTransport::Configure(
+      boost::posix_time::millisec(batch_period_ms));
+
   // Setup Publisher/subscribers
   InitializeSubscriber(name_);
   InitializePublishers(children_, &children_pub_list_, "_parent");
@@ -285,7 +346,26 @@ Node::Node(NodeId_t name, NodeList peers, NodeList children, NodeId_t parent,
   ROS_WARN("END OF NODE CONSTRUCTOR");
 }
 
-Node::~Node() {}
+Node::~Node() {
+  // Stop recording before the node goes away: a record running now
+  // finishes first, later ones see stopped
+  if (record_control_) {
+    boost::lock_guard<boost::mutex> lock(record_control_->mut);
+    record_control_->stopped = true;
+  }
+  if (record_thread) {
+    record_thread->interrupt();
+    record_thread->join();
+    delete record_thread;
+  }
+  if (dialogue_thread_) {
+    dialogue_thread_->interrupt();
+    dialogue_thread_->join();
+    delete dialogue_thread_;
+  }
+  delete[] child_slots_;
+  delete[] child_reported_;
+}
 
 void Node::init()
 {
@@ -324,16 +404,19 @@ void Node::GenerateNodeBitmaskMap() {
       // ROS_INFO("Node::GenerateNodeBitmaskMap was called!!!!\n");
 
   std::vector<std::string> nodes;
+  node_table_ = NULL;
   if (local_.getParam("NodeList", nodes)) {
     // printf("Generating BitmaskMap\n");
-    for (std::vector<std::string>::iterator it = nodes.begin();
-        it != nodes.end(); ++it) {
+    // Names and masks are parsed once per process by the shared table
+    node_table_ = NodeTable::Load(nodes);
+    node_dict_.assign(node_table_->Size(), NULL);
+    for (NodeHandle_t handle = 0; handle < node_table_->Size(); ++handle) {
       NodeId_t *nptr = new NodeId_t;
-      nptr->topic = *it;
-      nptr->mask = GetBitmask(*it);
+      nptr->topic = node_table_->Name(handle);
+      nptr->mask = node_table_->Mask(handle);
       nptr->pub = NULL;
       nptr->state =  {nptr->mask, false, false, 0.0f, 0.0f};
-      node_dict_[nptr->mask] = nptr;
+      node_dict_[handle] = nptr;
       // printf("Adding [%s] to Dictionary.\n", nptr->topic.c_str());
     }
   }
@@ -345,7 +428,16 @@ void Node::Activate() {
   // TODO JB: have this only spin a new thread if the thread doesn't already exist
   // create peer_check thread if it isn't already running
 
-  if(!peer_check_thread) {
+  if (executor_) {
+    // peer check is a short task, so run it on the shared executor instead
+    // of spawning a detached thread per activation attempt
+    if (!thread_running_ && !state_.check_peer) {
+      state_.check_peer = true;
+      thread_running_ = true;
+      executor_->Post(boost::bind(&PeerCheckThread, this));
+    }
+  }
+  else if(!peer_check_thread) {
     state_.check_peer = true;
     peer_check_thread  = new boost::thread(&PeerCheckThread, this);
     ROS_DEBUG("\n\tThread was not active, so has been created!\n");
@@ -384,6 +476,7 @@ void Node::Activate() {
           // this will publish the updated state to say I am now active
           PublishStateToPeers();
         }
+        StartWorkThreads();
         cv.notify_all();
         // TODO JB: kill the thread now
         // peer_check_thread->interrupt();
@@ -407,6 +500,7 @@ void Node::Activate() {
           PublishStateToPeers();
 
         }
+        StartWorkThreads();
         cv.notify_all();
         // TODO JB: kill the thread now
         // peer_check_thread->interrupt();
@@ -443,10 +537,19 @@ void Node::Deactivate() {
 
   DeactivatePeer();
 
+  // Stop the running work cooperatively; the old thread exits once it sees
+  // that it has been replaced
+  work_generation_++;
+  CancelWork();
+
   ROS_WARN("Work thread is being unlocked");
   work_mut.unlock();
   delete work_thread;
-  work_thread = new boost::thread(&WorkThread, this);
+  work_thread = NULL;
+  // with a shared executor the work thread is only created on activation,
+  // with a work executor there is no work thread at all
+  if (!executor_ && !work_executor_)
+    work_thread = new boost::thread(&WorkThread, this);
   ROS_WARN("Work thread was terminated and then restarted");
 
 }
@@ -481,9 +584,8 @@ void Node::DeactivatePeer() {
   msg->peerUndone = true;
 
   // publish to all peers
-  for (PubList::iterator it = peer_pub_list_.begin();
-      it != peer_pub_list_.end(); ++it) {
-    it->publish(msg);
+  for (NodeListPtrIterator it = peers_.begin(); it != peers_.end(); ++it) {
+    Transmit(*it, LocalTransport::PEER_CHANNEL, (*it)->pub, msg);
   }
 }
 
@@ -500,7 +602,7 @@ void Node::DialogueCallback(const dialogue::Resolution::ConstPtr &msg) {
   FAILED_PICK = true;
   ros::param::set("/Collision", true);
   bool coll_test;
-  ros::Duration(1).sleep();
+  mutex::SimClock::Sleep(ros::Duration(1));
   ros::param::get("/Collision", coll_test);
   std::cout << "Collision is set to: " << coll_test << "\n\n\n\n\n\n\n";
 
@@ -517,7 +619,7 @@ void Node::DialogueCallback(const dialogue::Resolution::ConstPtr &msg) {
     state_.peerPlacing = true;
     // ros::param::set("/Collision", true);
     PublishStateToPeers();
-    ros::Duration(1).sleep();
+    mutex::SimClock::Sleep(ros::Duration(1));
     state_.peerPlacing = false;
     state_.peer_active = true;
     ros::param::set("/Collision", false);
@@ -536,7 +638,7 @@ void Node::DialogueCallback(const dialogue::Resolution::ConstPtr &msg) {
     if (ros::service::call("pick_and_place_object", msg)) {
     }
     ROS_WARN("Serivce call made from dialogue, sleeping for 30 seconds");
-    ros::Duration(35).sleep();
+    mutex::SimClock::Sleep(ros::Duration(35));
     state_.active = false;
     state_.done = true;
     state_.activation_level = 0.0f;
@@ -549,7 +651,7 @@ void Node::DialogueCallback(const dialogue::Resolution::ConstPtr &msg) {
     if (ros::service::call("pick_and_place_object", msg)) {
     }
     ROS_WARN("Serivce call made from dialogue, sleeping for 30 seconds");
-    ros::Duration(90).sleep();
+    mutex::SimClock::Sleep(ros::Duration(90));
     state_.active = false;
     state_.done = true;
     state_.activation_level = 0.0f;
@@ -570,6 +672,21 @@ void Node::DialogueCallback(const dialogue::Resolution::ConstPtr &msg) {
   //state_.activation_potential = 0.1f;
 }
 
+bool Node::DialogueRunning() {
+  if (!dialogue_thread_ && hold_status_.dropped) {
+    ROS_ERROR("Hold_status dropped is true, launching dialogue node!!!");
+    // It waits for a person, so not on a pool thread
+    dialogue_thread_ = new boost::thread(&Node::Dialogue, this);
+  }
+  if (!dialogue_thread_)
+    return false;
+  if (!dialogue_thread_->timed_join(boost::posix_time::time_duration()))
+    return true;
+  delete dialogue_thread_;
+  dialogue_thread_ = NULL;
+  return false;
+}
+
 void Node::Dialogue() {
   // pause moveit
   // if(APPLEHACK == 1) {
@@ -579,7 +696,7 @@ void Node::Dialogue() {
   ROS_WARN("NODE::DOIALOGUE got calledddd here");
   ros::param::set("/Collision", true);
   bool coll_test;
-  ros::Duration(1).sleep();
+  mutex::SimClock::Sleep(ros::Duration(1));
   ros::param::get("/Collision", coll_test);
   std::cout << "Dialogue: Collision is set to: " << coll_test << "\n\n\n\n\n\n\n";
 
@@ -599,6 +716,7 @@ void Node::Dialogue() {
   while(!RESP_RECEIVED) {
     ros::spinOnce();
     // ROS_INFO("IN dialogue while loop!\n");
+    mutex::SimClock::Sleep(boost::posix_time::millisec(DIALOGUE_POLL_MS));
   }
   RESP_RECEIVED = false;
   hold_status_.dropped = false;
@@ -627,44 +745,71 @@ void Node::SendToParent(const robotics_task_tree_msgs::ControlMessage msg) {
   ROS_INFO("[%s]: Node::SendToParent was called", name_->topic.c_str() );
   ControlMessagePtr msg_temp(new robotics_task_tree_msgs::ControlMessage);
   *msg_temp = msg;
-  parent_pub_.publish(msg_temp);
+  Transmit(parent_, LocalTransport::CHILD_CHANNEL, &parent_pub_, msg_temp);
 }
 void Node::SendToParent(const ControlMessagePtr_t msg) {
   ROS_INFO("[%s]: Node::SendToParent was called", name_->topic.c_str() );
-  parent_pub_.publish(msg);
+  Transmit(parent_, LocalTransport::CHILD_CHANNEL, &parent_pub_, msg);
 }
 void Node::SendToChild(NodeBitmask node,
   const robotics_task_tree_msgs::ControlMessage msg) {
   //ROS_INFO("[%s]: Node::SendToChild was called", name_->topic.c_str() );
-  // get publisher for specific node
-  ros::Publisher* pub = node_dict_[node]->pub;
   // publish message to the specific child
   ControlMessagePtr msg_temp(new robotics_task_tree_msgs::ControlMessage);
   *msg_temp = msg;
-  pub->publish(msg_temp);
+  SendToChild(node, msg_temp);
 }
 void Node::SendToChild(NodeBitmask node, const ControlMessagePtr_t msg) {
     // ROS_INFO("Node::SendToChild was called!!!!\n");
   //ROS_INFO("[%s]: Node::SendToChild was called", name_->topic.c_str() );
-
-  node_dict_[node]->pub->publish(msg);
+  NodeId_t *child = LookupNode(node);
+  Transmit(child, LocalTransport::PARENT_CHANNEL, child->pub, msg);
 }
 void Node::SendToPeer(NodeBitmask node,
   const robotics_task_tree_msgs::ControlMessage msg) {
-  ROS_INFO("[%s]: Node::SendToPeer was called", name_->topic.c_str() );
-
     // ROS_INFO("Node::SendToPeer was called!!!!\n");
-  // get publisher for specific node
-  ros::Publisher* pub = node_dict_[node]->pub;
-  // publish message to the specific child
+  // publish message to the specific peer
   ControlMessagePtr msg_temp(new robotics_task_tree_msgs::ControlMessage);
   *msg_temp = msg;
-  pub->publish(msg_temp);
-
+  SendToPeer(node, msg_temp);
 }
 void Node::SendToPeer(NodeBitmask node, const ControlMessagePtr_t msg) {
   ROS_INFO("[%s]: Node::SendToPeer was called", name_->topic.c_str() );
-  node_dict_[node]->pub->publish(msg);
+  NodeId_t *peer = LookupNode(node);
+  Transmit(peer, LocalTransport::PEER_CHANNEL, peer->pub, msg);
+}
+
+// All control messages go through here. Nodes living in this process get the
+// message pointer through the local mailbox; everyone else gets it over ROS,
+// either on its own topic or packed into the process wide batch.
+void Node::Transmit(NodeId_t *node, LocalTransport::Channel channel,
+    ros::Publisher *pub, const ControlMessagePtr_t msg) {
+  messages_sent.fetch_add(1, std::memory_order_relaxed);
+  if ((intra_process_ || batch_) && node_table_) {
+    if (LocalTransport::Instance()->Deliver(node_table_->Handle(node->mask),
+        channel, msg))
+      return;
+    if (batch_) {
+      batch_->Queue(node->mask, channel, msg);
+      return;
+    }
+  }
+  messages_published.fetch_add(1, std::memory_order_relaxed);
+  pub->publish(msg);
+}
+
+uint64_t Node::MessagesSent() {
+  return messages_sent.load(std::memory_order_relaxed);
+}
+
+uint64_t Node::PublishesSuppressed() {
+  return publishes_suppressed.load(std::memory_order_relaxed);
+}
+
+uint64_t Node::MessagesPublished() {
+  BatchTransport *batch = BatchTransport::Instance();
+  return messages_published.load(std::memory_order_relaxed)
+    + (batch ? batch->BatchesSent() : 0);
 }
 
 void Node::ReceiveFromParent(ConstControlMessagePtr_t msg) {
@@ -672,6 +817,8 @@ void Node::ReceiveFromParent(ConstControlMessagePtr_t msg) {
   // Set activation level from parent
   // TODO(Luke Fraser) Use mutex to avoid race condition setup in publisher
   boost::unique_lock<boost::mutex> lck(mut);
+  bool was_active = IsActive();
+  bool was_parent_done = parent_done_;
   if( msg->type == 0 )
     state_.activation_level = msg->activation_level;
   if( msg->done != 0 )
@@ -681,20 +828,214 @@ void Node::ReceiveFromParent(ConstControlMessagePtr_t msg) {
     state_.active = false;
   }
   //state_.done = msg->done;
+  // the level itself is refreshed every parent tick; only crossing the
+  // activation threshold changes what Update() would decide
+  if (was_active != IsActive() || was_parent_done != parent_done_)
+    MarkDirty();
 }
 
 void Node::ReceiveFromChildren(ConstControlMessagePtr_t msg) {
   ROS_DEBUG("Node::ReceiveFromChildren was called!!!!");
   // Determine the child
-  NodeId_t *child = node_dict_[msg->sender];
-  boost::unique_lock<boost::mutex> lck(mut);
-  child->state.activation_level = msg->activation_level;
-  child->state.activation_potential = msg->activation_potential;
-  child->state.done = msg->done;
-  child->state.highest.node = msg->highest.node;
-  child->state.highest.type = msg->highest.type;
-  child->state.highest.robot = msg->highest.robot;
-  child->state.active = msg->active;
+  if (!node_table_)
+    return;
+  NodeHandle_t handle = node_table_->Handle(msg->sender);
+  if (handle == NodeTable::INVALID_HANDLE || child_index_[handle] < 0)
+    return;
+  SeqLock<ChildSample> *slot = &child_slots_[child_index_[handle]];
+
+  // No mut here: the report goes into the child's slot and the update path
+  // picks it up at its next tick
+  ChildSample sample;
+  sample.activation_level = msg->activation_level;
+  sample.activation_potential = msg->activation_potential;
+  sample.highest = BitmaskKey(msg->highest);
+  sample.done = msg->done;
+  sample.active = msg->active;
+  ChildSample last = slot->Read();
+  slot->Write(sample);
+  int index = child_index_[handle];
+  child_reported_[index / 64].fetch_or(uint64_t(1) << (index % 64),
+    std::memory_order_release);
+  // activation_level is not used by the parent's decisions, so it does not
+  // make the node dirty
+  if (last.activation_potential != sample.activation_potential
+      || last.done != sample.done
+      || last.active != sample.active
+      || last.highest != sample.highest)
+    MarkDirty();
+}
+
+void Node::InitializeChildSlots() {
+  child_slots_ = new SeqLock<ChildSample>[children_.size()];
+  child_index_.assign(node_table_ ? node_table_->Size() : 0, -1);
+  for (size_t i = 0; i < children_.size(); ++i) {
+    NodeId_t *child = children_[i];
+    if (node_table_) {
+      NodeHandle_t handle = node_table_->Handle(child->mask);
+      if (handle != NodeTable::INVALID_HANDLE)
+        child_index_[handle] = i;
+    }
+    ChildSample sample;
+    sample.activation_level = child->state.activation_level;
+    sample.activation_potential = child->state.activation_potential;
+    sample.highest = BitmaskKey(child->state.highest);
+    sample.done = child->state.done;
+    sample.active = child->state.active;
+    child_slots_[i].Write(sample);
+  }
+  child_report_words_ = (children_.size() + 63) / 64;
+  child_reported_ = new std::atomic<uint64_t>[child_report_words_];
+  for (size_t i = 0; i < child_report_words_; ++i)
+    child_reported_[i].store(0);
+  children_done_ = 0;
+  children_finished_ = 0;
+  children_active_ = 0;
+  children_claimed_ = 0;
+  open_children_.clear();
+  open_potentials_.clear();
+  for (size_t i = 0; i < children_.size(); ++i)
+    CountChild(i, true);
+}
+
+// Copy the latest child reports into children_[i]->state. Everything the
+// tick evaluates (Precondition, IsDone, UpdateActivationPotential) then sees
+// one consistent view for the whole tick. Only children that reported since
+// the last tick are read, and the child counts follow their changes.
+void Node::RefreshChildStates() {
+  for (size_t word = 0; word < child_report_words_; ++word) {
+    // Clear the bits before reading the slots so a report arriving during
+    // the copy is picked up next tick
+    uint64_t bits = child_reported_[word].exchange(0,
+      std::memory_order_acquire);
+    while (bits) {
+      int bit = __builtin_ctzll(bits);
+      bits &= bits - 1;
+      size_t i = word * 64 + bit;
+      ChildSample sample = child_slots_[i].Read();
+      State &state = children_[i]->state;
+      CountChild(i, false);
+      state.activation_level = sample.activation_level;
+      state.activation_potential = sample.activation_potential;
+      state.highest = KeyBitmask(sample.highest);
+      state.done = sample.done;
+      state.active = sample.active;
+      CountChild(i, true);
+    }
+  }
+}
+
+// Add or remove the child's current state from the counts and open sets
+void Node::CountChild(size_t index, bool add) {
+  const State &state = children_[index]->state;
+  size_t delta = add ? 1 : static_cast<size_t>(-1);
+  if (state.done)
+    children_done_ += delta;
+  if (state.done || state.peer_done)
+    children_finished_ += delta;
+  if (state.active)
+    children_active_ += delta;
+  if (state.peer_active || state.peer_done)
+    children_claimed_ += delta;
+  if (state.done || state.peer_done || state.peer_active)
+    return;
+  std::pair<float, int> key(state.activation_potential,
+    -static_cast<int>(index));
+  if (add) {
+    open_children_.insert(index);
+    if (!state.active)
+      open_potentials_.insert(key);
+  } else {
+    open_children_.erase(index);
+    if (!state.active)
+      open_potentials_.erase(key);
+  }
+}
+
+bool Node::AllChildrenDone() const {
+  return children_done_ == children_.size();
+}
+
+bool Node::AllChildrenFinished() const {
+  return children_finished_ == children_.size();
+}
+
+bool Node::AnyChildFinished() const {
+  return children_finished_ > 0;
+}
+
+bool Node::AnyChildActive() const {
+  return children_active_ > 0;
+}
+
+bool Node::Claimed() const {
+  return state_.peer_active || state_.peer_done;
+}
+
+bool Node::AnyChildClaimed() const {
+  return children_claimed_ > 0;
+}
+
+bool Node::AllChildrenClaimed() const {
+  return children_claimed_ == children_.size();
+}
+
+NodeId_t* Node::FirstOpenChild() const {
+  if (open_children_.empty())
+    return NULL;
+  return children_[*open_children_.begin()];
+}
+
+NodeId_t* Node::HighestOpenChild() const {
+  if (open_potentials_.empty())
+    return NULL;
+  return children_[-open_potentials_.rbegin()->second];
+}
+
+void Node::SetChildPeerActive(size_t index, bool peer_active) {
+  if (children_[index]->state.peer_active == peer_active)
+    return;
+  CountChild(index, false);
+  children_[index]->state.peer_active = peer_active;
+  CountChild(index, true);
+}
+
+void Node::PublishSnapshot() {
+  SelfSample sample;
+  sample.activation_level = state_.activation_level;
+  sample.activation_potential = state_.activation_potential;
+  sample.suitability = state_.suitability;
+  sample.active = state_.active;
+  sample.done = state_.done;
+  sample.working = working;
+  self_snapshot_.Write(sample);
+}
+
+// A publisher is connected once its subscriber shows up. Targets reached
+// without a ROS connection of their own (same process, or via the batch
+// topic) and the ROOT node, which no process runs, are not waited for.
+bool Node::ConnectionsReady(std::vector<std::string> *waiting) {
+  NodeListPtr targets;
+  targets.insert(targets.end(), children_.begin(), children_.end());
+  targets.insert(targets.end(), peers_.begin(), peers_.end());
+  targets.push_back(parent_);
+  bool ready = true;
+  for (NodeListPtrIterator it = targets.begin(); it != targets.end(); ++it) {
+    NodeId_t *target = *it;
+    if (!target || !target->pub || target->mask.type == ROOT)
+      continue;
+    if ((intra_process_ || batch_) && node_table_
+        && LocalTransport::Instance()->IsLocal(
+          node_table_->Handle(target->mask)))
+      continue;
+    bool connected = batch_ ? batch_->Connected()
+      : target->pub->getNumSubscribers() > 0;
+    if (!connected) {
+      ready = false;
+      waiting->push_back(target->topic);
+    }
+  }
+  return ready;
 }
 
 void Node::ReceiveFromPeers(ConstControlMessagePtr_t msg) {
@@ -703,6 +1044,8 @@ void Node::ReceiveFromPeers(ConstControlMessagePtr_t msg) {
   // state_.activation_level = msg->activation_level;
   // state_.done = msg->done;
   boost::unique_lock<boost::mutex> lck(mut);
+  State before = state_;
+  bool was_dropped = hold_status_.dropped;
   // TODO: Modify this to keep track of peer states from a list of peers if the node's parent is an OR node
   //       This will require doing some sort of "or" on the state so that if it was ever 1 it will stay one
   //       across multiple msgs being recived to know that one of the peers was active.....
@@ -747,16 +1090,103 @@ void Node::ReceiveFromPeers(ConstControlMessagePtr_t msg) {
   }
   state_.done = state_.done || state_.peer_done;
   // ROS_INFO("OTHER, set msg based on peer lists!!! %d\n\n", state_.peer_active);
+  // peers publish every tick, so only wake up on an actual change or two
+  // peers would keep re-evaluating each other
+  if (before.peer_active != state_.peer_active
+      || before.peer_done != state_.peer_done
+      || before.done != state_.done
+      || before.active != state_.active
+      || before.selfPlacing != state_.selfPlacing
+      || was_dropped != hold_status_.dropped)
+    MarkDirty();
 }
 
 // Main Loop of Update Thread. spins once every mtime milliseconds
 void UpdateThread(Node *node, boost::posix_time::millisec mtime) {
     ROS_DEBUG("Node::UpdateThread was called!!!!");
-    sleep(5);
+  mutex::SimClock::Client client;
+  if (node->barrier_)
+    node->barrier_->WaitReady();
+  else
+    mutex::SimClock::Sleep(boost::posix_time::millisec(STARTUP_DELAY_MS));
+  node->update_started_ = true;
   while (true) {
     node->Update();
-    boost::this_thread::sleep(mtime);
+    if (node->event_driven_)
+      node->WaitForUpdate();
+    else
+      mutex::SimClock::Sleep(mtime);
+  }
+}
+
+// Block the update thread until the node is marked dirty or the heartbeat
+// period expires. Several MarkDirty calls while waiting coalesce into one.
+void Node::WaitForUpdate() {
+  boost::unique_lock<boost::mutex> lock(update_mut_);
+  boost::posix_time::ptime deadline =
+    mutex::SimClock::Now() + heartbeat_period_;
+  while (!update_dirty_) {
+    if (!mutex::SimClock::TimedWait(update_cv_, lock, deadline))
+      break;
   }
+  update_dirty_ = false;
+}
+
+void Node::MarkDirty() {
+  if (!event_driven_)
+    return;
+  boost::unique_lock<boost::mutex> lock(update_mut_);
+  update_dirty_ = true;
+  if (!executor_) {
+    update_cv_.notify_one();
+    return;
+  }
+  if (update_started_ && !update_scheduled_) {
+    update_scheduled_ = true;
+    executor_->Post(boost::bind(&EventUpdateTask, this));
+  }
+}
+
+// Executor version of the event driven update. update_scheduled_ keeps at
+// most one update of this node queued or running at any time; changes that
+// arrive while it runs schedule exactly one more pass.
+void EventUpdateTask(Node *node) {
+  {
+    boost::unique_lock<boost::mutex> lock(node->update_mut_);
+    node->update_dirty_ = false;
+  }
+  node->Update();
+  boost::unique_lock<boost::mutex> lock(node->update_mut_);
+  node->update_scheduled_ = false;
+  if (node->update_dirty_) {
+    node->update_scheduled_ = true;
+    node->executor_->Post(boost::bind(&EventUpdateTask, node));
+  }
+}
+
+// Low rate tick so activation falloff and externally driven potentials
+// (simulator state, vision) are still evaluated on idle nodes
+void HeartbeatTask(Node *node) {
+  node->update_started_ = true;
+  node->MarkDirty();
+  node->executor_->PostAfter(node->heartbeat_period_,
+    boost::bind(&HeartbeatTask, node));
+}
+
+// First update on the executor once the readiness barrier releases
+void StartUpdateTask(Node *node) {
+  if (node->event_driven_)
+    node->executor_->Post(boost::bind(&HeartbeatTask, node));
+  else
+    node->executor_->Post(boost::bind(&UpdateTask, node));
+}
+
+// Executor version of the update thread. Each tick reschedules itself, so a
+// node never has more than one update in flight.
+void UpdateTask(Node *node) {
+  node->Update();
+  node->executor_->PostAfter(node->update_period_,
+    boost::bind(&UpdateTask, node));
 }
 
 // TODO: need to be able to reset node if work fails
@@ -767,24 +1197,77 @@ void UpdateThread(Node *node, boost::posix_time::millisec mtime) {
 void WorkThread(Node *node) {
       ROS_DEBUG("[%s]: Node::WorkThread was called!!!!", node->name_->topic.c_str() );
 
+  uint32_t generation = node->work_generation_;
+  while (true) {
+    boost::unique_lock<boost::mutex> lock(node->work_mut);
+    while (!node->state_.active) {
+      node->cv.wait(lock);
+    }
+    if (generation != node->work_generation_)
+      return;
+    ROS_DEBUG("work thread Initialized");
+    if (node->RunWork(generation) == WorkHandle::WORK_SUCCEEDED)
+      break;
+    // Cancelled: wait for the next activation unless Deactivate() replaced us
+    if (generation != node->work_generation_)
+      return;
+  }
+ROS_INFO("[%s]: Work Thread has ended", node->name_->topic.c_str() );
+}
 
-  boost::unique_lock<boost::mutex> lock(node->work_mut);
-  while (!node->state_.active) {
-    node->cv.wait(lock);
+// One activation's worth of work on the shared WorkExecutor
+void WorkTask(Node *node, uint32_t generation) {
+  {
+    boost::unique_lock<boost::mutex> lock(node->work_mut);
+    if (generation == node->work_generation_ && node->state_.active)
+      node->RunWork(generation);
   }
-  ROS_DEBUG("work thread Initialized");
+  bool resubmit;
+  {
+    boost::lock_guard<boost::mutex> lock(node->work_handle_mut_);
+    node->work_pending_ = false;
+    // Re-activated while the cancelled work was being undone
+    resubmit = node->state_.active && !node->state_.done;
+  }
+  if (resubmit)
+    node->SubmitWork();
+}
+
+// Runs Work() once with work_mut held by the caller. A cancelled work is
+// undone and the node deactivated; a finished one marks the node done and
+// tells the parent and peers.
+WorkHandle::Result Node::RunWork(uint32_t generation) {
+  WorkHandlePtr handle = BeginWork();
   // Process Data
-  node->working = true;
-  node->Work();
+  working = true;
+  Work();
+
+  if (handle->IsCancelled()) {
+    // Deactivate() already reset the node
+    if (generation != work_generation_) {
+      handle->Complete(WorkHandle::WORK_CANCELLED);
+      return WorkHandle::WORK_CANCELLED;
+    }
+    ROS_DEBUG("Work was cancelled, undoing");
+    {
+      boost::unique_lock<boost::mutex> lck(mut);
+      UndoWork();
+      working = false;
+      state_.active = false;
+    }
+    handle->Complete(WorkHandle::WORK_CANCELLED);
+    MarkDirty();
+    return WorkHandle::WORK_CANCELLED;
+  }
 
   if ( !FAILED_PICK ) // if did not fail pick i.e. if failed_pick == false
   {
     ROS_WARN("Work thread is ending becuase pick worked\n\n\n");
-    ROS_WARN("     Object was %s", node->object_.c_str());
-    boost::unique_lock<boost::mutex> lck(node->mut);
-    node->state_.active = false;
-    node->state_.done = true;
-    node->working = false;
+    ROS_WARN("     Object was %s", object_.c_str());
+    boost::unique_lock<boost::mutex> lck(mut);
+    state_.active = false;
+    state_.done = true;
+    working = false;
   }
   else{
     // Hakcity hack hack
@@ -794,20 +1277,20 @@ void WorkThread(Node *node) {
     //  so for now we are hard coding the state active and done messages here to reflect this.
     //   THIS NEEDS TO GET FIXED by INSERT_NAME!!!!!!!
     FAILED_PICK = false;
-    node->state_.active = false;
-    node->state_.done = true;
-    node->working = false;
+    state_.active = false;
+    state_.done = true;
+    working = false;
     ROS_WARN("Work thread is ending becuase issue was found");
+  }
+  handle->Complete(WorkHandle::WORK_SUCCEEDED);
+  PublishDoneParent();
+  PublishStateToPeers();
+  MarkDirty();
 
-
- }
-node->PublishDoneParent();
-node->PublishStateToPeers();
-
-// int sleepTime = 200 + (75*node->mask_.robot);
-// boost::this_thread::sleep(boost::posix_time::millisec(sleepTime));
-// ROS_INFO("Sleeping for %d", sleepTime);
-ROS_INFO("[%s]: Work Thread has ended", node->name_->topic.c_str() );
+  // int sleepTime = 200 + (75*mask_.robot);
+  // boost::this_thread::sleep(boost::posix_time::millisec(sleepTime));
+  // ROS_INFO("Sleeping for %d", sleepTime);
+  return WorkHandle::WORK_SUCCEEDED;
 }
 
 // TODO JB: implementation for peer thread!
@@ -901,6 +1384,7 @@ try{
   ROS_DEBUG_NAMED("PeerCheck", "\nPeercheckthread is at end!!!!\n");
   node->state_.check_peer = false;
   node->thread_running_ = false;
+  node->MarkDirty();
 }
 catch(...) {
   ROS_WARN("Peer Check THREAD INTERRUPTED\n\n\n\n");
@@ -909,86 +1393,293 @@ catch(...) {
   node->thread_running_ = false;
 }
 
-void CheckThread(Node *node) {
-      // ROS_INFO("Node::CheckThread was called!!!!\n");
-
-  boost::mutex mut;
-  boost::unique_lock<boost::mutex> lock(mut);
-  while (!node->state_.active) {
-    ROS_DEBUG("Check Thread waiting");
-    // ROS_INFO("Check Thread waiting");
-    node->cv.wait(lock);
-  }
-  ROS_DEBUG("Check Work Thread Initialized");
-  // ROS_INFO("Check Work Thread Initialized");
-  while (node->state_.active) {
-    if (!node->CheckWork()) {
-      ROS_DEBUG("Deleting Thread! and Restarting");
-      // ROS_INFO("Deleting Thread! and Restarting");
-      {
-        boost::unique_lock<boost::mutex> lock(node->mut);
-        node->work_thread->interrupt();
-        delete node->work_thread;
-        node->UndoWork();
-        node->working = false;
-        node->state_.active = false;
-        node->work_thread = new boost::thread(&WorkThread, node);
-        node->check_thread = new boost::thread(&CheckThread, node);
-        break;
-      }
-    }
-    boost::this_thread::sleep(boost::posix_time::millisec(10));
-  }
-}
 
 void Node::RecordToFile() {
       // ROS_INFO("Node::RecordToFile was called!!!!\n");
 
+  if (!print_recorder_)
+    return;
   boost::posix_time::ptime time_t_epoch(boost::gregorian::date(1970,1,1));
-  boost::posix_time::time_duration diff = boost::posix_time::microsec_clock::universal_time() - time_t_epoch;
+  boost::posix_time::time_duration diff = mutex::SimClock::Now() - time_t_epoch;
   double seconds = (double)diff.total_seconds() + (double)diff.fractional_seconds() / 1000000.0;
-  record_file  << std::fixed
-        << seconds
-        << ", "
-        << state_.active
-        << ", "
-        << state_.done
-        << ", "
-        << state_.activation_level
-        << ", "
-        << state_.activation_potential
-        << ","
-        << working
-        << ","
-        << state_.suitability
-        << "\n";
-        record_file.flush();
+  // Read the state published by the last tick instead of racing Update()
+  SelfSample state = self_snapshot_.Read();
+  // Copied as is, the text is made on the recorder's worker
+  print_recorder_->Record(name_->topic, seconds,
+    static_cast<bool>(state.active), static_cast<bool>(state.done),
+    state.activation_level, state.activation_potential,
+    static_cast<bool>(state.working), state.suitability);
 }
+
+// Typed recorder shared by every node of the process, so the text is made
+// on one worker thread. The first node creates it: feeding the
+// timeseries_recording_server, writing capped segments with policy or one
+// CSV file into directory. Left running for the life of the process, the
+// server reclaims its ring once the process is gone. NULL when directory
+// cannot be used.
+static recording_toolkit::PrintRecorder *ProcessRecorder(bool server,
+    const std::string &directory,
+    const recording_toolkit::SegmentPolicy *policy) {
+  static boost::mutex recorder_mut;
+  static recording_toolkit::PrintRecorder *recorder = NULL;
+  static bool created = false;
+  boost::lock_guard<boost::mutex> lock(recorder_mut);
+  if (created)
+    return recorder;
+  created = true;
+  std::string process = NodeRecorder::ProcessName();
+  if (server) {
+    recorder = new recording_toolkit::SharedMemoryRecorder(
+      ros::this_node::getName());
+  } else if (policy) {
+    if (!recording_toolkit::SegmentWriter::Usable(directory)) {
+      ROS_ERROR("~record_dir \"%s\" is not a writable directory, not "
+        "recording", directory.c_str());
+      return NULL;
+    }
+    recorder = new recording_toolkit::FilePrintRecorder(directory,
+      process + "_Data", *policy);
+  } else {
+    std::string filename = directory + "/" + process + "_Data_.csv";
+    ROS_INFO("Creating Data File: %s", filename.c_str());
+    recorder = new recording_toolkit::FilePrintRecorder(filename.c_str());
+  }
+  // The columns of <topic>_Data_.csv behind the topic
+  recording_toolkit::RecordSchema schema;
+  schema.Field<std::string>("topic")
+    .Field<double>("time", RECORD_PRECISION)
+    .Field<bool>("active")
+    .Field<bool>("done")
+    .Field<float>("activation_level", RECORD_PRECISION)
+    .Field<float>("activation_potential", RECORD_PRECISION)
+    .Field<bool>("working")
+    .Field<float>("suitability", RECORD_PRECISION);
+  recorder->SetSchema(schema);
+  recorder->StartRecord();
+  return recorder;
+}
+
 void RecordThread(Node *node) {
       // ROS_INFO("Node::RecordThreadc was called!!!!\n");
 
   // Open Record File
+  mutex::SimClock::Client client;
+  RecordControlPtr control = node->record_control_;
   while (true) {
-    node->RecordToFile();
-    boost::this_thread::sleep(boost::posix_time::millisec(100));
+    {
+      boost::lock_guard<boost::mutex> lock(control->mut);
+      if (control->stopped)
+        return;
+      node->RecordToFile();
+    }
+    mutex::SimClock::Sleep(node->record_period_);
   }
 }
+
+void RecordTask(Node *node, RecordControlPtr control) {
+  boost::lock_guard<boost::mutex> lock(control->mut);
+  if (control->stopped)
+    return;
+  node->RecordToFile();
+  node->executor_->PostAfter(node->record_period_,
+    boost::bind(&RecordTask, node, control));
+}
+
 // Initialize node threads and variables
 void Node::NodeInit(boost::posix_time::millisec mtime) {
   // ROS_INFO("Node::NodeInit was called!!!!\n");
+  update_period_ = mtime;
+  update_thread = NULL;
+  work_thread = NULL;
+  peer_check_thread = NULL;
+  record_thread = NULL;
+  dialogue_thread_ = NULL;
+  working = false;
+  work_pending_ = false;
+
+  // Opt-in bounded work executor: Work() runs on a per process (per robot)
+  // pool instead of a thread per node
+  int max_concurrent_work;
+  double work_report_s;
+  local_.param<int>("max_concurrent_work", max_concurrent_work, 0);
+  local_.param<double>("work_report_period_s", work_report_s,
+    WORK_REPORT_PERIOD_S);
+  work_executor_ = NULL;
+  if (max_concurrent_work > 0)
+    work_executor_ = WorkExecutor::Configure(max_concurrent_work,
+      boost::posix_time::microseconds(static_cast<int64_t>(
+      std::max(work_report_s, 0.0) * 1e6)));
+
+  // Opt-in event driven update: re-evaluate on change instead of polling
+  int heartbeat_ms;
+  local_.param<bool>("event_driven_update", event_driven_, false);
+  local_.param<int>("update_heartbeat_ms", heartbeat_ms, UPDATE_HEARTBEAT_MS);
+  heartbeat_period_ = boost::posix_time::millisec(heartbeat_ms);
+  update_started_ = false;
+  update_dirty_ = false;
+  update_scheduled_ = false;
+
+  // Opt-in change only publishing: skip PublishStatus when the state did not
+  // move, but still publish every heartbeat so receivers see the node alive
+  int publish_heartbeat_ms;
+  local_.param<bool>("change_only_publish", change_only_publish_, false);
+  local_.param<float>("publish_epsilon", publish_epsilon_, PUBLISH_EPSILON);
+  local_.param<int>("publish_heartbeat_ms", publish_heartbeat_ms,
+    PUBLISH_HEARTBEAT_MS);
+  publish_heartbeat_ = boost::posix_time::millisec(publish_heartbeat_ms);
+  published_once_ = false;
+  publishes_sent_ = 0;
+  publishes_suppressed_ = 0;
+
+  // Recording: with only ~record_dir set every node of the process is
+  // sampled into one binary log there. Otherwise the nodes share one typed
+  // recorder: one shared memory ring with ~recording_server set, capped CSV
+  // segments in ~record_dir with ~record_segment_mb set, else one CSV file
+  // of the process in the data directory.
+  std::string record_dir;
+  double record_rate_hz;
+  bool recording_server;
+  double segment_mb, segment_age_s, retain_mb;
+  local_.param<std::string>("record_dir", record_dir, "");
+  local_.param<bool>("recording_server", recording_server, false);
+  local_.param<double>("record_segment_mb", segment_mb, 0.0);
+  local_.param<double>("record_segment_age_s", segment_age_s, 0.0);
+  local_.param<double>("record_retain_mb", retain_mb, 0.0);
+  local_.param<double>("record_rate_hz", record_rate_hz,
+    1000.0 / RECORD_PERIOD_MS);
+  if (record_rate_hz <= 0.0)
+    record_rate_hz = 1000.0 / RECORD_PERIOD_MS;
+  record_period_ = boost::posix_time::microseconds(
+    static_cast<int64_t>(1e6 / record_rate_hz));
+  recorder_ = NULL;
+  print_recorder_ = NULL;
+  record_control_.reset(new RecordControl);
+  if (!record_dir.empty() && segment_mb <= 0.0 && node_table_)
+    recorder_ = NodeRecorder::Configure(record_dir, record_rate_hz,
+      node_table_);
+  if (recorder_) {
+    recorder_->Register(node_table_->Handle(mask_), &self_snapshot_);
+  } else if (recording_server) {
+    print_recorder_ = ProcessRecorder(true, "", NULL);
+  } else if (segment_mb > 0.0) {
+    // Size and age capped segments instead of one file per run
+    recording_toolkit::SegmentPolicy policy;
+    policy.max_bytes = segment_mb * (1 << 20);
+    policy.max_age_ns = segment_age_s * 1e9;
+    policy.retain_bytes = retain_mb * (1 << 20);
+    print_recorder_ = ProcessRecorder(false, record_dir, &policy);
+  } else {
+    print_recorder_ = ProcessRecorder(false, RECORD_DATA_DIR, NULL);
+  }
+
+  // Opt-in readiness handshake: start updating once every robot's
+  // publishers are connected instead of after a fixed delay
+  bool readiness_barrier;
+  int ready_timeout_ms;
+  local_.param<bool>("readiness_barrier", readiness_barrier, false);
+  local_.param<int>("ready_timeout_ms", ready_timeout_ms, READY_TIMEOUT_MS);
+  barrier_ = NULL;
+  if (readiness_barrier && node_table_) {
+    std::vector<int> ready_robots;
+    local_.getParam("ready_robots", ready_robots);
+    barrier_ = ReadinessBarrier::Configure(node_table_, ready_robots,
+      boost::posix_time::millisec(ready_timeout_ms));
+    barrier_->Register(name_->topic, mask_.robot,
+      boost::bind(&Node::ConnectionsReady, this, _1));
+  }
+
+  if (executor_) {
+    // The work thread is created on activation (StartWorkThreads)
+    if (barrier_) {
+      barrier_->OnReady(boost::bind(&StartUpdateTask, this));
+    } else if (event_driven_) {
+      executor_->PostAfter(boost::posix_time::millisec(STARTUP_DELAY_MS),
+        boost::bind(&HeartbeatTask, this));
+    } else {
+      executor_->PostAfter(boost::posix_time::millisec(STARTUP_DELAY_MS),
+        boost::bind(&UpdateTask, this));
+    }
+    if (!recorder_)
+      executor_->PostAfter(record_period_,
+        boost::bind(&RecordTask, this, record_control_));
+    return;
+  }
 
   // Initialize node threads
   update_thread = new boost::thread(&UpdateThread, this, mtime);
-  work_thread   = new boost::thread(&WorkThread, this);
-  check_thread  = new boost::thread(&CheckThread, this);
+  if (!work_executor_)
+    work_thread = new boost::thread(&WorkThread, this);
   // peer_check_thread  = new boost::thread(&PeerCheckThread, this);
 
   // Initialize recording Thread
-  std::string filename = "/home/bashira/catkin_ws/src/Distributed_Collaborative_Task_Tree/Data/" + name_->topic + "_Data_.csv";
-  ROS_INFO("Creating Data File: %s", filename.c_str());
-  record_file.open(filename.c_str());
-  record_file.precision(15);
-  record_thread = new boost::thread(&RecordThread, this);
+  if (!recorder_)
+    record_thread = new boost::thread(&RecordThread, this);
+}
+
+// Only needed in executor mode: idle nodes do not own work/check threads, so
+// they are spawned the first time the node is activated.
+void Node::StartWorkThreads() {
+  if (work_executor_) {
+    SubmitWork();
+    return;
+  }
+  if (!executor_)
+    return;
+  if (!work_thread)
+    work_thread = new boost::thread(&WorkThread, this);
+}
+
+// Called by the work thread with work_mut held, right before Work(). The
+// shared supervisor polls CheckWork() while the handle is running.
+WorkHandlePtr Node::BeginWork() {
+  WorkHandlePtr handle(new WorkHandle);
+  {
+    boost::lock_guard<boost::mutex> lock(work_handle_mut_);
+    work_handle_ = handle;
+  }
+  WorkSupervisor::Instance()->Watch(handle,
+    boost::bind(&Node::CheckWork, this));
+  return handle;
+}
+
+// Queue this activation on the work executor. Only one job per node is
+// queued or running at a time.
+void Node::SubmitWork() {
+  {
+    boost::lock_guard<boost::mutex> lock(work_handle_mut_);
+    if (work_pending_)
+      return;
+    work_pending_ = true;
+  }
+  work_executor_->Submit(boost::bind(&WorkTask, this, work_generation_));
+}
+
+void Node::CancelWork() {
+  WorkHandlePtr handle = CurrentWork();
+  if (handle)
+    handle->Cancel();
+}
+
+WorkHandlePtr Node::CurrentWork() {
+  boost::lock_guard<boost::mutex> lock(work_handle_mut_);
+  return work_handle_;
+}
+
+bool Node::WorkCancelled(boost::posix_time::time_duration wait) {
+  WorkHandlePtr handle = CurrentWork();
+  if (!handle) {
+    mutex::SimClock::Sleep(wait);
+    return false;
+  }
+  if (wait.is_special() || wait.total_microseconds() <= 0)
+    return handle->IsCancelled();
+  return handle->Token()->WaitFor(wait);
+}
+
+void Node::ReportProgress(float progress) {
+  WorkHandlePtr handle = CurrentWork();
+  if (handle)
+    handle->ReportProgress(progress);
 }
 
 void Node::ActivationFalloff() {
@@ -1000,6 +1691,7 @@ void Node::ActivationFalloff() {
 // time step to process node properties. Each node should run in its own thread
 void Node::Update() {
   ROS_DEBUG("[%s]: Node::Update was called!!!!", name_->topic.c_str());
+  RefreshChildStates();
 
 
   // Check if Done // check parent done status
@@ -1016,14 +1708,16 @@ void Node::Update() {
     // Check Activation Level
     if (IsActive()) {
       // check in object has been dropped
-      if(hold_status_.dropped) {
+      if(hold_status_.dropped && !executor_) {
         // pause architecture
         ROS_ERROR("Hold_status dropped is true, launching dialogue node!!!"); // why is this not getting printed out????
         boost::thread *pause_thread = new boost::thread(&Node::Dialogue, this);
         pause_thread->join();
       }
       // Check Preconditions
-      if (Precondition()) {
+      if (executor_ && DialogueRunning()) {
+        // paused until the dialogue is resolved
+      } else if (Precondition()) {
         if(name_->topic.compare("PLACE_3_0_003_state")==0){
         ROS_ERROR("[%s]: Preconditions Satisfied Safe To Do Work!",
           name_->topic.c_str());
@@ -1049,19 +1743,19 @@ void Node::Update() {
   }
   // Publish Status
   PublishStatus();
+  PublishSnapshot();
 }
 
 void Node::Work() {
     // ROS_INFO("Node::Work was called!!!!\n");
   printf("Doing Work\n");
-  boost::this_thread::sleep(boost::posix_time::millisec(1000));
+  mutex::SimClock::Sleep(boost::posix_time::millisec(1000));
   printf("Done!\n");
 }
 
 bool Node::CheckWork() {
     // ROS_INFO("Node::CheckWork was called!!!!\n");
   // LOG_INFO("Checking Work");
-  boost::this_thread::sleep(boost::posix_time::millisec(100));
   return true;
 }
 
@@ -1086,6 +1780,27 @@ std::string StateToString(State state) {
 
 void Node::PublishStatus() {
   ROS_DEBUG("[%s]: Node::PublishStatus was called", name_->topic.c_str());
+  // Potential is part of the state that gets compared, so refresh it first
+  UpdateActivationPotential();
+  if (change_only_publish_) {
+    boost::posix_time::ptime now = mutex::SimClock::Now();
+    if (published_once_ && !StateChanged()
+        && now - last_publish_time_ < publish_heartbeat_) {
+      publishes_suppressed_++;
+      uint64_t suppressed =
+        publishes_suppressed.fetch_add(1, std::memory_order_relaxed) + 1;
+      ROS_INFO_THROTTLE(SUPPRESSED_REPORT_PERIOD_S, "%lu unchanged state "
+        "publishes suppressed in this process, [%s]: %lu suppressed, %lu sent",
+        (unsigned long)suppressed, name_->topic.c_str(),
+        (unsigned long)publishes_suppressed_, (unsigned long)publishes_sent_);
+      return;
+    }
+    published_once_ = true;
+    published_state_ = state_;
+    last_publish_time_ = now;
+  }
+  publishes_sent_++;
+
   robotics_task_tree_msgs::State msg;
   msg.owner.type = state_.owner.type;
   msg.owner.robot = state_.owner.robot;
@@ -1104,14 +1819,39 @@ void Node::PublishStatus() {
 
   //*msg = state_; // for some reason this doesn't work anymore
   //ROS_INFO("[%s]: PublishStatus", name_->topic.c_str() );
+  messages_published.fetch_add(1, std::memory_order_relaxed);
   self_pub_.publish(msg);
 
   // Publish Activation Potential
-  PublishActivationPotential();
+  SendActivationPotential();
   PublishStateToPeers();
   PublishStateToChildren();
 }
 
+// True when the state differs from the last published one by more than
+// publish_epsilon_ in any float field or in any flag
+bool Node::StateChanged() {
+  const State &last = published_state_;
+  return state_.active != last.active
+    || state_.done != last.done
+    || state_.peer_active != last.peer_active
+    || state_.peer_done != last.peer_done
+    || state_.collision != last.collision
+    || state_.peerPlacing != last.peerPlacing
+    || state_.selfPlacing != last.selfPlacing
+    || state_.parent_type != last.parent_type
+    || !is_eq(state_.highest, last.highest)
+    || fabs(state_.activation_level - last.activation_level) > publish_epsilon_
+    || fabs(state_.activation_potential - last.activation_potential)
+      > publish_epsilon_
+    || fabs(state_.highest_potential - last.highest_potential)
+      > publish_epsilon_;
+}
+
+uint64_t Node::SuppressedPublishes() {
+  return publishes_suppressed_;
+}
+
 void Node::PublishStateToPeers() {
   ROS_DEBUG("[%s]: Node::PublishStateToPeers was called", name_->topic.c_str());
   boost::shared_ptr<ControlMessage_t> msg(new ControlMessage_t);
@@ -1125,9 +1865,8 @@ void Node::PublishStateToPeers() {
   msg->peerPlacing = state_.peerPlacing;
   msg->peerUndone = false;
 
-  for (PubList::iterator it = peer_pub_list_.begin();
-      it != peer_pub_list_.end(); ++it) {
-    it->publish(msg);
+  for (NodeListPtrIterator it = peers_.begin(); it != peers_.end(); ++it) {
+    Transmit(*it, LocalTransport::PEER_CHANNEL, (*it)->pub, msg);
   }
 }
 
@@ -1145,9 +1884,9 @@ void Node::PublishStateToChildren() {
   msg->peerUndone = false;
 
 
-  for (PubList::iterator it = children_pub_list_.begin();
-      it != children_pub_list_.end(); ++it) {
-    it->publish(msg);
+  for (NodeListPtrIterator it = children_.begin(); it != children_.end();
+      ++it) {
+    Transmit(*it, LocalTransport::PARENT_CHANNEL, (*it)->pub, msg);
   }
 
 }
@@ -1156,6 +1895,10 @@ void Node::PublishActivationPotential() {
   ROS_DEBUG("[%s]: Node::PublishActivationPotential was called", name_->topic.c_str());
   // Update Activation Potential
   UpdateActivationPotential();
+  SendActivationPotential();
+}
+
+void Node::SendActivationPotential() {
   ControlMessagePtr_t msg(new ControlMessage_t);
   msg->sender = mask_;
   msg->activation_level = state_.activation_level;
@@ -1167,7 +1910,7 @@ void Node::PublishActivationPotential() {
   // ROS_INFO("msg->activation_level %f", msg->activation_level);
   // ROS_INFO("msg->activation_potential %f", msg->activation_potential);
   msg->active = state_.active;
-  parent_pub_.publish(msg);
+  Transmit(parent_, LocalTransport::CHILD_CHANNEL, &parent_pub_, msg);
 }
 
 void Node::UpdateActivationPotential() {
@@ -1184,7 +1927,7 @@ void Node::PublishDoneParent() {
   msg->activation_potential = state_.activation_potential;
   msg->done = state_.done;
   msg->active = state_.active;
-  parent_pub_.publish(msg);
+  Transmit(parent_, LocalTransport::CHILD_CHANNEL, &parent_pub_, msg);
   // printf("Publish Status: %d\n", msg->done);
 }
 
@@ -1208,14 +1951,7 @@ bool Node::Precondition() {
 
   // TODO(Luke Fraser) Merge children/peer/name/parent lists to point to the
   // same as dictionary
-  bool satisfied = true;
-  for (NodeListPtrIterator it = children_.begin();
-      it != children_.end(); ++it) {
-    satisfied = satisfied && (*it)->state.done;
-  }
-  if (satisfied)
-    return true;
-  return false;
+  return AllChildrenDone();
 }
 uint32_t Node::SpreadActivation() {
       // ROS_INFO("Node::SpreadActivation was called!!!!\n");
@@ -1256,6 +1992,19 @@ void Node::InitializeSubscriber(NodeId_t *node) {
     PUB_SUB_QUEUE_SIZE,
     &Node::dropCallback,
     this);
+
+  // Batched messages from other processes are demultiplexed through the
+  // local transport as well
+  if ((intra_process_ || batch_) && node_table_) {
+    LocalTransport *transport = LocalTransport::Instance();
+    NodeHandle_t handle = node_table_->Handle(node->mask);
+    transport->Register(handle, LocalTransport::CHILD_CHANNEL,
+      boost::bind(&Node::ReceiveFromChildren, this, _1));
+    transport->Register(handle, LocalTransport::PARENT_CHANNEL,
+      boost::bind(&Node::ReceiveFromParent, this, _1));
+    transport->Register(handle, LocalTransport::PEER_CHANNEL,
+      boost::bind(&Node::ReceiveFromPeers, this, _1));
+  }
 }
 void Node::InitializePublishers(NodeListPtr nodes, PubList *pub,
     const char * topic_addition) {
@@ -1268,8 +2017,8 @@ void Node::InitializePublishers(NodeListPtr nodes, PubList *pub,
         PUB_SUB_QUEUE_SIZE);
 
     pub->push_back(*topic);
-    node_dict_[(*it)->mask]->pub = topic;
-    node_dict_[(*it)->mask]->topic += topic_addition;
+    (*it)->pub = topic;
+    (*it)->topic += topic_addition;
     ROS_INFO("[PUBLISHER] - Creating Topic: %s", (*it)->topic.c_str());
   }
 }
@@ -1283,7 +2032,7 @@ void Node::InitializePublisher(NodeId_t *node, ros::Publisher *pub,
   (*pub) =
     pub_nh_.advertise<robotics_task_tree_msgs::ControlMessage>(node->topic,
       PUB_SUB_QUEUE_SIZE);
-  node_dict_[node->mask]->pub = pub;
+  node->pub = pub;
   // node_dict_[node.mask]->topic += topic_addition;
 }
 
@@ -1295,26 +2044,32 @@ void Node::InitializeStatePublisher(NodeId_t *node, ros::Publisher *pub,
   ROS_INFO("[PUBLISHER] - Creating Topic: %s", node->topic.c_str());
   (*pub) = pub_nh_.advertise<robotics_task_tree_msgs::State>(node->topic,
     PUB_SUB_QUEUE_SIZE);
-  node_dict_[node->mask]->pub = pub;
+  node->pub = pub;
   // node_dict_[node.mask]->topic += topic_addition;
 }
 
 NodeBitmask Node::GetBitmask(std::string name) {
     // ROS_INFO("Node::GetBitmask was called!!!!\n");
-  // Split underscores
-  std::vector<std::string> split_vec;
-  boost::algorithm::split(split_vec, name,
-    boost::algorithm::is_any_of("_"));
-  NodeBitmask mask;
-  // node_type
-  mask.type  = static_cast<uint8_t>(atoi(split_vec[1].c_str()));
-  mask.robot = static_cast<uint8_t>(atoi(split_vec[2].c_str()));
-  mask.node  = static_cast<uint16_t>(atoi(split_vec[3].c_str()));
-  return mask;
+  // Names from the NodeList were parsed when the table was built
+  if (node_table_) {
+    NodeHandle_t handle = node_table_->Handle(name);
+    if (handle != NodeTable::INVALID_HANDLE)
+      return node_table_->Mask(handle);
+  }
+  return NodeTable::ParseBitmask(name);
 }
 NodeId_t Node::GetNodeId(NodeBitmask id) {
     // ROS_INFO("Node::GetNodeId was called!!!!\n");
-  return *node_dict_[id];
+  return *LookupNode(id);
+}
+// Returns NULL for nodes that are not in the NodeList
+NodeId_t* Node::LookupNode(const NodeBitmask &mask) {
+  if (!node_table_)
+    return NULL;
+  NodeHandle_t handle = node_table_->Handle(mask);
+  if (handle == NodeTable::INVALID_HANDLE)
+    return NULL;
+  return node_dict_[handle];
 }
 
 ros::CallbackQueue* Node::GetPubCallbackQueue() {
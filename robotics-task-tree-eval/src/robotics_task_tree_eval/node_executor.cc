@@ -0,0 +1,134 @@
+/*
+robotics-task-tree-eval
+Copyright (C) 2015  Luke Fraser
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#include "robotics_task_tree_eval/node_executor.h"
+#include <ros/ros.h>
+#include "remote_mutex/sim_clock.h"
+
+namespace task_net {
+
+NodeExecutor *NodeExecutor::instance_ = NULL;
+boost::mutex NodeExecutor::instance_mut_;
+
+NodeExecutor* NodeExecutor::Configure(uint32_t num_threads) {
+  boost::lock_guard<boost::mutex> lock(instance_mut_);
+  if (!instance_) {
+    if (num_threads == 0)
+      num_threads = 1;
+    instance_ = new NodeExecutor(num_threads);
+    ROS_INFO("NodeExecutor started with %u worker threads", num_threads);
+    ROS_WARN("NodeExecutor: node updates share these threads, a behavior "
+      "whose ActivationPrecondition() or Precondition() blocks stalls every "
+      "node of the process");
+  }
+  return instance_;
+}
+
+NodeExecutor* NodeExecutor::Instance() {
+  boost::lock_guard<boost::mutex> lock(instance_mut_);
+  return instance_;
+}
+
+NodeExecutor::NodeExecutor(uint32_t num_threads)
+    : timer_sequence_(0), running_(true), num_threads_(num_threads) {
+  for (uint32_t i = 0; i < num_threads_; ++i) {
+    workers_.create_thread(boost::bind(&NodeExecutor::WorkerLoop, this));
+  }
+}
+
+NodeExecutor::~NodeExecutor() {
+  Stop();
+}
+
+void NodeExecutor::Stop() {
+  {
+    boost::lock_guard<boost::mutex> lock(mut_);
+    if (!running_)
+      return;
+    running_ = false;
+  }
+  cv_.notify_all();
+  workers_.join_all();
+}
+
+void NodeExecutor::Post(Task task) {
+  {
+    boost::lock_guard<boost::mutex> lock(mut_);
+    ready_.push_back(task);
+  }
+  cv_.notify_one();
+}
+
+void NodeExecutor::PostAfter(boost::posix_time::time_duration delay,
+    Task task) {
+  TimedTask timed;
+  timed.deadline = mutex::SimClock::Now() + delay;
+  timed.task = task;
+  {
+    boost::lock_guard<boost::mutex> lock(mut_);
+    timed.sequence = timer_sequence_++;
+    timers_.push(timed);
+  }
+  // A new timer may be earlier than the one the workers are waiting on
+  cv_.notify_all();
+}
+
+uint32_t NodeExecutor::NumThreads() const {
+  return num_threads_;
+}
+
+size_t NodeExecutor::PendingTasks() {
+  boost::lock_guard<boost::mutex> lock(mut_);
+  return ready_.size() + timers_.size();
+}
+
+// Each worker moves expired timers onto the ready queue, then runs one task
+// with the lock released. Idle workers sleep until the earliest deadline.
+void NodeExecutor::WorkerLoop(NodeExecutor *executor) {
+  mutex::SimClock::Client client;
+  boost::unique_lock<boost::mutex> lock(executor->mut_);
+  while (executor->running_) {
+    boost::posix_time::ptime now = mutex::SimClock::Now();
+    while (!executor->timers_.empty()
+        && executor->timers_.top().deadline <= now) {
+      executor->ready_.push_back(executor->timers_.top().task);
+      executor->timers_.pop();
+    }
+
+    if (!executor->ready_.empty()) {
+      Task task = executor->ready_.front();
+      executor->ready_.pop_front();
+      lock.unlock();
+      try {
+        task();
+      }
+      catch (boost::thread_interrupted&) {
+        throw;
+      }
+      catch (std::exception &e) {
+        ROS_ERROR("NodeExecutor: task threw exception: %s", e.what());
+      }
+      lock.lock();
+    } else if (!executor->timers_.empty()) {
+      mutex::SimClock::TimedWait(executor->cv_, lock,
+        executor->timers_.top().deadline);
+    } else {
+      mutex::SimClock::Wait(executor->cv_, lock);
+    }
+  }
+}
+}  // namespace task_net
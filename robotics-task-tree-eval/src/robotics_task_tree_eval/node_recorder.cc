@@ -0,0 +1,302 @@
+/*
+robotics-task-tree-eval
+Copyright (C) 2015  Luke Fraser
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#include "robotics_task_tree_eval/node_recorder.h"
+#include <ros/ros.h>
+#include <boost/bind.hpp>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+#include <errno.h>
+#include <string.h>
+#include "robotics_task_tree_eval/node_executor.h"
+
+// Records are appended into mapped windows of this size
+#define RECORD_CHUNK_BYTES (4 * 1024 * 1024)
+#define DEFAULT_RECORD_RATE_HZ 10
+
+namespace task_net {
+
+uint64_t MonotonicNs() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return static_cast<uint64_t>(ts.tv_sec) * 1000000000ull + ts.tv_nsec;
+}
+
+static uint64_t WallNs() {
+  struct timespec ts;
+  clock_gettime(CLOCK_REALTIME, &ts);
+  return static_cast<uint64_t>(ts.tv_sec) * 1000000000ull + ts.tv_nsec;
+}
+
+static uint64_t RoundUp(uint64_t value, uint64_t multiple) {
+  return (value + multiple - 1) / multiple * multiple;
+}
+
+NodeRecorder *NodeRecorder::instance_ = NULL;
+boost::mutex NodeRecorder::instance_mut_;
+
+std::string NodeRecorder::ProcessName() {
+  std::string process = ros::this_node::getName();
+  for (size_t i = 0; i < process.size(); ++i) {
+    if (process[i] == '/')
+      process[i] = '_';
+  }
+  if (!process.empty() && process[0] == '_')
+    process.erase(0, 1);
+  return process;
+}
+
+NodeRecorder* NodeRecorder::Configure(const std::string &directory,
+    double rate_hz, NodeTable *table) {
+  boost::lock_guard<boost::mutex> lock(instance_mut_);
+  if (instance_)
+    return instance_;
+
+  // <directory>/<ros node name>_<YYYYmmddTHHMMSS>.ttrec
+  std::string process = ProcessName();
+  std::string stamp = boost::posix_time::to_iso_string(
+    boost::posix_time::second_clock::local_time());
+  std::string filename = directory + "/" + process + "_" + stamp + ".ttrec";
+
+  NodeRecorder *recorder = new NodeRecorder(filename, rate_hz, table);
+  if (recorder->fd_ < 0) {
+    delete recorder;
+    return NULL;
+  }
+  instance_ = recorder;
+  ROS_INFO("NodeRecorder: recording %zu nodes at %u Hz to %s", table->Size(),
+    instance_->rate_hz_, filename.c_str());
+  return instance_;
+}
+
+NodeRecorder* NodeRecorder::Instance() {
+  boost::lock_guard<boost::mutex> lock(instance_mut_);
+  return instance_;
+}
+
+NodeRecorder::NodeRecorder(const std::string &filename, double rate_hz,
+    NodeTable *table)
+    : filename_(filename), fd_(-1), header_(NULL), header_map_size_(0),
+      chunk_(NULL), chunk_offset_(0), chunk_size_(0), write_offset_(0),
+      file_size_(0), executor_(NULL), record_thread_(NULL) {
+  if (rate_hz <= 0.0)
+    rate_hz = DEFAULT_RECORD_RATE_HZ;
+  rate_hz_ = static_cast<uint32_t>(rate_hz + 0.5);
+  if (rate_hz_ == 0)
+    rate_hz_ = 1;
+  period_ns_ = static_cast<uint64_t>(1e9 / rate_hz);
+  period_ = boost::posix_time::microseconds(period_ns_ / 1000);
+
+  if (!Open(table)) {
+    Close();
+    return;
+  }
+  executor_ = NodeExecutor::Instance();
+  if (executor_)
+    executor_->PostAfter(period_, boost::bind(&RecordTask, this));
+  else
+    record_thread_ = new boost::thread(&RecordThread, this);
+}
+
+NodeRecorder::~NodeRecorder() {
+  if (record_thread_) {
+    record_thread_->interrupt();
+    record_thread_->join();
+    delete record_thread_;
+  }
+  boost::lock_guard<boost::mutex> lock(mut_);
+  Close();
+}
+
+bool NodeRecorder::Open(NodeTable *table) {
+  fd_ = open(filename_.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+  if (fd_ < 0) {
+    ROS_ERROR("NodeRecorder: cannot create %s: %s", filename_.c_str(),
+      strerror(errno));
+    return false;
+  }
+
+  // Records start on a page boundary so every chunk can be mapped directly
+  uint64_t page = sysconf(_SC_PAGESIZE);
+  uint64_t names_size = table->Size() * RECORD_NAME_LENGTH;
+  uint64_t data_offset = RoundUp(sizeof(RecordFileHeader) + names_size, page);
+  if (ftruncate(fd_, data_offset) != 0) {
+    ROS_ERROR("NodeRecorder: cannot size %s: %s", filename_.c_str(),
+      strerror(errno));
+    return false;
+  }
+  file_size_ = data_offset;
+
+  void *map = mmap(NULL, data_offset, PROT_READ | PROT_WRITE, MAP_SHARED, fd_,
+    0);
+  if (map == MAP_FAILED) {
+    ROS_ERROR("NodeRecorder: cannot map %s: %s", filename_.c_str(),
+      strerror(errno));
+    return false;
+  }
+  header_ = static_cast<RecordFileHeader*>(map);
+  header_map_size_ = data_offset;
+
+  memset(header_, 0, data_offset);
+  memcpy(header_->magic, RECORD_MAGIC, sizeof(RECORD_MAGIC));
+  header_->version = RECORD_VERSION;
+  header_->header_size = sizeof(RecordFileHeader);
+  header_->record_size = sizeof(RecordEntry);
+  header_->node_count = table->Size();
+  header_->name_length = RECORD_NAME_LENGTH;
+  header_->rate_hz = rate_hz_;
+  header_->data_offset = data_offset;
+  header_->monotonic_start_ns = MonotonicNs();
+  header_->wall_start_ns = WallNs();
+  header_->record_count = 0;
+
+  char *names = reinterpret_cast<char*>(header_ + 1);
+  for (NodeHandle_t handle = 0; handle < table->Size(); ++handle) {
+    strncpy(names + handle * RECORD_NAME_LENGTH, table->Name(handle).c_str(),
+      RECORD_NAME_LENGTH - 1);
+  }
+
+  write_offset_ = data_offset;
+  chunk_size_ = RoundUp(RECORD_CHUNK_BYTES, page);
+  return MapChunk(data_offset);
+}
+
+// Grow the file by one chunk and move the write window onto it
+bool NodeRecorder::MapChunk(uint64_t offset) {
+  if (chunk_) {
+    munmap(chunk_, chunk_size_);
+    chunk_ = NULL;
+  }
+  if (offset + chunk_size_ > file_size_) {
+    if (ftruncate(fd_, offset + chunk_size_) != 0) {
+      ROS_ERROR("NodeRecorder: cannot grow %s: %s", filename_.c_str(),
+        strerror(errno));
+      return false;
+    }
+    file_size_ = offset + chunk_size_;
+  }
+  void *map = mmap(NULL, chunk_size_, PROT_READ | PROT_WRITE, MAP_SHARED, fd_,
+    offset);
+  if (map == MAP_FAILED) {
+    ROS_ERROR("NodeRecorder: cannot map %s: %s", filename_.c_str(),
+      strerror(errno));
+    return false;
+  }
+  chunk_ = static_cast<char*>(map);
+  chunk_offset_ = offset;
+  return true;
+}
+
+// Unmap and cut the file back to the records actually written
+void NodeRecorder::Close() {
+  if (chunk_) {
+    munmap(chunk_, chunk_size_);
+    chunk_ = NULL;
+  }
+  if (header_) {
+    munmap(header_, header_map_size_);
+    header_ = NULL;
+  }
+  if (fd_ >= 0) {
+    if (write_offset_ > 0 && ftruncate(fd_, write_offset_) != 0) {
+      ROS_WARN("NodeRecorder: cannot trim %s: %s", filename_.c_str(),
+        strerror(errno));
+    }
+    close(fd_);
+    fd_ = -1;
+  }
+}
+
+void NodeRecorder::Register(NodeHandle_t handle,
+    const SeqLock<SelfSample> *snapshot) {
+  if (handle == NodeTable::INVALID_HANDLE)
+    return;
+  Source_t source;
+  source.handle = handle;
+  source.snapshot = snapshot;
+  boost::lock_guard<boost::mutex> lock(mut_);
+  sources_.push_back(source);
+}
+
+const std::string& NodeRecorder::Filename() const {
+  return filename_;
+}
+
+uint64_t NodeRecorder::RecordCount() {
+  boost::lock_guard<boost::mutex> lock(mut_);
+  if (!header_)
+    return 0;
+  return header_->record_count;
+}
+
+// Copy every registered snapshot into the log. The record count in the
+// header only moves once the whole sample is written, so a reader of a live
+// file never sees a torn record.
+void NodeRecorder::Sample() {
+  boost::lock_guard<boost::mutex> lock(mut_);
+  if (!chunk_)
+    return;
+  uint64_t now = MonotonicNs();
+  for (size_t i = 0; i < sources_.size(); ++i) {
+    if (write_offset_ + sizeof(RecordEntry) > chunk_offset_ + chunk_size_) {
+      if (!MapChunk(write_offset_))
+        break;
+    }
+    SelfSample sample = sources_[i].snapshot->Read();
+    RecordEntry *entry = reinterpret_cast<RecordEntry*>(
+      chunk_ + (write_offset_ - chunk_offset_));
+    entry->monotonic_ns = now;
+    entry->node = sources_[i].handle;
+    entry->activation_level = sample.activation_level;
+    entry->activation_potential = sample.activation_potential;
+    entry->suitability = sample.suitability;
+    entry->active = sample.active;
+    entry->done = sample.done;
+    entry->working = sample.working;
+    memset(entry->reserved, 0, sizeof(entry->reserved));
+    write_offset_ += sizeof(RecordEntry);
+  }
+  __atomic_store_n(&header_->record_count,
+    (write_offset_ - header_->data_offset) / sizeof(RecordEntry),
+    __ATOMIC_RELEASE);
+}
+
+// Absolute deadlines so the sampling rate does not drift with Sample() time
+void NodeRecorder::RecordThread(NodeRecorder *recorder) {
+  uint64_t next = MonotonicNs();
+  while (true) {
+    recorder->Sample();
+    next += recorder->period_ns_;
+    uint64_t now = MonotonicNs();
+    if (next > now) {
+      boost::this_thread::sleep(
+        boost::posix_time::microseconds((next - now) / 1000));
+    } else {
+      next = now;
+    }
+  }
+}
+
+void NodeRecorder::RecordTask(NodeRecorder *recorder) {
+  recorder->Sample();
+  recorder->executor_->PostAfter(recorder->period_,
+    boost::bind(&RecordTask, recorder));
+}
+}  // namespace task_net
@@ -0,0 +1,125 @@
+/*
+robotics-task-tree-eval
+Copyright (C) 2015  Luke Fraser
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#include "robotics_task_tree_eval/node_table.h"
+#include <ros/ros.h>
+#include <boost/algorithm/string/split.hpp>
+#include <boost/algorithm/string/classification.hpp>
+#include <stdlib.h>
+
+#define EMPTY_SLOT 0xffffffff
+
+namespace task_net {
+
+const NodeHandle_t NodeTable::INVALID_HANDLE;
+NodeTable *NodeTable::instance_ = NULL;
+boost::mutex NodeTable::instance_mut_;
+
+static inline uint32_t HashKey(uint32_t key) {
+  key ^= key >> 16;
+  key *= 0x45d9f3b;
+  key ^= key >> 16;
+  return key;
+}
+
+NodeTable* NodeTable::Load(const std::vector<std::string> &names) {
+  boost::lock_guard<boost::mutex> lock(instance_mut_);
+  if (!instance_) {
+    instance_ = new NodeTable(names);
+    ROS_INFO("NodeTable loaded with %zu nodes", instance_->Size());
+  }
+  return instance_;
+}
+
+NodeTable* NodeTable::Instance() {
+  boost::lock_guard<boost::mutex> lock(instance_mut_);
+  return instance_;
+}
+
+NodeBitmask NodeTable::ParseBitmask(const std::string &name) {
+  // Split underscores
+  std::vector<std::string> split_vec;
+  boost::algorithm::split(split_vec, name,
+    boost::algorithm::is_any_of("_"));
+  NodeBitmask mask;
+  mask.type  = static_cast<uint8_t>(atoi(split_vec[1].c_str()));
+  mask.robot = static_cast<uint8_t>(atoi(split_vec[2].c_str()));
+  mask.node  = static_cast<uint16_t>(atoi(split_vec[3].c_str()));
+  return mask;
+}
+
+NodeTable::NodeTable(const std::vector<std::string> &names) {
+  // At most half full so probe chains stay short
+  uint32_t slots = 4;
+  while (slots < 2 * names.size())
+    slots <<= 1;
+  slot_mask_ = slots - 1;
+  slot_keys_.assign(slots, EMPTY_SLOT);
+  slot_handles_.assign(slots, INVALID_HANDLE);
+
+  for (std::vector<std::string>::const_iterator it = names.begin();
+      it != names.end(); ++it) {
+    NodeBitmask mask = ParseBitmask(*it);
+    if (Handle(mask) != INVALID_HANDLE) {
+      ROS_WARN("NodeTable: duplicate node [%s] ignored", it->c_str());
+      continue;
+    }
+    NodeHandle_t handle = names_.size();
+    names_.push_back(*it);
+    masks_.push_back(mask);
+    name_index_[*it] = handle;
+
+    uint32_t key = BitmaskKey(mask);
+    uint32_t slot = HashKey(key) & slot_mask_;
+    while (slot_keys_[slot] != EMPTY_SLOT)
+      slot = (slot + 1) & slot_mask_;
+    slot_keys_[slot] = key;
+    slot_handles_[slot] = handle;
+  }
+}
+
+NodeHandle_t NodeTable::Handle(const NodeBitmask &mask) const {
+  uint32_t key = BitmaskKey(mask);
+  uint32_t slot = HashKey(key) & slot_mask_;
+  while (slot_keys_[slot] != EMPTY_SLOT) {
+    if (slot_keys_[slot] == key)
+      return slot_handles_[slot];
+    slot = (slot + 1) & slot_mask_;
+  }
+  return INVALID_HANDLE;
+}
+
+NodeHandle_t NodeTable::Handle(const std::string &name) const {
+  std::map<std::string, NodeHandle_t>::const_iterator it =
+    name_index_.find(name);
+  if (it == name_index_.end())
+    return INVALID_HANDLE;
+  return it->second;
+}
+
+const std::string& NodeTable::Name(NodeHandle_t handle) const {
+  return names_[handle];
+}
+
+const NodeBitmask& NodeTable::Mask(NodeHandle_t handle) const {
+  return masks_[handle];
+}
+
+size_t NodeTable::Size() const {
+  return names_.size();
+}
+}  // namespace task_net
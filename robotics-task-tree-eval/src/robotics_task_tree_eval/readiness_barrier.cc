@@ -0,0 +1,257 @@
+/*
+robotics-task-tree-eval
+Copyright (C) 2015  Luke Fraser
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#include "robotics_task_tree_eval/readiness_barrier.h"
+#include <boost/bind.hpp>
+#include "remote_mutex/sim_clock.h"
+#include "robotics_task_tree_eval/node_executor.h"
+
+#define READY_TOPIC "task_tree_ready"
+#define READY_POLL_MS 50
+
+namespace task_net {
+
+bool ReadinessBarrier::nodes_created_ = false;
+ReadinessBarrier *ReadinessBarrier::instance_ = NULL;
+boost::mutex ReadinessBarrier::instance_mut_;
+
+ReadinessBarrier* ReadinessBarrier::Configure(NodeTable *table,
+    const std::vector<int> &robots, boost::posix_time::time_duration timeout) {
+  boost::lock_guard<boost::mutex> lock(instance_mut_);
+  if (!instance_) {
+    instance_ = new ReadinessBarrier(table, robots, timeout);
+    ROS_INFO("ReadinessBarrier waiting for %zu robots, timeout %ld ms",
+      instance_->expected_robots_.size(),
+      static_cast<long>(timeout.total_milliseconds()));
+  }
+  return instance_;
+}
+
+ReadinessBarrier* ReadinessBarrier::Instance() {
+  boost::lock_guard<boost::mutex> lock(instance_mut_);
+  return instance_;
+}
+
+void ReadinessBarrier::NodesCreated() {
+  boost::lock_guard<boost::mutex> lock(instance_mut_);
+  nodes_created_ = true;
+}
+
+ReadinessBarrier::ReadinessBarrier(NodeTable *table,
+    const std::vector<int> &robots, boost::posix_time::time_duration timeout)
+    : local_ready_(false), reported_(false), released_(false),
+      timeout_(timeout), poll_thread_(NULL) {
+  if (robots.empty()) {
+    for (NodeHandle_t handle = 0; handle < table->Size(); ++handle) {
+      // Nobody runs the ROOT node, it only names the top of the tree
+      if (table->Mask(handle).type != ROOT)
+        expected_robots_.insert(table->Mask(handle).robot);
+    }
+  } else {
+    for (size_t i = 0; i < robots.size(); ++i)
+      expected_robots_.insert(static_cast<uint8_t>(robots[i]));
+  }
+
+  process_ = ros::this_node::getName();
+  start_ = boost::posix_time::microsec_clock::universal_time();
+  ready_pub_ = nh_.advertise<robotics_task_tree_msgs::ReadinessReport>(
+    READY_TOPIC, 10, true);
+  ready_sub_ = nh_.subscribe(READY_TOPIC, 10,
+    &ReadinessBarrier::ReceiveReport, this);
+
+  executor_ = NodeExecutor::Instance();
+  if (executor_)
+    executor_->PostAfter(boost::posix_time::millisec(READY_POLL_MS),
+      boost::bind(&PollTask, this));
+  else
+    poll_thread_ = new boost::thread(&PollThread, this);
+}
+
+ReadinessBarrier::~ReadinessBarrier() {
+  if (poll_thread_) {
+    poll_thread_->interrupt();
+    poll_thread_->join();
+    delete poll_thread_;
+  }
+}
+
+void ReadinessBarrier::Register(const std::string &name, uint8_t robot,
+    Check check) {
+  Node_t node;
+  node.name = name;
+  node.robot = robot;
+  node.check = check;
+  boost::lock_guard<boost::mutex> lock(mut_);
+  nodes_.push_back(node);
+}
+
+void ReadinessBarrier::OnReady(Callback callback) {
+  {
+    boost::lock_guard<boost::mutex> lock(mut_);
+    if (!released_) {
+      callbacks_.push_back(callback);
+      return;
+    }
+  }
+  callback();
+}
+
+void ReadinessBarrier::WaitReady() {
+  boost::unique_lock<boost::mutex> lock(mut_);
+  while (!released_)
+    mutex::SimClock::Wait(cv_, lock);
+}
+
+bool ReadinessBarrier::Released() {
+  boost::lock_guard<boost::mutex> lock(mut_);
+  return released_;
+}
+
+void ReadinessBarrier::ReceiveReport(
+    const robotics_task_tree_msgs::ReadinessReport::ConstPtr &msg) {
+  if (msg->process == process_)
+    return;
+  boost::lock_guard<boost::mutex> lock(mut_);
+  reports_[msg->process] = *msg;
+}
+
+// Run the node checks, publish this process' report when it changes and
+// release once every expected robot has a ready process
+bool ReadinessBarrier::Poll() {
+  bool created;
+  {
+    boost::lock_guard<boost::mutex> lock(instance_mut_);
+    created = nodes_created_;
+  }
+  std::vector<Node_t> nodes;
+  {
+    boost::lock_guard<boost::mutex> lock(mut_);
+    if (released_)
+      return false;
+    nodes = nodes_;
+  }
+
+  // Checks query the ROS publishers, so they run without the lock held
+  robotics_task_tree_msgs::ReadinessReport report;
+  report.process = process_;
+  report.ready = created;
+  report.nodes = nodes.size();
+  std::set<uint8_t> robots;
+  for (size_t i = 0; i < nodes.size(); ++i) {
+    robots.insert(nodes[i].robot);
+    std::vector<std::string> topics;
+    if (!nodes[i].check(&topics)) {
+      report.ready = false;
+      for (size_t j = 0; j < topics.size(); ++j)
+        report.waiting.push_back(nodes[i].name + " -> " + topics[j]);
+    }
+  }
+  report.robots.assign(robots.begin(), robots.end());
+
+  bool publish = false;
+  bool release = false;
+  bool timed_out = false;
+  {
+    boost::lock_guard<boost::mutex> lock(mut_);
+    if (!reported_ || report.ready != local_ready_) {
+      reported_ = true;
+      local_ready_ = report.ready;
+      publish = true;
+    }
+    reports_[process_] = report;
+
+    std::set<uint8_t> ready_robots;
+    std::map<std::string, robotics_task_tree_msgs::ReadinessReport>::iterator it;
+    for (it = reports_.begin(); it != reports_.end(); ++it) {
+      if (it->second.ready)
+        ready_robots.insert(it->second.robots.begin(),
+          it->second.robots.end());
+    }
+    release = local_ready_;
+    for (std::set<uint8_t>::iterator robot = expected_robots_.begin();
+        robot != expected_robots_.end(); ++robot) {
+      if (ready_robots.find(*robot) == ready_robots.end())
+        release = false;
+    }
+    if (!release && boost::posix_time::microsec_clock::universal_time()
+        - start_ > timeout_) {
+      release = true;
+      timed_out = true;
+    }
+  }
+  if (publish) {
+    ROS_INFO("ReadinessBarrier: %s %s (%zu nodes)", process_.c_str(),
+      report.ready ? "ready" : "not ready", nodes.size());
+    ready_pub_.publish(report);
+  }
+  if (release)
+    Release(timed_out);
+  return !release;
+}
+
+void ReadinessBarrier::Release(bool timed_out) {
+  std::vector<Callback> callbacks;
+  {
+    boost::lock_guard<boost::mutex> lock(mut_);
+    long elapsed = (boost::posix_time::microsec_clock::universal_time()
+      - start_).total_milliseconds();
+    if (timed_out) {
+      ROS_WARN("ReadinessBarrier: timed out after %ld ms, starting anyway",
+        elapsed);
+      std::map<std::string, robotics_task_tree_msgs::ReadinessReport>::iterator
+        it;
+      for (it = reports_.begin(); it != reports_.end(); ++it) {
+        if (it->second.ready)
+          continue;
+        ROS_WARN("  %s not ready (%u nodes)", it->first.c_str(),
+          it->second.nodes);
+        for (size_t i = 0; i < it->second.waiting.size(); ++i)
+          ROS_WARN("    waiting: %s", it->second.waiting[i].c_str());
+      }
+      for (std::set<uint8_t>::iterator robot = expected_robots_.begin();
+          robot != expected_robots_.end(); ++robot) {
+        bool seen = false;
+        for (it = reports_.begin(); it != reports_.end(); ++it) {
+          const std::vector<uint8_t> &robots = it->second.robots;
+          for (size_t i = 0; i < robots.size(); ++i)
+            seen = seen || robots[i] == *robot;
+        }
+        if (!seen)
+          ROS_WARN("  no process reported for robot %u", *robot);
+      }
+    } else {
+      ROS_INFO("ReadinessBarrier: tree ready after %ld ms", elapsed);
+    }
+    released_ = true;
+    callbacks.swap(callbacks_);
+  }
+  cv_.notify_all();
+  for (size_t i = 0; i < callbacks.size(); ++i)
+    callbacks[i]();
+}
+
+void ReadinessBarrier::PollThread(ReadinessBarrier *barrier) {
+  while (barrier->Poll())
+    mutex::SimClock::Sleep(boost::posix_time::millisec(READY_POLL_MS));
+}
+
+void ReadinessBarrier::PollTask(ReadinessBarrier *barrier) {
+  if (barrier->Poll())
+    barrier->executor_->PostAfter(boost::posix_time::millisec(READY_POLL_MS),
+      boost::bind(&PollTask, barrier));
+}
+}  // namespace task_net
@@ -0,0 +1,644 @@
+/*
+robotics-task-tree-eval
+Copyright (C) 2015  Luke Fraser
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#include "robotics_task_tree_eval/tree_evaluator.h"
+#include <stdio.h>
+#include <string.h>
+#include <yaml-cpp/yaml.h>
+#include <deque>
+
+// Same constants as node.cc
+#define ACTIVATION_THESH 0.1
+#define ACTIVATION_FALLOFF 0.999f
+#define DEFAULT_LEAF_POTENTIAL 1.0f
+#define DEFAULT_TOP_ACTIVATION 1.0f
+#define DEFAULT_WORK_STEPS 1
+
+namespace task_net {
+namespace {
+struct NodeRecord_t {
+  NodeBitmask mask;
+  std::string parent;
+  std::vector<std::string> children;
+  std::vector<std::string> peers;
+  bool has_potential;
+  float potential;
+};
+
+std::vector<std::string> ReadNames(const YAML::Node &node) {
+  std::vector<std::string> names;
+  if (!node || !node.IsSequence())
+    return names;
+  for (size_t i = 0; i < node.size(); ++i) {
+    std::string name = node[i].as<std::string>();
+    if (name != "NONE")
+      names.push_back(name);
+  }
+  return names;
+}
+
+// The type digit after the first '_', as Node::Node parses it
+int ParentType(const std::string &parent) {
+  size_t pos = parent.find('_');
+  if (pos == std::string::npos || pos + 1 >= parent.size()
+      || parent[pos + 1] < '0' || parent[pos + 1] > '9')
+    return ROOT;
+  return parent[pos + 1] - '0';
+}
+}  // namespace
+
+TreeEvaluator::TreeEvaluator()
+  : default_leaf_potential_(DEFAULT_LEAF_POTENTIAL),
+    top_activation_(DEFAULT_TOP_ACTIVATION),
+    work_steps_(DEFAULT_WORK_STEPS),
+    steps_(0) {}
+
+bool TreeEvaluator::Load(const std::string &filename) {
+  std::vector<std::string> names;
+  std::map<std::string, NodeRecord_t> records;
+  try {
+    YAML::Node config = YAML::LoadFile(filename);
+    if (!config["NodeList"] || !config["Nodes"]) {
+      fprintf(stderr, "%s: no NodeList/Nodes parameters\n", filename.c_str());
+      return false;
+    }
+    names = ReadNames(config["NodeList"]);
+    for (size_t i = 0; i < names.size(); ++i) {
+      YAML::Node node = config["Nodes"][names[i]];
+      if (!node || !node["mask"]) {
+        fprintf(stderr, "%s: node %s has no mask\n", filename.c_str(),
+          names[i].c_str());
+        return false;
+      }
+      NodeRecord_t record;
+      record.mask.type = node["mask"]["type"].as<int>();
+      record.mask.robot = node["mask"]["robot"].as<int>();
+      record.mask.node = node["mask"]["node"].as<int>();
+      record.parent = node["parent"] ? node["parent"].as<std::string>()
+        : "NONE";
+      record.children = ReadNames(node["children"]);
+      record.peers = ReadNames(node["peers"]);
+      record.has_potential = node["potential"].IsDefined();
+      record.potential = record.has_potential
+        ? node["potential"].as<float>() : 0.0f;
+      records[names[i]] = record;
+    }
+  } catch (const YAML::Exception &e) {
+    fprintf(stderr, "%s: %s\n", filename.c_str(), e.what());
+    return false;
+  }
+
+  nodes_.clear();
+  child_index_.clear();
+  child_views_.clear();
+  peer_index_.clear();
+  tops_.clear();
+  name_index_.clear();
+
+  // Breadth first from the nodes below a ROOT (or without a known parent),
+  // so every parent comes before its children in nodes_
+  std::deque<std::string> queue;
+  for (size_t i = 0; i < names.size(); ++i) {
+    const NodeRecord_t &record = records[names[i]];
+    if (record.mask.type == ROOT)
+      continue;
+    std::map<std::string, NodeRecord_t>::iterator parent =
+      records.find(record.parent);
+    if (parent == records.end() || parent->second.mask.type == ROOT)
+      queue.push_back(names[i]);
+  }
+  while (!queue.empty()) {
+    std::string name = queue.front();
+    queue.pop_front();
+    if (name_index_.count(name))
+      continue;
+    const NodeRecord_t &record = records[name];
+    uint32_t index = nodes_.size();
+    name_index_[name] = index;
+
+    Node_t node;
+    node.name = name;
+    node.mask = record.mask;
+    node.parent = -1;
+    node.parent_slot = 0;
+    node.first_child = 0;
+    node.num_children = 0;
+    node.first_peer = 0;
+    node.num_peers = 0;
+    node.parent_done = false;
+    node.then_next = 0;
+    node.peer_checked = false;
+    node.own_potential = record.has_potential;
+    node.leaf_potential = record.has_potential ? record.potential
+      : default_leaf_potential_;
+    node.work_left = 0;
+    node.active_step = -1;
+    node.done_step = -1;
+
+    // Initial state as set up by Node::Node
+    memset(&node.state, 0, sizeof(node.state));
+    node.state.owner = record.mask;
+    node.state.highest = record.mask;
+    std::map<std::string, NodeRecord_t>::iterator parent =
+      records.find(record.parent);
+    node.state.parent_type = parent != records.end()
+      ? parent->second.mask.type : ParentType(record.parent);
+    if (node.state.parent_type == ROOT)
+      tops_.push_back(index);
+    nodes_.push_back(node);
+
+    for (size_t i = 0; i < record.children.size(); ++i) {
+      if (records.count(record.children[i]))
+        queue.push_back(record.children[i]);
+    }
+  }
+
+  // Link children and peers now that every node has its index
+  for (uint32_t index = 0; index < nodes_.size(); ++index) {
+    Node_t &node = nodes_[index];
+    const NodeRecord_t &record = records[node.name];
+    node.first_child = child_index_.size();
+    for (size_t i = 0; i < record.children.size(); ++i) {
+      std::map<std::string, uint32_t>::iterator child =
+        name_index_.find(record.children[i]);
+      if (child == name_index_.end()
+          || nodes_[child->second].parent >= 0)
+        continue;
+      nodes_[child->second].parent = index;
+      nodes_[child->second].parent_slot = child_index_.size();
+      child_index_.push_back(child->second);
+
+      ChildView_t view;
+      memset(&view, 0, sizeof(view));
+      view.highest = nodes_[child->second].mask;
+      child_views_.push_back(view);
+    }
+    node.num_children = child_index_.size() - node.first_child;
+
+    node.first_peer = peer_index_.size();
+    for (size_t i = 0; i < record.peers.size(); ++i) {
+      std::map<std::string, uint32_t>::iterator peer =
+        name_index_.find(record.peers[i]);
+      if (peer != name_index_.end())
+        peer_index_.push_back(peer->second);
+    }
+    node.num_peers = peer_index_.size() - node.first_peer;
+  }
+
+  if (tops_.empty()) {
+    fprintf(stderr, "%s: no node below a ROOT node\n", filename.c_str());
+    return false;
+  }
+  initial_ = nodes_;
+  initial_views_ = child_views_;
+  steps_ = 0;
+  return true;
+}
+
+void TreeEvaluator::Reset() {
+  nodes_ = initial_;
+  child_views_ = initial_views_;
+  steps_ = 0;
+}
+
+void TreeEvaluator::SetDefaultLeafPotential(float potential) {
+  default_leaf_potential_ = potential;
+  for (size_t i = 0; i < nodes_.size(); ++i) {
+    if (!nodes_[i].own_potential) {
+      nodes_[i].leaf_potential = potential;
+      initial_[i].leaf_potential = potential;
+    }
+  }
+}
+
+bool TreeEvaluator::SetLeafPotential(const std::string &name,
+    float potential) {
+  int32_t index = Find(name);
+  if (index < 0)
+    return false;
+  nodes_[index].leaf_potential = potential;
+  nodes_[index].own_potential = true;
+  initial_[index].leaf_potential = potential;
+  initial_[index].own_potential = true;
+  return true;
+}
+
+void TreeEvaluator::SetWorkSteps(uint32_t steps) {
+  work_steps_ = steps;
+}
+
+void TreeEvaluator::SetTopActivation(float level) {
+  top_activation_ = level;
+}
+
+// One Update() of every node. Work finishes between ticks, the ROOT stand in
+// activates the top nodes, decisions run parents first and the status
+// messages go out children first so every potential a parent aggregates in
+// this step is already up to date.
+void TreeEvaluator::Step() {
+  for (uint32_t i = 0; i < nodes_.size(); ++i) {
+    if (nodes_[i].work_left > 0 && --nodes_[i].work_left == 0)
+      FinishWork(i);
+  }
+
+  ControlMessage_t activate;
+  memset(&activate, 0, sizeof(activate));
+  activate.type = 0;
+  activate.activation_level = top_activation_;
+  for (size_t i = 0; i < tops_.size(); ++i)
+    ReceiveFromParent(tops_[i], activate);
+
+  for (uint32_t i = 0; i < nodes_.size(); ++i)
+    Update(i);
+  for (uint32_t i = nodes_.size(); i > 0; --i)
+    PublishStatus(i - 1);
+
+  for (uint32_t i = 0; i < nodes_.size(); ++i) {
+    Node_t &node = nodes_[i];
+    if ((node.state.active || node.state.done) && node.active_step < 0)
+      node.active_step = steps_;
+    if (node.state.done && node.done_step < 0)
+      node.done_step = steps_;
+  }
+  steps_++;
+}
+
+uint32_t TreeEvaluator::Run(uint32_t max_steps) {
+  uint32_t taken = 0;
+  while (taken < max_steps && !Done()) {
+    Step();
+    taken++;
+  }
+  return taken;
+}
+
+bool TreeEvaluator::Done() const {
+  for (size_t i = 0; i < tops_.size(); ++i) {
+    if (!nodes_[tops_[i]].state.done)
+      return false;
+  }
+  return true;
+}
+
+uint32_t TreeEvaluator::Steps() const {
+  return steps_;
+}
+
+size_t TreeEvaluator::Size() const {
+  return nodes_.size();
+}
+
+int32_t TreeEvaluator::Find(const std::string &name) const {
+  std::map<std::string, uint32_t>::const_iterator it = name_index_.find(name);
+  return it == name_index_.end() ? -1 : static_cast<int32_t>(it->second);
+}
+
+const TreeEvaluator::Node_t& TreeEvaluator::GetNode(size_t index) const {
+  return nodes_[index];
+}
+
+robotics_task_tree_msgs::State TreeEvaluator::StateMessage(
+    size_t index) const {
+  const State &state = nodes_[index].state;
+  robotics_task_tree_msgs::State msg;
+  msg.owner.type = state.owner.type;
+  msg.owner.robot = state.owner.robot;
+  msg.owner.node = state.owner.node;
+  msg.active = state.active;
+  msg.done = state.done;
+  msg.activation_level = state.activation_level;
+  msg.activation_potential = state.activation_potential;
+  msg.peer_active = state.peer_active;
+  msg.peer_done = state.peer_done;
+  msg.highest.type = state.highest.type;
+  msg.highest.robot = state.highest.robot;
+  msg.highest.node = state.highest.node;
+  msg.highest_potential = state.highest_potential;
+  msg.parent_type = state.parent_type;
+  return msg;
+}
+
+// Node::Update without the dialogue and mutex paths
+void TreeEvaluator::Update(uint32_t index) {
+  if (IsDone(index))
+    return;
+  if (!IsActive(index))
+    return;
+  if (Precondition(index))
+    Activate(index);
+  else
+    SpreadActivation(index);
+  nodes_[index].state.activation_level *= ACTIVATION_FALLOFF;
+}
+
+// AndBehavior/ThenBehavior::IsDone: all children done, OrBehavior::IsDone:
+// any child done. Both write the result back into the state.
+bool TreeEvaluator::IsDone(uint32_t index) {
+  Node_t &node = nodes_[index];
+  if (IsLeaf(index))
+    return node.state.done;
+  ChildView_t *views = &child_views_[node.first_child];
+  if (node.mask.type == OR) {
+    for (uint32_t i = 0; i < node.num_children; ++i) {
+      if (views[i].done || views[i].peer_done) {
+        node.state.done = true;
+        return true;
+      }
+    }
+    node.state.done = false;
+    return false;
+  }
+  for (uint32_t i = 0; i < node.num_children; ++i) {
+    if (!(views[i].done || views[i].peer_done)) {
+      node.state.done = false;
+      return false;
+    }
+  }
+  node.state.done = true;
+  return true;
+}
+
+bool TreeEvaluator::IsActive(uint32_t index) const {
+  return nodes_[index].state.activation_level > ACTIVATION_THESH;
+}
+
+bool TreeEvaluator::Precondition(uint32_t index) {
+  Node_t &node = nodes_[index];
+  ChildView_t *views = node.num_children
+    ? &child_views_[node.first_child] : NULL;
+  if (node.mask.type == OR) {
+    for (uint32_t i = 0; i < node.num_children; ++i) {
+      if (views[i].done || views[i].peer_done) {
+        node.state.done = true;
+        return true;
+      }
+    }
+    return false;
+  }
+  for (uint32_t i = 0; i < node.num_children; ++i) {
+    if (!views[i].done)
+      return false;
+  }
+  return true;
+}
+
+// Node::Activate. The first call starts the peer check, the call after it
+// acts on the outcome, the same two ticks the PeerCheckThread round trip
+// takes when the check finishes between updates.
+void TreeEvaluator::Activate(uint32_t index) {
+  Node_t &node = nodes_[index];
+  if (!node.peer_checked) {
+    PeerCheck(index);
+    node.peer_checked = true;
+    return;
+  }
+  node.peer_checked = false;
+  if (node.state.peer_okay && !node.state.active && !node.state.done) {
+    node.state.active = true;
+    SendToPeers(index);
+    node.work_left = work_steps_;
+    if (node.work_left == 0)
+      FinishWork(index);
+  }
+  node.state.peer_okay = false;
+}
+
+// PeerCheckThread: announce to the peers, then refuse while a peer is active
+// or done, backing off the activation once per active peer
+void TreeEvaluator::PeerCheck(uint32_t index) {
+  Node_t &node = nodes_[index];
+  node.state.check_peer = true;
+  SendToPeers(index);
+  bool okay = true;
+  for (uint32_t i = 0; i < node.num_peers; ++i) {
+    if (node.state.peer_done) {
+      okay = false;
+    } else if (node.state.peer_active) {
+      okay = false;
+      node.state.activation_level *= ACTIVATION_FALLOFF;
+      node.state.activation_potential *= ACTIVATION_FALLOFF;
+    }
+  }
+  node.state.peer_okay = okay;
+  node.state.check_peer = false;
+}
+
+void TreeEvaluator::SpreadActivation(uint32_t index) {
+  Node_t &node = nodes_[index];
+  if (IsLeaf(index) || node.num_children == 0)
+    return;
+  ControlMessage_t msg = Message(index, 0);
+  msg.done = false;
+  uint32_t *children = &child_index_[node.first_child];
+  if (node.mask.type == THEN) {
+    // Pops at most one finished child per tick, like activation_queue_
+    if (node.then_next < node.num_children) {
+      const ChildView_t &front = child_views_[node.first_child
+        + node.then_next];
+      if (front.done || front.peer_done)
+        node.then_next++;
+    }
+    if (node.then_next < node.num_children) {
+      msg.activation_level = 100.0f;
+      ReceiveFromParent(children[node.then_next], msg);
+    }
+    return;
+  }
+  msg.activation_level = node.mask.type == AND
+    ? 100.0f / node.num_children : 100.0f;
+  for (uint32_t i = 0; i < node.num_children; ++i)
+    ReceiveFromParent(children[i], msg);
+}
+
+void TreeEvaluator::UpdateActivationPotential(uint32_t index) {
+  Node_t &node = nodes_[index];
+  State &state = node.state;
+  if (IsLeaf(index)) {
+    state.activation_potential = state.done ? 0.0f : node.leaf_potential;
+    return;
+  }
+  if (IsDone(index)) {
+    state.highest_potential = 0;
+    state.highest = node.mask;
+    return;
+  }
+  ChildView_t *views = node.num_children
+    ? &child_views_[node.first_child] : NULL;
+  NodeBitmask highest = node.mask;
+
+  if (node.mask.type == AND) {
+    // Highest potential among the children nobody works on yet
+    float best = -1;
+    for (uint32_t i = 0; i < node.num_children; ++i) {
+      const ChildView_t &view = views[i];
+      if (view.activation_potential > best && !view.done && !view.peer_done
+          && !view.peer_active && !view.active) {
+        best = view.activation_potential;
+        highest = view.highest;
+      }
+    }
+    state.activation_potential = best;
+    state.highest_potential = best;
+    state.highest = highest;
+    return;
+  }
+
+  if (node.mask.type == THEN) {
+    // First child not done yet
+    float best = 0;
+    for (uint32_t i = 0; i < node.num_children; ++i) {
+      const ChildView_t &view = views[i];
+      if (!view.done && !view.peer_done && !view.peer_active) {
+        best = view.activation_potential;
+        highest = view.highest;
+        break;
+      }
+    }
+    state.activation_potential = best;
+    state.highest_potential = best;
+    state.highest = highest;
+    return;
+  }
+
+  // OR: nothing to offer once a child or a child's peer took over
+  bool descendant_active = false;
+  for (uint32_t i = 0; i < node.num_children; ++i) {
+    if (views[i].peer_done || views[i].peer_active)
+      descendant_active = true;
+  }
+  if (descendant_active) {
+    for (uint32_t i = 0; i < node.num_children; ++i)
+      views[i].peer_active = true;
+    state.highest_potential = 0;
+    state.highest = node.mask;
+    return;
+  }
+  float best = 0;
+  for (uint32_t i = 0; i < node.num_children; ++i) {
+    const ChildView_t &view = views[i];
+    if (view.done || view.active) {
+      state.highest_potential = 0;
+      state.highest = node.mask;
+      return;
+    }
+    if (view.activation_potential > best) {
+      best = view.activation_potential;
+      highest = view.highest;
+    }
+  }
+  state.activation_potential = best;
+  state.highest_potential = best;
+  state.highest = highest;
+}
+
+// Node::PublishStatus, with every message delivered right away
+void TreeEvaluator::PublishStatus(uint32_t index) {
+  UpdateActivationPotential(index);
+  SendToParent(index);
+  SendToPeers(index);
+  SendToChildren(index);
+}
+
+void TreeEvaluator::SendToParent(uint32_t index) {
+  if (nodes_[index].parent < 0)
+    return;
+  ReceiveFromChild(index, Message(index, 0));
+}
+
+void TreeEvaluator::SendToPeers(uint32_t index) {
+  const Node_t &node = nodes_[index];
+  if (node.num_peers == 0)
+    return;
+  ControlMessage_t msg = Message(index, 0);
+  for (uint32_t i = 0; i < node.num_peers; ++i)
+    ReceiveFromPeer(peer_index_[node.first_peer + i], msg);
+}
+
+void TreeEvaluator::SendToChildren(uint32_t index) {
+  const Node_t &node = nodes_[index];
+  if (node.num_children == 0)
+    return;
+  ControlMessage_t msg = Message(index, 1);
+  for (uint32_t i = 0; i < node.num_children; ++i)
+    ReceiveFromParent(child_index_[node.first_child + i], msg);
+}
+
+void TreeEvaluator::ReceiveFromParent(uint32_t index,
+    const ControlMessage_t &msg) {
+  Node_t &node = nodes_[index];
+  if (msg.type == 0)
+    node.state.activation_level = msg.activation_level;
+  if (msg.done) {
+    node.parent_done = true;
+    node.state.active = false;
+  }
+}
+
+void TreeEvaluator::ReceiveFromChild(uint32_t index,
+    const ControlMessage_t &msg) {
+  ChildView_t &view = child_views_[nodes_[index].parent_slot];
+  view.activation_level = msg.activation_level;
+  view.activation_potential = msg.activation_potential;
+  view.highest = msg.highest;
+  view.done = msg.done;
+  view.active = msg.active;
+}
+
+// Node::ReceiveFromPeers: peers under an OR keep the flags once set
+void TreeEvaluator::ReceiveFromPeer(uint32_t index,
+    const ControlMessage_t &msg) {
+  State &state = nodes_[index].state;
+  if (msg.parent_type == OR) {
+    state.peer_active = msg.active || state.peer_active;
+    state.peer_done = msg.done || state.peer_done;
+  } else {
+    state.peer_active = msg.active;
+    state.peer_done = msg.done;
+  }
+  state.done = state.done || state.peer_done;
+}
+
+ControlMessage_t TreeEvaluator::Message(uint32_t index, int type) const {
+  const State &state = nodes_[index].state;
+  ControlMessage_t msg;
+  memset(&msg, 0, sizeof(msg));
+  msg.sender = nodes_[index].mask;
+  msg.type = type;
+  msg.activation_level = state.activation_level;
+  msg.activation_potential = state.activation_potential;
+  msg.done = state.done;
+  msg.active = state.active;
+  msg.highest = state.highest;
+  msg.parent_type = state.parent_type;
+  return msg;
+}
+
+// Node::RunWork after a successful Work()
+void TreeEvaluator::FinishWork(uint32_t index) {
+  Node_t &node = nodes_[index];
+  node.work_left = 0;
+  node.state.active = false;
+  node.state.done = true;
+  SendToParent(index);
+  SendToPeers(index);
+}
+
+bool TreeEvaluator::IsLeaf(uint32_t index) const {
+  uint8_t type = nodes_[index].mask.type;
+  return type != THEN && type != OR && type != AND;
+}
+}  // namespace task_net
@@ -0,0 +1,155 @@
+/*
+robotics-task-tree-eval
+Copyright (C) 2015  Luke Fraser
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#include "robotics_task_tree_eval/work_executor.h"
+#include <ros/ros.h>
+#include <boost/bind.hpp>
+
+namespace task_net {
+
+WorkExecutor *WorkExecutor::instance_ = NULL;
+boost::mutex WorkExecutor::instance_mut_;
+
+WorkExecutor* WorkExecutor::Configure(uint32_t max_concurrent,
+    boost::posix_time::time_duration report_period) {
+  boost::lock_guard<boost::mutex> lock(instance_mut_);
+  if (!instance_) {
+    if (max_concurrent == 0)
+      max_concurrent = 1;
+    instance_ = new WorkExecutor(max_concurrent, report_period);
+    ROS_INFO("WorkExecutor started, running at most %u works at once",
+      max_concurrent);
+  }
+  return instance_;
+}
+
+WorkExecutor* WorkExecutor::Instance() {
+  boost::lock_guard<boost::mutex> lock(instance_mut_);
+  return instance_;
+}
+
+WorkExecutor::WorkExecutor(uint32_t max_concurrent,
+    boost::posix_time::time_duration report_period)
+    : running_(0), submitted_(0), completed_(0), total_wait_ms_(0.0),
+      max_wait_ms_(0.0), total_run_ms_(0.0), max_run_ms_(0.0),
+      max_concurrent_(max_concurrent), report_period_(report_period) {
+  for (uint32_t i = 0; i < max_concurrent_; ++i) {
+    workers_.create_thread(boost::bind(&WorkExecutor::WorkerLoop, this));
+  }
+  if (report_period_ > boost::posix_time::time_duration())
+    workers_.create_thread(boost::bind(&WorkExecutor::ReportLoop, this));
+}
+
+WorkExecutor::~WorkExecutor() {
+  workers_.interrupt_all();
+  workers_.join_all();
+}
+
+void WorkExecutor::Submit(Job job) {
+  QueuedJob queued;
+  queued.job = job;
+  queued.submitted = boost::posix_time::microsec_clock::universal_time();
+  {
+    boost::lock_guard<boost::mutex> lock(mut_);
+    queue_.push_back(queued);
+    submitted_++;
+  }
+  cv_.notify_one();
+}
+
+size_t WorkExecutor::QueueDepth() {
+  boost::lock_guard<boost::mutex> lock(mut_);
+  return queue_.size();
+}
+
+WorkExecutor::Stats WorkExecutor::GetStats() {
+  boost::lock_guard<boost::mutex> lock(mut_);
+  Stats stats;
+  stats.queued = queue_.size();
+  stats.running = running_;
+  stats.submitted = submitted_;
+  stats.completed = completed_;
+  stats.mean_wait_ms = completed_ ? total_wait_ms_ / completed_ : 0.0;
+  stats.max_wait_ms = max_wait_ms_;
+  stats.mean_run_ms = completed_ ? total_run_ms_ / completed_ : 0.0;
+  stats.max_run_ms = max_run_ms_;
+  return stats;
+}
+
+uint32_t WorkExecutor::MaxConcurrent() const {
+  return max_concurrent_;
+}
+
+void WorkExecutor::Report() {
+  Stats stats = GetStats();
+  ROS_INFO("WorkExecutor: %zu queued, %zu running of %u, %lu of %lu done, "
+    "wait mean %.1f ms max %.1f ms, run mean %.1f ms max %.1f ms",
+    stats.queued, stats.running, max_concurrent_,
+    static_cast<unsigned long>(stats.completed),
+    static_cast<unsigned long>(stats.submitted), stats.mean_wait_ms,
+    stats.max_wait_ms, stats.mean_run_ms, stats.max_run_ms);
+}
+
+void WorkExecutor::ReportLoop(WorkExecutor *executor) {
+  while (true) {
+    boost::this_thread::sleep(executor->report_period_);
+    executor->Report();
+  }
+}
+
+void WorkExecutor::WorkerLoop(WorkExecutor *executor) {
+  while (true) {
+    QueuedJob queued;
+    boost::posix_time::ptime started;
+    {
+      boost::unique_lock<boost::mutex> lock(executor->mut_);
+      while (executor->queue_.empty())
+        executor->cv_.wait(lock);
+      queued = executor->queue_.front();
+      executor->queue_.pop_front();
+      executor->running_++;
+      started = boost::posix_time::microsec_clock::universal_time();
+    }
+
+    try {
+      queued.job();
+    }
+    catch (boost::thread_interrupted&) {
+      throw;
+    }
+    catch (std::exception &e) {
+      ROS_ERROR("WorkExecutor: work threw exception: %s", e.what());
+    }
+
+    boost::posix_time::ptime finished =
+      boost::posix_time::microsec_clock::universal_time();
+    double wait_ms = (started - queued.submitted).total_microseconds() / 1000.0;
+    double run_ms = (finished - started).total_microseconds() / 1000.0;
+    boost::lock_guard<boost::mutex> lock(executor->mut_);
+    executor->running_--;
+    executor->completed_++;
+    executor->total_wait_ms_ += wait_ms;
+    executor->total_run_ms_ += run_ms;
+    if (wait_ms > executor->max_wait_ms_)
+      executor->max_wait_ms_ = wait_ms;
+    if (run_ms > executor->max_run_ms_)
+      executor->max_run_ms_ = run_ms;
+    ROS_DEBUG("WorkExecutor: work waited %.1f ms, ran %.1f ms, %zu queued",
+      wait_ms, run_ms, executor->queue_.size());
+  }
+}
+}  // namespace task_net
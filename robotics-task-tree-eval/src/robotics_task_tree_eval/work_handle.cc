@@ -0,0 +1,256 @@
+/*
+robotics-task-tree-eval
+Copyright (C) 2015  Luke Fraser
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#include "robotics_task_tree_eval/work_handle.h"
+#include <ros/ros.h>
+#include <boost/bind.hpp>
+#include "remote_mutex/sim_clock.h"
+#include "robotics_task_tree_eval/node_executor.h"
+
+#define SUPERVISE_PERIOD_MS 10
+
+namespace task_net {
+
+////////////////////////////////////////////////////////////////////////////////
+// CancellationToken
+////////////////////////////////////////////////////////////////////////////////
+CancellationToken::CancellationToken() : cancelled_(false) {}
+
+void CancellationToken::Cancel() {
+  {
+    boost::lock_guard<boost::mutex> lock(mut_);
+    cancelled_ = true;
+  }
+  cv_.notify_all();
+}
+
+bool CancellationToken::IsCancelled() {
+  boost::lock_guard<boost::mutex> lock(mut_);
+  return cancelled_;
+}
+
+bool CancellationToken::WaitFor(boost::posix_time::time_duration duration) {
+  boost::posix_time::ptime deadline = mutex::SimClock::Now() + duration;
+  boost::unique_lock<boost::mutex> lock(mut_);
+  while (!cancelled_) {
+    if (!mutex::SimClock::TimedWait(cv_, lock, deadline))
+      break;
+  }
+  return cancelled_;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// WorkHandle
+////////////////////////////////////////////////////////////////////////////////
+WorkHandle::WorkHandle()
+    : token_(new CancellationToken), result_(WORK_RUNNING), progress_(0.0f) {}
+
+CancellationTokenPtr WorkHandle::Token() {
+  return token_;
+}
+
+void WorkHandle::Cancel() {
+  token_->Cancel();
+}
+
+bool WorkHandle::IsCancelled() {
+  return token_->IsCancelled();
+}
+
+void WorkHandle::ReportProgress(float progress) {
+  std::vector<ProgressCallback> callbacks;
+  {
+    boost::lock_guard<boost::mutex> lock(mut_);
+    progress_ = progress;
+    callbacks = progress_callbacks_;
+  }
+  for (size_t i = 0; i < callbacks.size(); ++i)
+    callbacks[i](progress);
+}
+
+float WorkHandle::Progress() {
+  boost::lock_guard<boost::mutex> lock(mut_);
+  return progress_;
+}
+
+void WorkHandle::OnProgress(ProgressCallback callback) {
+  boost::lock_guard<boost::mutex> lock(mut_);
+  progress_callbacks_.push_back(callback);
+}
+
+void WorkHandle::OnComplete(CompletionCallback callback) {
+  Result result;
+  {
+    boost::lock_guard<boost::mutex> lock(mut_);
+    if (result_ == WORK_RUNNING) {
+      completion_callbacks_.push_back(callback);
+      return;
+    }
+    result = result_;
+  }
+  callback(result);
+}
+
+void WorkHandle::Complete(Result result) {
+  std::vector<CompletionCallback> callbacks;
+  {
+    boost::lock_guard<boost::mutex> lock(mut_);
+    if (result_ != WORK_RUNNING)
+      return;
+    result_ = result;
+    callbacks.swap(completion_callbacks_);
+  }
+  cv_.notify_all();
+  for (size_t i = 0; i < callbacks.size(); ++i)
+    callbacks[i](result);
+}
+
+bool WorkHandle::Done() {
+  boost::lock_guard<boost::mutex> lock(mut_);
+  return result_ != WORK_RUNNING;
+}
+
+WorkHandle::Result WorkHandle::GetResult() {
+  boost::lock_guard<boost::mutex> lock(mut_);
+  return result_;
+}
+
+WorkHandle::Result WorkHandle::Wait() {
+  boost::unique_lock<boost::mutex> lock(mut_);
+  while (result_ == WORK_RUNNING)
+    cv_.wait(lock);
+  return result_;
+}
+
+bool WorkHandle::WaitFor(boost::posix_time::time_duration duration) {
+  boost::posix_time::ptime deadline = mutex::SimClock::Now() + duration;
+  boost::unique_lock<boost::mutex> lock(mut_);
+  while (result_ == WORK_RUNNING) {
+    if (!mutex::SimClock::TimedWait(cv_, lock, deadline))
+      break;
+  }
+  return result_ != WORK_RUNNING;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// WorkSupervisor
+////////////////////////////////////////////////////////////////////////////////
+WorkSupervisor *WorkSupervisor::instance_ = NULL;
+boost::mutex WorkSupervisor::instance_mut_;
+
+WorkSupervisor* WorkSupervisor::Instance() {
+  boost::lock_guard<boost::mutex> lock(instance_mut_);
+  if (!instance_)
+    instance_ = new WorkSupervisor();
+  return instance_;
+}
+
+WorkSupervisor::WorkSupervisor()
+    : task_scheduled_(false),
+      period_(boost::posix_time::millisec(SUPERVISE_PERIOD_MS)),
+      supervise_thread_(NULL) {
+  executor_ = NodeExecutor::Instance();
+  if (!executor_)
+    supervise_thread_ = new boost::thread(&SuperviseThread, this);
+}
+
+WorkSupervisor::~WorkSupervisor() {
+  if (supervise_thread_) {
+    supervise_thread_->interrupt();
+    supervise_thread_->join();
+    delete supervise_thread_;
+  }
+}
+
+void WorkSupervisor::Watch(WorkHandlePtr handle, CheckFunction check) {
+  Watch_t watch;
+  watch.handle = handle;
+  watch.check = check;
+  bool schedule = false;
+  {
+    boost::lock_guard<boost::mutex> lock(mut_);
+    watched_.push_back(watch);
+    if (executor_ && !task_scheduled_) {
+      task_scheduled_ = true;
+      schedule = true;
+    }
+  }
+  if (schedule)
+    executor_->PostAfter(period_, boost::bind(&SuperviseTask, this));
+  else if (!executor_)
+    cv_.notify_one();
+}
+
+size_t WorkSupervisor::Watched() {
+  boost::lock_guard<boost::mutex> lock(mut_);
+  return watched_.size();
+}
+
+// Checks run without the lock held since CheckWork may call ROS services.
+// A failed check cancels the work; the work runner then undoes it.
+bool WorkSupervisor::CheckAll() {
+  std::vector<Watch_t> watched;
+  {
+    boost::lock_guard<boost::mutex> lock(mut_);
+    watched = watched_;
+  }
+  for (size_t i = 0; i < watched.size(); ++i) {
+    WorkHandlePtr handle = watched[i].handle;
+    if (handle->Done() || handle->IsCancelled())
+      continue;
+    if (!watched[i].check()) {
+      ROS_DEBUG("WorkSupervisor: check failed, cancelling work");
+      handle->Cancel();
+    }
+  }
+
+  boost::lock_guard<boost::mutex> lock(mut_);
+  std::vector<Watch_t> running;
+  for (size_t i = 0; i < watched_.size(); ++i) {
+    if (!watched_[i].handle->Done() && !watched_[i].handle->IsCancelled())
+      running.push_back(watched_[i]);
+  }
+  watched_.swap(running);
+  return !watched_.empty();
+}
+
+void WorkSupervisor::SuperviseThread(WorkSupervisor *supervisor) {
+  mutex::SimClock::Client client;
+  while (true) {
+    {
+      boost::unique_lock<boost::mutex> lock(supervisor->mut_);
+      while (supervisor->watched_.empty())
+        mutex::SimClock::Wait(supervisor->cv_, lock);
+    }
+    supervisor->CheckAll();
+    mutex::SimClock::Sleep(supervisor->period_);
+  }
+}
+
+void WorkSupervisor::SuperviseTask(WorkSupervisor *supervisor) {
+  if (!supervisor->CheckAll()) {
+    boost::lock_guard<boost::mutex> lock(supervisor->mut_);
+    // Watch() may have added work after CheckAll() looked
+    if (supervisor->watched_.empty()) {
+      supervisor->task_scheduled_ = false;
+      return;
+    }
+  }
+  supervisor->executor_->PostAfter(supervisor->period_,
+    boost::bind(&SuperviseTask, supervisor));
+}
+}  // namespace task_net
@@ -0,0 +1,369 @@
+/*
+robotics-task-tree-eval
+Copyright (C) 2015  Luke Fraser
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+// Scalability benchmark for one robot of a task tree. Runs the robot's
+// THEN/AND/OR nodes with leaves whose Work() finishes immediately, drives
+// the robot's top node the way a ROOT parent would, and reports completion
+// time, per level decision latency, message rates, threads, RSS and CPU.
+// Trees come from scripts/generate_task_tree.py and several processes are
+// started by scripts/run_task_tree_benchmark.py.
+#include <ros/ros.h>
+#include <boost/date_time.hpp>
+#include <boost/bind.hpp>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <fstream>
+#include <map>
+#include <string>
+#include <vector>
+#include "robotics_task_tree_eval/behavior.h"
+#include "robotics_task_tree_msgs/State.h"
+
+#define DRIVER_RATE_HZ 100
+// /proc is read every N driver ticks so the sampling barely shows up in CPU
+#define SAMPLE_EVERY_TICKS 10
+#define DEFAULT_STARTUP_DELAY_MS 5500
+
+namespace task_net {
+// Leaf behavior with no robot behind it: always suitable, no preconditions
+// and Work() returns at once
+class InstantBehavior: public Behavior {
+ public:
+  InstantBehavior(NodeId_t name, NodeList peers, NodeList children,
+    NodeId_t parent, State_t state)
+    : Behavior(name, peers, children, parent, state, "N/A") {}
+  void UpdateActivationPotential() {
+    state_.activation_potential = state_.done ? 0.0f : 1.0f;
+  }
+  bool ActivationPrecondition() { return true; }
+  void Work() {}
+ protected:
+  virtual bool Precondition() { return true; }
+  virtual uint32_t SpreadActivation() { return 0; }
+};
+}  // namespace task_net
+
+struct NodeStats_t {
+  std::string parent;
+  int level;
+  boost::posix_time::ptime active;
+  boost::posix_time::ptime done;
+};
+
+struct ProcessSample_t {
+  int threads;
+  long rss_kb;
+  double cpu_s;
+};
+
+// Written by the state callbacks on the spinner thread
+static std::map<std::string, NodeStats_t> node_stats;
+static boost::mutex stats_mut;
+
+static ProcessSample_t SampleProcess() {
+  ProcessSample_t sample = {0, 0, 0.0};
+  std::ifstream status("/proc/self/status");
+  std::string line;
+  while (std::getline(status, line)) {
+    if (line.compare(0, 8, "Threads:") == 0)
+      sample.threads = atoi(line.c_str() + 8);
+    else if (line.compare(0, 6, "VmRSS:") == 0)
+      sample.rss_kb = atol(line.c_str() + 6);
+  }
+  // utime and stime are fields 14 and 15, after the parenthesised comm
+  std::ifstream stat("/proc/self/stat");
+  std::getline(stat, line);
+  size_t end = line.rfind(')');
+  if (end != std::string::npos) {
+    unsigned long utime = 0, stime = 0;
+    if (sscanf(line.c_str() + end + 2,
+        "%*c %*d %*d %*d %*d %*d %*u %*u %*u %*u %*u %lu %lu",
+        &utime, &stime) == 2)
+      sample.cpu_s = static_cast<double>(utime + stime) / sysconf(_SC_CLK_TCK);
+  }
+  return sample;
+}
+
+static void StateCallback(const std::string &name,
+    const robotics_task_tree_msgs::State::ConstPtr &msg) {
+  boost::lock_guard<boost::mutex> lock(stats_mut);
+  NodeStats_t &stats = node_stats[name];
+  boost::posix_time::ptime now =
+    boost::posix_time::microsec_clock::universal_time();
+  if ((msg->active || msg->done) && stats.active.is_not_a_date_time())
+    stats.active = now;
+  if (msg->done && stats.done.is_not_a_date_time())
+    stats.done = now;
+}
+
+int main(int argc, char *argv[]) {
+  ros::init(argc, argv, "task_tree_benchmark");
+  ros::NodeHandle nh_("~");
+  ros::NodeHandle pub_nh;
+
+  std::vector<std::string> nodes;
+  if (!nh_.getParam("NodeList", nodes)) {
+    ROS_ERROR("No NodeList param, load a tree from generate_task_tree.py");
+    return 1;
+  }
+  int robot, startup_delay_ms;
+  double activation_rate_hz, timeout_s;
+  std::string results_file;
+  nh_.param<int>("robot", robot, 0);
+  nh_.param<double>("activation_rate_hz", activation_rate_hz,
+    1000.0 / BEHAVIOR_SLEEP_TIME);
+  nh_.param<double>("timeout_s", timeout_s, 600.0);
+  nh_.param<int>("startup_delay_ms", startup_delay_ms,
+    DEFAULT_STARTUP_DELAY_MS);
+  nh_.param<std::string>("results_file", results_file, "");
+
+  std::string prefix = "Nodes/";
+  std::vector<task_net::Node*> network;
+  std::vector<ros::Subscriber> state_subs;
+  std::string top;
+  for (size_t i = 0; i < nodes.size(); ++i) {
+    int node_robot, type;
+    if (!nh_.getParam(prefix + nodes[i] + "/mask/robot", node_robot)
+        || node_robot != robot)
+      continue;
+    nh_.getParam(prefix + nodes[i] + "/mask/type", type);
+    if (type == task_net::ROOT)
+      continue;
+
+    task_net::NodeId_t name, parent;
+    task_net::NodeList children, peers;
+    std::vector<std::string> names;
+    name.topic = nodes[i];
+    nh_.getParam(prefix + nodes[i] + "/parent", parent.topic);
+    if (nh_.getParam(prefix + nodes[i] + "/children", names)) {
+      for (size_t j = 0; j < names.size(); ++j) {
+        task_net::NodeId_t child;
+        child.topic = names[j];
+        child.pub = NULL;
+        children.push_back(child);
+      }
+    }
+    names.clear();
+    if (nh_.getParam(prefix + nodes[i] + "/peers", names)) {
+      for (size_t j = 0; j < names.size(); ++j) {
+        if (names[j] == "NONE")
+          continue;
+        task_net::NodeId_t peer;
+        peer.topic = names[j];
+        peer.pub = NULL;
+        peers.push_back(peer);
+      }
+    }
+
+    task_net::State_t state;
+    switch (type) {
+      case task_net::THEN:
+        network.push_back(new task_net::ThenBehavior(name, peers, children,
+          parent, state, "N/A"));
+        break;
+      case task_net::OR:
+        network.push_back(new task_net::OrBehavior(name, peers, children,
+          parent, state, "N/A"));
+        break;
+      case task_net::AND:
+        network.push_back(new task_net::AndBehavior(name, peers, children,
+          parent, state, "N/A"));
+        break;
+      default:
+        network.push_back(new task_net::InstantBehavior(name, peers, children,
+          parent, state));
+        break;
+    }
+
+    node_stats[nodes[i]].parent = parent.topic;
+    state_subs.push_back(pub_nh.subscribe<robotics_task_tree_msgs::State>(
+      nodes[i] + "_state", 100, boost::bind(&StateCallback, nodes[i], _1)));
+    int parent_type;
+    if (nh_.getParam(prefix + parent.topic + "/mask/type", parent_type)
+        && parent_type == task_net::ROOT)
+      top = nodes[i];
+  }
+  if (top.empty()) {
+    ROS_ERROR("Robot %d has no node below a ROOT node", robot);
+    return 1;
+  }
+
+  // Depth below the top node, following parent links
+  int depth = 0;
+  for (std::map<std::string, NodeStats_t>::iterator it = node_stats.begin();
+      it != node_stats.end(); ++it) {
+    int level = 0;
+    std::string name = it->first;
+    while (name != top && node_stats.count(name) && level <= nodes.size()) {
+      name = node_stats[name].parent;
+      level++;
+    }
+    it->second.level = level;
+    if (level > depth)
+      depth = level;
+  }
+  task_net::ReadinessBarrier::NodesCreated();
+  ros::AsyncSpinner spinner(1);
+  spinner.start();
+  ROS_INFO("Benchmark robot %d: %zu nodes, depth %d, top %s", robot,
+    network.size(), depth, top.c_str());
+
+  // The ROOT node is not run by anyone; stand in for it
+  ros::Publisher activate_pub =
+    pub_nh.advertise<robotics_task_tree_msgs::ControlMessage>(top + "_parent",
+      10);
+  task_net::ControlMessagePtr_t activate(new task_net::ControlMessage_t());
+  activate->type = 0;
+  activate->activation_level = 1.0f;
+
+  task_net::ReadinessBarrier *barrier = task_net::ReadinessBarrier::Instance();
+  ros::Rate rate(DRIVER_RATE_HZ);
+  boost::posix_time::ptime ready_wait =
+    boost::posix_time::microsec_clock::universal_time()
+    + boost::posix_time::millisec(startup_delay_ms);
+  while (ros::ok()) {
+    if (barrier ? barrier->Released()
+        : boost::posix_time::microsec_clock::universal_time() > ready_wait)
+      break;
+    rate.sleep();
+  }
+
+  ProcessSample_t start_sample = SampleProcess();
+  ProcessSample_t peak = start_sample;
+  uint64_t start_messages = task_net::Node::MessagesSent();
+  uint64_t start_published = task_net::Node::MessagesPublished();
+  uint64_t start_suppressed = task_net::Node::PublishesSuppressed();
+  boost::posix_time::ptime start =
+    boost::posix_time::microsec_clock::universal_time();
+  boost::posix_time::ptime last_activate;
+  boost::posix_time::time_duration activate_period =
+    boost::posix_time::microseconds(
+      static_cast<int64_t>(1e6 / activation_rate_hz));
+  bool completed = false;
+  uint32_t ticks = 0;
+  while (ros::ok()) {
+    boost::posix_time::ptime now =
+      boost::posix_time::microsec_clock::universal_time();
+    if (last_activate.is_not_a_date_time()
+        || now - last_activate >= activate_period) {
+      activate_pub.publish(activate);
+      last_activate = now;
+    }
+    if (++ticks % SAMPLE_EVERY_TICKS == 0) {
+      ProcessSample_t sample = SampleProcess();
+      if (sample.threads > peak.threads)
+        peak.threads = sample.threads;
+      if (sample.rss_kb > peak.rss_kb)
+        peak.rss_kb = sample.rss_kb;
+    }
+    {
+      boost::lock_guard<boost::mutex> lock(stats_mut);
+      completed = !node_stats[top].done.is_not_a_date_time();
+    }
+    if (completed)
+      break;
+    if ((now - start).total_milliseconds() > timeout_s * 1000.0)
+      break;
+    rate.sleep();
+  }
+
+  spinner.stop();
+  boost::posix_time::ptime end = completed ? node_stats[top].done
+    : boost::posix_time::microsec_clock::universal_time();
+  double elapsed_s = (end - start).total_microseconds() / 1e6;
+  ProcessSample_t end_sample = SampleProcess();
+  double cpu_percent = elapsed_s > 0.0
+    ? 100.0 * (end_sample.cpu_s - start_sample.cpu_s) / elapsed_s : 0.0;
+  // Control messages the nodes sent, and what actually went out over ROS
+  double messages_per_s = elapsed_s > 0.0
+    ? (task_net::Node::MessagesSent() - start_messages) / elapsed_s : 0.0;
+  double published_per_s = elapsed_s > 0.0
+    ? (task_net::Node::MessagesPublished() - start_published) / elapsed_s
+    : 0.0;
+
+  // Decision latency: time from a node's parent becoming active to the node
+  // becoming active, averaged per level
+  std::vector<double> level_sum(depth + 1, 0.0);
+  std::vector<double> level_max(depth + 1, 0.0);
+  std::vector<int> level_count(depth + 1, 0);
+  for (std::map<std::string, NodeStats_t>::iterator it = node_stats.begin();
+      it != node_stats.end(); ++it) {
+    NodeStats_t &stats = it->second;
+    if (stats.level == 0 || stats.active.is_not_a_date_time()
+        || !node_stats.count(stats.parent)
+        || node_stats[stats.parent].active.is_not_a_date_time())
+      continue;
+    double latency_ms =
+      (stats.active - node_stats[stats.parent].active).total_microseconds()
+      / 1000.0;
+    level_sum[stats.level] += latency_ms;
+    level_count[stats.level]++;
+    if (latency_ms > level_max[stats.level])
+      level_max[stats.level] = latency_ms;
+  }
+
+  printf("==== task tree benchmark, robot %d ====\n", robot);
+  printf("nodes:              %zu (depth %d)\n", network.size(), depth);
+  printf("completed:          %s\n", completed ? "yes" : "NO (timeout)");
+  printf("time to completion: %.3f s\n", elapsed_s);
+  printf("messages/s:         %.1f sent, %.1f published\n", messages_per_s,
+    published_per_s);
+  printf("state publishes:    %lu suppressed as unchanged\n",
+    static_cast<unsigned long>(task_net::Node::PublishesSuppressed()
+      - start_suppressed));
+  if (task_net::BatchTransport *batch = task_net::BatchTransport::Instance()) {
+    printf("batches:            %lu carrying %lu messages\n",
+      static_cast<unsigned long>(batch->BatchesSent()),
+      static_cast<unsigned long>(batch->MessagesSent()));
+  }
+  printf("threads (peak):     %d\n", peak.threads);
+  printf("RSS (peak):         %ld kB\n", peak.rss_kb);
+  printf("CPU:                %.1f %%\n", cpu_percent);
+  if (task_net::WorkExecutor *work = task_net::WorkExecutor::Instance()) {
+    task_net::WorkExecutor::Stats stats = work->GetStats();
+    printf("work queue:         %zu queued, %zu running, %lu of %lu done\n",
+      stats.queued, stats.running,
+      static_cast<unsigned long>(stats.completed),
+      static_cast<unsigned long>(stats.submitted));
+    printf("work wait:          mean %.1f ms, max %.1f ms\n",
+      stats.mean_wait_ms, stats.max_wait_ms);
+    printf("work run:           mean %.1f ms, max %.1f ms\n",
+      stats.mean_run_ms, stats.max_run_ms);
+  }
+  std::string levels;
+  for (int level = 1; level <= depth; ++level) {
+    double mean = level_count[level] ? level_sum[level] / level_count[level]
+      : 0.0;
+    printf("level %2d latency:   mean %.1f ms, max %.1f ms (%d nodes)\n",
+      level, mean, level_max[level], level_count[level]);
+    char buffer[32];
+    snprintf(buffer, sizeof(buffer), "%s%.1f", level > 1 ? ";" : "", mean);
+    levels += buffer;
+  }
+
+  if (!results_file.empty()) {
+    std::ofstream results(results_file.c_str(), std::ios::app);
+    results << robot << "," << network.size() << "," << depth << ","
+      << completed << "," << elapsed_s << "," << messages_per_s << ","
+      << published_per_s << ","
+      << peak.threads << "," << peak.rss_kb << "," << cpu_percent << ","
+      << levels << "\n";
+  }
+  ros::shutdown();
+  return completed ? 0 : 2;
+}
@@ -0,0 +1,105 @@
+/*
+robotics-task-tree-eval
+Copyright (C) 2015  Luke Fraser
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+// Offline run of a task tree file with the TreeEvaluator, no ROS master
+// needed. Prints when every node became active and done, and can append
+// the per node result as CSV for parameter sweeps:
+//
+//   task_tree_evaluator test_network_THEN.yaml --work_steps 5
+//     --potential PLACE_5_0_001=0.5 --csv sweep.csv
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fstream>
+#include <string>
+#include "robotics_task_tree_eval/tree_evaluator.h"
+
+#define DEFAULT_MAX_STEPS 100000
+
+static void Usage(const char *name) {
+  fprintf(stderr, "usage: %s <tree.yaml> [--max_steps N] [--work_steps N]"
+    " [--top_activation X] [--default_potential X]"
+    " [--potential NODE=X]... [--csv FILE]\n", name);
+}
+
+int main(int argc, char *argv[]) {
+  if (argc < 2) {
+    Usage(argv[0]);
+    return 1;
+  }
+  task_net::TreeEvaluator evaluator;
+  if (!evaluator.Load(argv[1]))
+    return 1;
+
+  uint32_t max_steps = DEFAULT_MAX_STEPS;
+  std::string csv_file;
+  for (int i = 2; i < argc; ++i) {
+    std::string arg = argv[i];
+    if (i + 1 >= argc) {
+      Usage(argv[0]);
+      return 1;
+    }
+    const char *value = argv[++i];
+    if (arg == "--max_steps") {
+      max_steps = strtoul(value, NULL, 10);
+    } else if (arg == "--work_steps") {
+      evaluator.SetWorkSteps(strtoul(value, NULL, 10));
+    } else if (arg == "--top_activation") {
+      evaluator.SetTopActivation(atof(value));
+    } else if (arg == "--default_potential") {
+      evaluator.SetDefaultLeafPotential(atof(value));
+    } else if (arg == "--potential") {
+      const char *eq = strchr(value, '=');
+      if (!eq || !evaluator.SetLeafPotential(std::string(value, eq - value),
+          atof(eq + 1))) {
+        fprintf(stderr, "unknown node in --potential %s\n", value);
+        return 1;
+      }
+    } else if (arg == "--csv") {
+      csv_file = value;
+    } else {
+      Usage(argv[0]);
+      return 1;
+    }
+  }
+
+  uint32_t steps = evaluator.Run(max_steps);
+  bool completed = evaluator.Done();
+  printf("==== task tree evaluator: %s ====\n", argv[1]);
+  printf("nodes:     %zu\n", evaluator.Size());
+  printf("completed: %s\n", completed ? "yes" : "NO (max_steps)");
+  printf("steps:     %u\n", steps);
+  printf("%-24s %8s %8s %10s %10s\n", "node", "active", "done", "level",
+    "potential");
+  for (size_t i = 0; i < evaluator.Size(); ++i) {
+    const task_net::TreeEvaluator::Node_t &node = evaluator.GetNode(i);
+    printf("%-24s %8d %8d %10.3f %10.3f\n", node.name.c_str(),
+      node.active_step, node.done_step, node.state.activation_level,
+      node.state.activation_potential);
+  }
+
+  if (!csv_file.empty()) {
+    std::ofstream csv(csv_file.c_str(), std::ios::app);
+    for (size_t i = 0; i < evaluator.Size(); ++i) {
+      const task_net::TreeEvaluator::Node_t &node = evaluator.GetNode(i);
+      csv << argv[1] << "," << node.name << "," << node.leaf_potential << ","
+        << node.active_step << "," << node.done_step << "," << steps << ","
+        << completed << "\n";
+    }
+  }
+  return completed ? 0 : 2;
+}
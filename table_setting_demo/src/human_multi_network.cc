@@ -210,6 +210,8 @@ std::vector<float> object_pos;
       // printf("MADE 5\n");
     }
   }
+  // All nodes of this process exist, let the readiness barrier report
+  task_net::ReadinessBarrier::NodesCreated();
   printf("Now spinning!\n");
   ros::spin();
   return 0;
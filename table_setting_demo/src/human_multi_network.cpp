@@ -217,6 +217,8 @@ int main(int argc, char *argv[]) {
       // printf("MADE 5\n");
     }
   }
+  // All nodes of this process exist, let the readiness barrier report
+  task_net::ReadinessBarrier::NodesCreated();
   printf("Now spinning!\n");
   ros::spin();
   return 0;
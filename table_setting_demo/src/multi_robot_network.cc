@@ -202,6 +202,8 @@ int main(int argc, char *argv[]) {
       // printf("MADE 5\n");
     }
   }
+  // All nodes of this process exist, let the readiness barrier report
+  task_net::ReadinessBarrier::NodesCreated();
   printf("MADE 6 - now spinning\n");
   ros::spin();
   return 0;
@@ -16,6 +16,7 @@ You should have received a copy of the GNU General Public License
 along with this program.  If not, see <http://www.gnu.org/licenses/>.
 */
 #include <cmath>
+#include <boost/bind.hpp>
 #include "table_setting_demo/log.h"
 #include "table_setting_demo/table_object_behavior.h"
 #include "geometry_msgs/PoseStamped.h"
@@ -141,7 +142,9 @@ TableObject::TableObject(NodeId_t name, NodeList peers, NodeList children,
 
   // debugging - declare publisher for manip markers
   marker_pub_ = nh_.advertise<visualization_msgs::Marker>("/markers",1000);
-  sleep(3);
+  // with the readiness barrier nothing runs before the connections are up
+  if (!barrier_)
+    sleep(3);
   ready_to_publish_ = true;
 
 }
@@ -304,7 +307,10 @@ bool TableObject::Precondition() {
   return true;
 }
 bool TableObject::ActivationPrecondition() {
-  return mut.Lock(state_.activation_potential);
+  // Asked again every update tick while the request waits in the mutex
+  // service queue, dropped once a peer claims the node
+  return mut.PollLock(state_.activation_potential,
+    boost::bind(&TableObject::Claimed, this));
 }
 
 bool TableObject::PickAndPlaceDone() {
@@ -320,8 +326,12 @@ void TableObject::Work() {
   table_setting_demo::object_position pos_msg;
     pos_msg.request.object_id = object_;
     bool tracked = false;
-    boost::this_thread::sleep(boost::posix_time::millisec(1000));
+    // Cancelled work returns early; UndoWork releases the mutex
+    if (WorkCancelled(boost::posix_time::millisec(1000)))
+      return;
     while (!tracked) {
+      if (WorkCancelled())
+        return;
       if (ros::service::call("qr_get_object_position", pos_msg)) {
         if (pos_msg.response.position.size() > 0) {
           tracked = true;
@@ -329,12 +339,14 @@ void TableObject::Work() {
       }
     }
     LOG_INFO("Waiting to pick up object [%s]!", object_.c_str());
-    boost::this_thread::sleep(boost::posix_time::millisec(6000));
+    if (WorkCancelled(boost::posix_time::millisec(6000)))
+      return;
     object_id_ = object_;
   }
   PickAndPlace(object_id_.c_str());
   while (!PickAndPlaceDone()) {
-    boost::this_thread::sleep(boost::posix_time::millisec(500));
+    if (WorkCancelled(boost::posix_time::millisec(500)))
+      return;
       // ROS_INFO("TableObject::Work: waiting for pick and place to be done!");
   }
   // Check if succeeded and try again
@@ -16,6 +16,7 @@ You should have received a copy of the GNU General Public License
 along with this program.  If not, see <http://www.gnu.org/licenses/>.
 */
 #include <cmath>
+#include <boost/bind.hpp>
 #include "table_setting_demo/log.h"
 #include "table_setting_demo/table_object_behavior_VisionManip.h"
 #include "geometry_msgs/PoseStamped.h"
@@ -171,30 +172,12 @@ bool TableObject_VisionManip_human::Precondition() {
   }
 }
 bool TableObject_VisionManip_human::ActivationPrecondition() {
-   bool lock_okay;
-
- // first attempt which did not work.....
-  // check peer states...?
-  if(!state_.peer_active && !state_.peer_done) {
-    // return mut_arm.Lock(state_.activation_potential);
-    ROS_INFO("\t[%s]: Trying to gain access to mutex!", name_->topic.c_str());
-    lock_okay = mut_arm.Lock(state_.activation_potential);
-    // return true;
-  }
-  else{
+  // Asked again every update tick: the lock request stays queued at the
+  // mutex service across ticks and is dropped once a peer claims the node
+  if (Claimed())
     ROS_INFO("\t[%s]: Peer gained access first, don't activate!", name_->topic.c_str());
-    return false;
-  }
-
-// second attempt
-  // check peer states...?
-  if(state_.peer_active || state_.peer_done) {
-    ROS_INFO("\t[%s]: Peer gained access first so release mutex and don't activate!", name_->topic.c_str());
-    mut_arm.Release();
-    return false;
-  }
-
-  return lock_okay;
+  return mut_arm.PollLock(state_.activation_potential,
+    boost::bind(&TableObject_VisionManip_human::Claimed, this));
 }
 
 bool TableObject_VisionManip_human::PickAndPlaceDone() {
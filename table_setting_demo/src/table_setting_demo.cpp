@@ -218,6 +218,8 @@ int main(int argc, char **argv) {
   printf("This is happening!!!!!!\n");
   TableSetting SetTable;
   ROS_INFO("\n\nThis is finished!!!!!!\n");
+  // All nodes of this process exist, let the readiness barrier report
+  task_net::ReadinessBarrier::NodesCreated();
   ros::spin();
   return 0;
 }
\ No newline at end of file
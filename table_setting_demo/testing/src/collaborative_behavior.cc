@@ -17,6 +17,7 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>.
 */
 
 #include "collaborative_behavior.h"
+#include <boost/bind.hpp>
 namespace task_net {
 CollabTestBehavior::CollabTestBehavior() {}
 CollabTestBehavior::CollabTestBehavior(
@@ -52,7 +53,8 @@ bool CollabTestBehavior::Precondition() {
 }
 
 bool CollabTestBehavior::ActivationPrecondition() {
-  return mut.Lock(state_.activation_potential);
+  return mut.PollLock(state_.activation_potential,
+    boost::bind(&CollabTestBehavior::Claimed, this));
 }
 
 void CollabTestBehavior::Work() {
@@ -202,6 +202,8 @@ int main(int argc, char **argv) {
   ros::init(argc, argv, "collaborative_test");
 
   CollaborativeTest test;
+  // All nodes of this process exist, let the readiness barrier report
+  task_net::ReadinessBarrier::NodesCreated();
   ros::spin();
   return 0;
 }
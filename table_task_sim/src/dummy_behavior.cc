@@ -2,6 +2,7 @@
 #include <table_task_sim/PickUpObject.h>
 #include <table_task_sim/PlaceObject.h>
 #include <table_task_sim/dummy_behavior.h>
+#include <boost/bind.hpp>
 
 namespace task_net {
 ////////////////////////////////////////////////////////////////////////////////
@@ -173,31 +174,12 @@ bool DummyBehavior::ActivationPrecondition() {
   // orig
   // return mut_arm.Lock(state_.activation_potential);
 
-
-  bool lock_okay;
-
- // first attempt which did not work.....
-  // check peer states...?
-  if(!state_.peer_active && !state_.peer_done) {
-    // return mut_arm.Lock(state_.activation_potential);
-    ROS_INFO("\t[%s]: Trying to gain access to mutex!", name_->topic.c_str());
-    lock_okay = mut_arm.Lock(state_.activation_potential);
-    // return true;
-  }
-  else{
+  // Asked again every update tick: the lock request stays queued at the
+  // mutex service across ticks and is dropped once a peer claims the node
+  if (Claimed())
     ROS_INFO("\t[%s]: Peer gained access first, don't activate!", name_->topic.c_str());
-    return false;
-  }
-
-// second attempt
-  // check peer states...?
-  if(state_.peer_active || state_.peer_done) {
-    ROS_INFO("\t[%s]: Peer gained access first so release mutex and don't activate!", name_->topic.c_str());
-    mut_arm.Release();
-    return false;
-  }
-
-  return lock_okay;
+  return mut_arm.PollLock(state_.activation_potential,
+    boost::bind(&DummyBehavior::Claimed, this));
 }
 
   void DummyBehavior::StateCallback( table_task_sim::SimState msg)
@@ -4,6 +4,8 @@
 #include <table_task_sim/PlaceObject.h>
 #include <robotics_task_tree_msgs/ObjStatus.h>
 #include <table_task_sim/human_behavior.h>
+#include <remote_mutex/sim_clock.h>
+#include <boost/bind.hpp>
 
 namespace task_net {
 ////////////////////////////////////////////////////////////////////////////////
@@ -124,7 +126,7 @@ bool HumanBehavior::Precondition() {
       ROS_ERROR("COLLISION IS HAPPENING FOR OBJECT = %s~~~~~~~~~~~~~~~~~~~~~~~~~~~~~",object_.c_str());
       state_.collision = true;
       this->PublishStateToPeers();
-      ros::Duration(5).sleep();
+      mutex::SimClock::Sleep(ros::Duration(5));
       state_.collision = false;
 
       return false;
@@ -222,34 +224,14 @@ bool HumanBehavior::ActivationPrecondition() {
   // orig
   // return mut_arm.Lock(state_.activation_potential);
 
-
-  bool lock_okay;
-
     ROS_ERROR("%s %d",object_.c_str(),state_.peer_active);
 
-
- // first attempt which did not work.....
-  // check peer states...?
-  if(!state_.peer_active && !state_.peer_done) {
-    // return mut_arm.Lock(state_.activation_potential);
-    ROS_INFO("\t[%s]: Trying to gain access to mutex!", name_->topic.c_str());
-    lock_okay = mut_arm.Lock(state_.activation_potential);
-    // return true;
-  }
-  else{
+  // Asked again every update tick: the lock request stays queued at the
+  // mutex service across ticks and is dropped once a peer claims the node
+  if (Claimed())
     ROS_INFO("\t[%s]: Peer gained access first, don't activate!", name_->topic.c_str());
-    return false;
-  }
-
-// second attempt
-  // check peer states...?
-  if(state_.peer_active || state_.peer_done) {
-    ROS_INFO("\t[%s]: Peer gained access first so release mutex and don't activate!", name_->topic.c_str());
-    mut_arm.Release();
-    return false;
-  }
-
-  return lock_okay;
+  return mut_arm.PollLock(state_.activation_potential,
+    boost::bind(&HumanBehavior::Claimed, this));
 }
 
   // TODO: Remove for Bashira's
@@ -7,6 +7,7 @@
 #include <table_task_sim/PlaceObject.h>
 #include <geometry_msgs/Pose.h>
 #include <yaml-cpp/yaml.h>
+#include <remote_mutex/sim_clock.h>
 
 // used to make sure that markers for robots/goals/objects do not collide and overwrite each other
 #define OBJ_PFX 1000
@@ -88,7 +89,7 @@ bool pick(table_task_sim::PickUpObject::Request  &req,
 	// set robot's goal to match object
 	simstate.robots[req.robot_id].goal = simstate.objects[idx].pose;
 	float dist = 999;
-	ros::Rate loop_rate( 10 );
+	ros::Duration loop_period( 0.1 );
 
 	// wait for robot to reach goal
 	do {
@@ -96,7 +97,7 @@ bool pick(table_task_sim::PickUpObject::Request  &req,
 		float ydist = simstate.robots[req.robot_id].goal.position.y - simstate.robots[req.robot_id].pose.position.y;
 		dist = hypot(ydist,xdist);
 		ROS_INFO ("robot [%d] moving to [%s] dist: %f", req.robot_id, req.object_name.c_str(), dist);
-		loop_rate.sleep();
+		mutex::SimClock::Sleep(loop_period);
 	} while( dist > 0.0001 );
 
 	simstate.robots[req.robot_id].holding = req.object_name;
@@ -135,14 +136,14 @@ bool place(table_task_sim::PlaceObject::Request		&req,
 	// move to place goal
 	simstate.robots[req.robot_id].goal = req.goal;
 	float dist = 999;
-	ros::Rate loop_rate( 10 );
+	ros::Duration loop_period( 0.1 );
 
 	// wait for robot to reach goal
 	do {
 		float xdist = simstate.robots[req.robot_id].goal.position.x - simstate.robots[req.robot_id].pose.position.x;
 		float ydist = simstate.robots[req.robot_id].goal.position.y - simstate.robots[req.robot_id].pose.position.y;
 		dist = hypot(ydist,xdist);
-		loop_rate.sleep();
+		mutex::SimClock::Sleep(loop_period);
 	} while( dist > 0.0001 );
 
 	// drop object
@@ -300,7 +301,7 @@ int main(int argc, char* argv[] )
 	ros::NodeHandle nh;
 	ros::NodeHandle nh_priv("~");
 
-	ros::Rate loop_rate(100);
+	boost::posix_time::time_duration loop_period = boost::posix_time::millisec(10);
 	
 	std::string filename;
 	if( nh_priv.getParam("filename", filename) ) 
@@ -327,12 +328,15 @@ int main(int argc, char* argv[] )
 	ros::AsyncSpinner spinner(4); // Use 4 threads
 	spinner.start();
 
-	ros::Time last_iter = ros::Time::now();
+	// the simulator loop holds the simulated clock while it updates
+	mutex::SimClock::Client clock_client;
+	boost::posix_time::ptime next_iter = mutex::SimClock::Now();
+	ros::Time last_iter = ros::Time::fromBoost(next_iter);
 
 	/* main control loop */
 	while( ros::ok() )
 	{
-		ros::Time curr_time = ros::Time::now();
+		ros::Time curr_time = ros::Time::fromBoost(mutex::SimClock::Now());
 
 		// update end effector positions
 		ros::Duration diff = curr_time - last_iter;
@@ -375,7 +379,13 @@ int main(int argc, char* argv[] )
 		state_pub.publish(simstate);
 
 		last_iter = curr_time;
-		loop_rate.sleep();
+		next_iter += loop_period;
+		if( next_iter < mutex::SimClock::Now() )
+		{
+			// fell behind (or no /clock yet), restart the schedule like ros::Rate
+			next_iter = mutex::SimClock::Now() + loop_period;
+		}
+		mutex::SimClock::SleepUntil(next_iter);
 	} // while ros::ok()
 
 	return 0;
@@ -0,0 +1,97 @@
+/*
+timeseries_recording_toolkit
+Copyright (C) 2015  Luke Fraser
+
+timeseries_recording_toolkit is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+timeseries_recording_toolkit is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with timeseries_recording_toolkit.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#ifndef INCLUDE_TIMESERIES_RECORDING_SERVER_RECORDING_SERVER_H_
+#define INCLUDE_TIMESERIES_RECORDING_SERVER_RECORDING_SERVER_H_
+#include <stdint.h>
+#include <map>
+#include <string>
+#include <vector>
+#include "timeseries_recording_toolkit/shared_memory_ring.h"
+#include "timeseries_recording_toolkit/segment_writer.h"
+
+namespace recording_toolkit {
+/*
+Class: RecordingServer
+Definition: Drains the shared memory rings of every SharedMemoryRecorder on
+            the host into one record stream ordered by record time. Rings
+            are found by name in /dev/shm. Records are held back until they
+            are merge_window old and no older than the newest record of
+            every ring that delivered lately, so records of all producers up
+            to then are in, and then written as
+              <seconds since epoch>, <stream>, <record>
+            to segment files, indexed by time range in timeseries.index.
+            Records that still arrive behind what was written go out late,
+            out of order, and are counted. Rings of producers that closed or
+            died are removed once drained.
+*/
+class RecordingServer {
+ public:
+  RecordingServer(const std::string &directory, const SegmentPolicy &policy,
+    uint64_t merge_window_ns);
+  ~RecordingServer();
+
+  // Pick up new rings, drain all of them and write what is old enough.
+  // Returns the records drained.
+  uint32_t Poll();
+  // Drain and write everything, for shutdown
+  void Flush();
+
+  uint64_t Records() const;
+  uint64_t Dropped() const;
+  // Records written after newer ones
+  uint64_t Late() const;
+
+ private:
+  struct Ring_t {
+    SharedRingHeader *header;
+    char *data;
+    size_t map_size;
+    std::string stream;
+    // Record time of the newest record drained, and server time it came
+    uint64_t newest_ns;
+    uint64_t active_ns;
+  };
+  struct Entry_t {
+    uint64_t wall_ns;
+    uint64_t sequence;
+    std::string stream;
+    std::string payload;
+    bool operator<(const Entry_t &other) const;
+  };
+
+  void Scan();
+  bool Attach(const std::string &name);
+  uint32_t Drain(Ring_t *ring, uint64_t now);
+  void Detach(const std::string &name, Ring_t *ring);
+  // Write the held records up to watermark_ns in order
+  void Write(uint64_t watermark_ns);
+
+  SegmentWriter writer_;
+  uint64_t merge_window_ns_;
+  std::map<std::string, Ring_t> rings_;
+  std::vector<Entry_t> pending_;
+  uint64_t sequence_;
+  uint64_t records_;
+  uint64_t dropped_;
+  uint64_t late_;
+  // Newest record time written
+  uint64_t written_ns_;
+  uint64_t last_scan_ns_;
+};
+}  // namespace recording_toolkit
+#endif  // INCLUDE_TIMESERIES_RECORDING_SERVER_RECORDING_SERVER_H_
@@ -0,0 +1,129 @@
+/*
+timeseries_recording_toolkit
+Copyright (C) 2015  Luke Fraser
+
+timeseries_recording_toolkit is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+timeseries_recording_toolkit is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with timeseries_recording_toolkit.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#ifndef INCLUDE_TIMESERIES_RECORDING_TOOLKIT_RECORD_SCHEMA_H_
+#define INCLUDE_TIMESERIES_RECORDING_TOOLKIT_RECORD_SCHEMA_H_
+#include <stdint.h>
+#include <string.h>
+#include <string>
+#include <vector>
+
+namespace recording_toolkit {
+typedef enum {
+  FIELD_BOOL,
+  FIELD_INT32,
+  FIELD_UINT32,
+  FIELD_INT64,
+  FIELD_UINT64,
+  FIELD_FLOAT,
+  FIELD_DOUBLE,
+  FIELD_STRING,
+} FieldType_t;
+
+// Binary encoding of a field of a typed record. Fixed size fields are
+// copied as they are, strings as a uint16_t length and their bytes.
+template <typename T>
+struct FieldTraits;
+
+#define RECORD_FIXED_FIELD(T, TYPE)                                          \
+  template <>                                                                 \
+  struct FieldTraits<T> {                                                     \
+    static const FieldType_t type = TYPE;                                     \
+    static size_t Size(const T &value) { return sizeof(T); }                  \
+    static void Encode(const T &value, char *out) {                           \
+      memcpy(out, &value, sizeof(T));                                         \
+    }                                                                         \
+  };
+RECORD_FIXED_FIELD(bool, FIELD_BOOL)
+RECORD_FIXED_FIELD(int32_t, FIELD_INT32)
+RECORD_FIXED_FIELD(uint32_t, FIELD_UINT32)
+RECORD_FIXED_FIELD(int64_t, FIELD_INT64)
+RECORD_FIXED_FIELD(uint64_t, FIELD_UINT64)
+RECORD_FIXED_FIELD(float, FIELD_FLOAT)
+RECORD_FIXED_FIELD(double, FIELD_DOUBLE)
+#undef RECORD_FIXED_FIELD
+
+template <>
+struct FieldTraits<const char *> {
+  static const FieldType_t type = FIELD_STRING;
+  static size_t Length(const char *value) {
+    size_t length = strlen(value);
+    return length > UINT16_MAX ? UINT16_MAX : length;
+  }
+  static size_t Size(const char *value) {
+    return sizeof(uint16_t) + Length(value);
+  }
+  static void Encode(const char *value, char *out) {
+    uint16_t length = Length(value);
+    memcpy(out, &length, sizeof(length));
+    memcpy(out + sizeof(length), value, length);
+  }
+};
+template <>
+struct FieldTraits<char *> : FieldTraits<const char *> {};
+template <size_t N>
+struct FieldTraits<char[N]> : FieldTraits<const char *> {};
+template <>
+struct FieldTraits<std::string> {
+  static const FieldType_t type = FIELD_STRING;
+  static size_t Length(const std::string &value) {
+    return value.size() > UINT16_MAX ? UINT16_MAX : value.size();
+  }
+  static size_t Size(const std::string &value) {
+    return sizeof(uint16_t) + Length(value);
+  }
+  static void Encode(const std::string &value, char *out) {
+    uint16_t length = Length(value);
+    memcpy(out, &length, sizeof(length));
+    memcpy(out + sizeof(length), value.data(), length);
+  }
+};
+
+/*
+Class: RecordSchema
+Definition: Names and types of the fields of the typed records of a
+            stream, declared once before recording starts. Records are
+            kept in binary and rendered as a line of comma separated
+            fields only when they are written out.
+*/
+class RecordSchema {
+ public:
+  // Precision: digits after the point of a float or double, 6 when < 0
+  template <typename T>
+  RecordSchema &Field(const std::string &name, int precision = -1) {
+    return Add(name, FieldTraits<T>::type, precision);
+  }
+  RecordSchema &Add(const std::string &name, FieldType_t type,
+    int precision = -1);
+
+  size_t Size() const;
+  const std::string &Name(size_t field) const;
+  FieldType_t Type(size_t field) const;
+  // Append the text line of one encoded record to out, false when the
+  // record does not match the schema
+  bool Render(const char *data, size_t length, std::string *out) const;
+
+ private:
+  struct Field_t {
+    std::string name;
+    FieldType_t type;
+    int precision;
+  };
+  std::vector<Field_t> fields_;
+};
+}  // namespace recording_toolkit
+#endif  // INCLUDE_TIMESERIES_RECORDING_TOOLKIT_RECORD_SCHEMA_H_
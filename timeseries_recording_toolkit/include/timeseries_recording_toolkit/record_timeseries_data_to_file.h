@@ -19,49 +19,204 @@ along with timeseries_recording_toolkit.  If not, see <http://www.gnu.org/licens
 #define INCLUDE_TIMESERIES_RECORDING_TOOLKIT_RECORD_TIMESERIES_DATA_TO_FILE_H_
 #include <boost/thread/thread.hpp>
 #include <boost/thread/mutex.hpp>
+#include <boost/thread/condition_variable.hpp>
+#include <boost/thread/tss.hpp>
+#include <boost/atomic.hpp>
 #include <boost/date_time.hpp>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdarg.h>
+#include <sys/uio.h>
 #include <string>
-#include <fstream>
-#include <queue>
+#include <vector>
+#include "timeseries_recording_toolkit/record_schema.h"
+#include "timeseries_recording_toolkit/segment_writer.h"
+
+// Longest record, longer formatted records are cut and longer typed
+// records dropped
+#define MAX_RECORD_SIZE 2048
 
 namespace recording_toolkit {
+typedef enum {
+  SUCCESS = 1,
+  NOT_RECORDING,
+  SCHEMA_MISMATCH,
+  RECORD_TOO_LONG,
+} error_recording;
+
+// One contiguous piece of a record in the ring, a record that wraps around
+// the end of the ring comes as two
+struct RecordSegment {
+  const char *data;
+  size_t length;
+  // Epoch time of the record in ns, 0 unless the recorder stamps records
+  uint64_t wall_ns;
+  // Last segment of its record
+  bool end;
+};
+
+// Output counters of a recorder
+struct RecorderStats {
+  uint64_t records;
+  uint64_t bytes;
+  // Batches handed to the output and how long they took
+  uint64_t batches;
+  uint64_t batch_us_total;
+  uint64_t batch_us_max;
+};
+
+/*
+Class: PrintRecorder
+Definition: Formatted records from any number of threads, written out by
+            one worker thread. Producers format into a buffer of their own
+            thread and copy the record into preallocated slots of a lock
+            free ring, so recording never allocates and never takes a lock
+            unless the ring is full. The worker hands batches of records to
+            ProcessRecords straight from the ring, at the latest max latency
+            after they were recorded.
+*/
 class PrintRecorder {
  public:
+  // queue_size: records the ring holds before producers wait on the worker
   explicit PrintRecorder(uint32_t queue_size = 2048);
   virtual ~PrintRecorder();
 
   virtual uint32_t RecordPrintf(const char *fmt, ...);
+  // Typed record with one value per field of the schema, in order. The
+  // values are copied in binary and only rendered as text by the worker.
+  template <typename... Fields>
+  uint32_t Record(const Fields&... fields);
+  // Schema of the typed records, set before recording starts
+  void SetSchema(const RecordSchema &schema);
   virtual uint32_t StartRecord();
+  // Write out everything recorded so far and stop the worker
   virtual uint32_t StopRecord();
 
   void WaitUntilFinishedWriting();
+  // Longest a record waits in the ring before it is written, 100 ms
+  // unless set
+  void SetMaxLatency(boost::posix_time::time_duration latency);
+  // Most records in one batch, the worker is woken once that many are in
+  // the ring
+  void SetMaxBatch(uint32_t records);
+  RecorderStats Stats();
  protected:
+  struct Slot_t {
+    // Position the slot is free for, position + 1 once a record is in it
+    boost::atomic<uint64_t> sequence;
+    // Set in the first slot of a record
+    uint32_t length;
+    uint32_t count;
+    uint64_t wall_ns;
+    // Binary record of the schema, rendered before it is processed
+    bool typed;
+  };
+  struct FormatBuffer_t;
+
   static void Worker(PrintRecorder *object);
+  // Hand every record ready in the ring to ProcessRecords, returns how many
   virtual uint32_t RecordingWorker();
-  virtual void ProcessBufferQueue(std::queue<std::string> *buffer);
-  bool recording_;
-  std::queue<std::string> *thread_queue_ptr_, *thread_queue_buffer_ptr_;
-  std::queue<std::string> queues[2];
-  uint32_t queue_size_;
+  virtual void ProcessRecords(const RecordSegment *segments, size_t count);
+  void Push(const char *data, uint32_t length, bool typed);
+  // Buffer of MAX_RECORD_SIZE bytes of the calling thread
+  char *RecordBuffer();
+  bool Encode(char *buffer, size_t *length, size_t field) {
+    return field == schema_.Size();
+  }
+  template <typename T, typename... Rest>
+  bool Encode(char *buffer, size_t *length, size_t field, const T &value,
+      const Rest&... rest);
+  void Wake();
+
+  boost::atomic<bool> recording_;
+  boost::atomic<bool> stopping_;
+  // Stamp every record with the wall clock when it is recorded
+  bool stamp_records_;
+  RecordSchema schema_;
+  // Text of the typed records of the batch being processed
+  std::string rendered_;
+  std::vector<std::pair<size_t, size_t> > rendered_segments_;
+  // Ring of capacity_ slots of RECORD_SLOT_SIZE bytes each
+  Slot_t *slots_;
+  char *data_;
+  uint64_t capacity_;
+  uint64_t mask_;
+  boost::atomic<uint64_t> enqueue_pos_;
+  boost::atomic<uint64_t> dequeue_pos_;
+  std::vector<RecordSegment> segments_;
+  boost::atomic<int64_t> max_latency_us_;
+  boost::atomic<uint32_t> max_batch_;
+  // Producers wake the worker each time this many slots filled up
+  boost::atomic<uint64_t> wake_every_;
+  boost::atomic<uint64_t> records_;
+  boost::atomic<uint64_t> bytes_;
+  boost::atomic<uint64_t> batches_;
+  boost::atomic<uint64_t> batch_us_total_;
+  boost::atomic<uint64_t> batch_us_max_;
+  static boost::thread_specific_ptr<FormatBuffer_t> format_buffer_;
 
   boost::thread *printing_thread;
-  boost::mutex queue_access;
+  boost::mutex wake_mut_;
+  boost::condition_variable wake_;
 };
+/*
+Class: FilePrintRecorder
+Definition: PrintRecorder into a file, truncated when opened, or into
+            segment files of a SegmentWriter. Each batch is written with
+            writev straight from the ring, and StopRecord syncs the file to
+            disk, or finishes the current segment.
+*/
 class FilePrintRecorder : public PrintRecorder {
  public:
   FilePrintRecorder(
                     const char* filename,
                     uint32_t queue_size = 2048);
+  // Records stamped and split into <directory>/<prefix>_<number>.csv
+  FilePrintRecorder(const std::string &directory, const std::string &prefix,
+    const SegmentPolicy &policy, uint32_t queue_size = 2048);
   virtual ~FilePrintRecorder();
+  virtual uint32_t StopRecord();
 
  protected:
-  virtual void ProcessBufferQueue(std::queue<std::string> *buffer);
+  virtual void ProcessRecords(const RecordSegment *segments, size_t count);
 
   std::string filename_;
-  std::ofstream fout;
+  int fd_;
+  // NULL when writing a single file
+  SegmentWriter *writer_;
+  std::vector<struct iovec> iov_;
 };
+
+template <typename... Fields>
+uint32_t PrintRecorder::Record(const Fields&... fields) {
+  if (!recording_.load(boost::memory_order_relaxed))
+    return NOT_RECORDING;
+  if (sizeof...(Fields) != schema_.Size())
+    return SCHEMA_MISMATCH;
+  char *buffer = RecordBuffer();
+  size_t length = 0;
+  if (!Encode(buffer, &length, 0, fields...))
+    return length > MAX_RECORD_SIZE ? RECORD_TOO_LONG : SCHEMA_MISMATCH;
+  Push(buffer, length, true);
+  return SUCCESS;
+}
+
+template <typename T, typename... Rest>
+bool PrintRecorder::Encode(char *buffer, size_t *length, size_t field,
+    const T &value, const Rest&... rest) {
+  if (FieldTraits<T>::type != schema_.Type(field))
+    return false;
+  size_t size = FieldTraits<T>::Size(value);
+  if (*length + size > MAX_RECORD_SIZE) {
+    *length += size;
+    return false;
+  }
+  FieldTraits<T>::Encode(value, buffer + *length);
+  *length += size;
+  return Encode(buffer, length, field + 1, rest...);
+}
+
+// CLOCK_REALTIME in nanoseconds
+uint64_t WallNs();
 }  // namespace recording_toolkit
 #endif  // INCLUDE_TIMESERIES_RECORDING_TOOLKIT_RECORD_TIMESERIES_DATA_TO_FILE_H_
@@ -0,0 +1,112 @@
+/*
+timeseries_recording_toolkit
+Copyright (C) 2015  Luke Fraser
+
+timeseries_recording_toolkit is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+timeseries_recording_toolkit is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with timeseries_recording_toolkit.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#ifndef INCLUDE_TIMESERIES_RECORDING_TOOLKIT_SEGMENT_WRITER_H_
+#define INCLUDE_TIMESERIES_RECORDING_TOOLKIT_SEGMENT_WRITER_H_
+#include <sys/uio.h>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+namespace recording_toolkit {
+// When segments are finished and how many are kept, 0 is no limit
+struct SegmentPolicy {
+  SegmentPolicy();
+  // A new segment is started before the current one would grow past
+  // max_bytes, or once its records span max_age_ns
+  uint64_t max_bytes;
+  uint64_t max_age_ns;
+  // The oldest finished segments are removed once together they take
+  // more than retain_bytes. The newest one is always kept.
+  uint64_t retain_bytes;
+};
+
+// One finished segment in the index
+struct SegmentInfo {
+  std::string name;
+  // Record times of the first and last write
+  uint64_t first_ns;
+  uint64_t last_ns;
+  uint64_t bytes;
+};
+
+/*
+Class: SegmentWriter
+Definition: Output split over numbered segment files
+            <directory>/<prefix>_<number>.<extension>. A segment is written
+            as <name>.partial and only renamed to its name once it is
+            finished and synced, so a segment under its name is always
+            complete. Finished segments are listed with their time range in
+            <directory>/<prefix>.index, replaced atomically on every change,
+            and a later run with the same prefix numbers on after them. A
+            single write is never split over two segments.
+*/
+class SegmentWriter {
+ public:
+  SegmentWriter(const std::string &directory, const std::string &prefix,
+    const std::string &extension, const SegmentPolicy &policy);
+  ~SegmentWriter();
+
+  // Write every buffer of iov, bytes in total, holding records from
+  // first_ns to last_ns. False on a write error.
+  bool Write(const struct iovec *iov, int count, uint64_t bytes,
+    uint64_t first_ns, uint64_t last_ns);
+  // Sync the current segment to disk
+  void Sync();
+  // Finish the current segment, the next write starts a new one
+  void Close();
+  const std::string& Filename() const;
+
+  // True when directory is a directory segments can be written to
+  static bool Usable(const std::string &directory);
+
+  // Finished segments of <directory>/<prefix> with records between
+  // begin_ns and end_ns, oldest first
+  static std::vector<SegmentInfo> Segments(const std::string &directory,
+    const std::string &prefix, uint64_t begin_ns = 0,
+    uint64_t end_ns = UINT64_MAX);
+
+ private:
+  bool Open();
+  // Report a failed write, returns false
+  bool Failed();
+  // Remove the oldest segments past the retention limit
+  void Retain();
+  void WriteIndex();
+  std::string Path(const std::string &name) const;
+  static std::string IndexPath(const std::string &directory,
+    const std::string &prefix);
+  static void ReadIndex(const std::string &path,
+    std::vector<SegmentInfo> *index);
+
+  std::string directory_;
+  std::string prefix_;
+  std::string extension_;
+  SegmentPolicy policy_;
+  uint32_t number_;
+  std::string name_;
+  std::string filename_;
+  int fd_;
+  // The last Open() failed and was reported, later failures are not
+  bool open_failed_;
+  uint64_t size_;
+  uint64_t first_ns_;
+  uint64_t last_ns_;
+  std::vector<SegmentInfo> index_;
+};
+}  // namespace recording_toolkit
+#endif  // INCLUDE_TIMESERIES_RECORDING_TOOLKIT_SEGMENT_WRITER_H_
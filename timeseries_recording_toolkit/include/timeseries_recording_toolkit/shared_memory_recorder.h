@@ -0,0 +1,58 @@
+/*
+timeseries_recording_toolkit
+Copyright (C) 2015  Luke Fraser
+
+timeseries_recording_toolkit is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+timeseries_recording_toolkit is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with timeseries_recording_toolkit.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#ifndef INCLUDE_TIMESERIES_RECORDING_TOOLKIT_SHARED_MEMORY_RECORDER_H_
+#define INCLUDE_TIMESERIES_RECORDING_TOOLKIT_SHARED_MEMORY_RECORDER_H_
+#include <stdint.h>
+#include <string>
+#include "timeseries_recording_toolkit/record_timeseries_data_to_file.h"
+#include "timeseries_recording_toolkit/shared_memory_ring.h"
+
+#define DEFAULT_SHARED_RING_BYTES (1 << 20)
+
+namespace recording_toolkit {
+/*
+Class: SharedMemoryRecorder
+Definition: PrintRecorder whose worker copies the records, stamped with the
+            time they were recorded, into a shared memory ring drained by
+            the timeseries_recording_server. The process does no file I/O
+            for its records. Without a server draining it the ring fills
+            up and further records are dropped and counted rather than
+            holding up the producers.
+*/
+class SharedMemoryRecorder : public PrintRecorder {
+ public:
+  explicit SharedMemoryRecorder(const std::string &stream,
+    uint64_t ring_bytes = DEFAULT_SHARED_RING_BYTES,
+    uint32_t queue_size = 2048);
+  virtual ~SharedMemoryRecorder();
+
+  // False when the ring could not be created, records are dropped then
+  bool Connected() const;
+  uint64_t Dropped() const;
+
+ protected:
+  virtual void ProcessRecords(const RecordSegment *segments, size_t count);
+  void Write(const RecordSegment *segments, size_t count, uint32_t length);
+
+  std::string name_;
+  SharedRingHeader *header_;
+  char *ring_;
+  size_t map_size_;
+};
+}  // namespace recording_toolkit
+#endif  // INCLUDE_TIMESERIES_RECORDING_TOOLKIT_SHARED_MEMORY_RECORDER_H_
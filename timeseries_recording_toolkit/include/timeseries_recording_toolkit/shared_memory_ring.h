@@ -0,0 +1,70 @@
+/*
+timeseries_recording_toolkit
+Copyright (C) 2015  Luke Fraser
+
+timeseries_recording_toolkit is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+timeseries_recording_toolkit is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with timeseries_recording_toolkit.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#ifndef INCLUDE_TIMESERIES_RECORDING_TOOLKIT_SHARED_MEMORY_RING_H_
+#define INCLUDE_TIMESERIES_RECORDING_TOOLKIT_SHARED_MEMORY_RING_H_
+#include <boost/atomic.hpp>
+#include <boost/static_assert.hpp>
+#include <stdint.h>
+#include <string>
+
+// Layout of the shared memory ring between a SharedMemoryRecorder and the
+// timeseries_recording_server. One ring per producer process and stream,
+// named /dev/shm/timeseries_recording.<stream>.<pid>:
+//   SharedRingHeader
+//   capacity bytes of records, each a SharedRingRecord followed by its
+//   payload padded to 8 bytes. A record never wraps: a length of
+//   SHARED_RING_WRAP tells the reader to go on at the start of the ring.
+#define SHARED_RING_PREFIX "timeseries_recording."
+#define SHARED_RING_MAGIC "TSRING1"
+#define SHARED_RING_STREAM_LENGTH 64
+#define SHARED_RING_WRAP 0xFFFFFFFFu
+
+// The counters are shared between processes, they must not fall back to
+// a lock inside boost::atomic
+BOOST_STATIC_ASSERT(BOOST_ATOMIC_INT64_LOCK_FREE == 2);
+BOOST_STATIC_ASSERT(BOOST_ATOMIC_INT32_LOCK_FREE == 2);
+
+namespace recording_toolkit {
+struct SharedRingHeader {
+  char magic[8];
+  uint32_t header_size;     // sizeof(SharedRingHeader), data follows
+  int32_t pid;              // producer process
+  uint64_t capacity;        // bytes of records, a power of two
+  char stream[SHARED_RING_STREAM_LENGTH];
+  boost::atomic<uint64_t> head;     // bytes written, by the producer
+  boost::atomic<uint64_t> tail;     // bytes read, by the server
+  boost::atomic<uint64_t> dropped;  // records lost to a full ring
+  boost::atomic<uint32_t> closed;   // the producer is gone
+  uint32_t reserved;
+};
+
+struct SharedRingRecord {
+  uint32_t length;          // payload bytes or SHARED_RING_WRAP
+  uint32_t reserved;
+  uint64_t wall_ns;         // epoch time the record was made
+};
+
+// Bytes a record with length bytes of payload takes in the ring
+inline uint64_t SharedRingSpace(uint32_t length) {
+  return sizeof(SharedRingRecord) + ((length + 7) & ~7ull);
+}
+
+// Shared memory name of a producer's ring
+std::string SharedRingName(const std::string &stream, int pid);
+}  // namespace recording_toolkit
+#endif  // INCLUDE_TIMESERIES_RECORDING_TOOLKIT_SHARED_MEMORY_RING_H_
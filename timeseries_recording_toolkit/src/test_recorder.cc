@@ -17,11 +17,81 @@ along with timeseries_recording_toolkit.  If not, see <http://www.gnu.org/licens
 */
 
 #include <boost/timer/timer.hpp>
+#include <boost/thread/thread.hpp>
+#include <boost/bind.hpp>
+#include <boost/atomic.hpp>
 #include <stdio.h>
+#include <time.h>
+#include <sys/stat.h>
 #include <iostream>
+#include <fstream>
+#include <set>
+#include <string>
+#include <utility>
 #include "timeseries_recording_toolkit/record_timeseries_data_to_file.h"
+#include "timeseries_recording_toolkit/shared_memory_recorder.h"
+#include "timeseries_recording_server/recording_server.h"
+
+#define PRODUCERS 16
+#define PRODUCER_RECORDS 20000
+
+void Produce(recording_toolkit::PrintRecorder *recorder, int thread) {
+  for (int i = 0; i < PRODUCER_RECORDS; ++i)
+    recorder->RecordPrintf("thread %d record %d\n", thread, i);
+}
+
+// CPU time of the calling thread only, without the recorder's worker
+double ThreadCpuNs() {
+  struct timespec now;
+  clock_gettime(CLOCK_THREAD_CPUTIME_ID, &now);
+  return now.tv_sec * 1e9 + now.tv_nsec;
+}
+
+void Serve(recording_toolkit::RecordingServer *server,
+    boost::atomic<bool> *stop) {
+  while (!stop->load()) {
+    if (!server->Poll())
+      boost::this_thread::yield();
+  }
+}
+
+// Lines of the server segments in directory: time order kept, records of
+// the stream that come out whole and once
+void CheckServerOutput(const std::string &directory, const std::string &stream,
+    std::set<std::pair<int, int> > *seen, int *lines, int *out_of_order) {
+  std::vector<recording_toolkit::SegmentInfo> segments =
+    recording_toolkit::SegmentWriter::Segments(directory, "timeseries");
+  std::string format = "%lu.%lu, " + stream + ", thread %d record %d";
+  unsigned long last_sec = 0, last_nsec = 0;
+  std::string line;
+  for (size_t i = 0; i < segments.size(); ++i) {
+    std::ifstream segment((directory + "/" + segments[i].name).c_str());
+    while (std::getline(segment, line)) {
+      unsigned long sec, nsec;
+      int thread, record;
+      if (sscanf(line.c_str(), format.c_str(), &sec, &nsec, &thread,
+          &record) != 4)
+        continue;
+      (*lines)++;
+      if (sec < last_sec || (sec == last_sec && nsec < last_nsec))
+        (*out_of_order)++;
+      last_sec = sec;
+      last_nsec = nsec;
+      seen->insert(std::make_pair(thread, record));
+    }
+  }
+}
+
+// Names a check that did not hold and counts it
+void Check(bool held, const char *check, int *failed) {
+  if (held)
+    return;
+  std::cout << "FAILED: " << check << std::endl;
+  (*failed)++;
+}
 
 int main(int argc, char *argv[]) {
+  int failed = 0;
   recording_toolkit::FilePrintRecorder output_test("test.txt");
 
   output_test.StartRecord();
@@ -36,11 +106,219 @@ int main(int argc, char *argv[]) {
   output_test.StopRecord();
   std::cout << "First Timing: " << timer.format() << std::endl;
 
+  // Many producers at once, every record has to come out whole and once
+  recording_toolkit::FilePrintRecorder threaded_test("test_threads.txt");
+  threaded_test.StartRecord();
+  timer.start();
+  boost::thread_group producers;
+  for (int t = 0; t < PRODUCERS; ++t)
+    producers.create_thread(boost::bind(&Produce, &threaded_test, t));
+  producers.join_all();
+  timer.stop();
+  threaded_test.StopRecord();
+  std::cout << "Threaded Timing: " << timer.format() << std::endl;
+  recording_toolkit::RecorderStats stats = threaded_test.Stats();
+  std::cout << "Threaded output: " << stats.records << " records, "
+    << stats.bytes << " bytes in " << stats.batches << " batches, "
+    << stats.batch_us_max << " us longest batch" << std::endl;
+
+  std::ifstream fin("test_threads.txt");
+  std::set<std::pair<int, int> > seen;
+  std::string line;
+  int lines = 0, broken = 0;
+  while (std::getline(fin, line)) {
+    int thread, record;
+    lines++;
+    if (sscanf(line.c_str(), "thread %d record %d", &thread, &record) == 2)
+      seen.insert(std::make_pair(thread, record));
+    else
+      broken++;
+  }
+  std::cout << "Threaded records: " << lines << " lines, " << seen.size()
+    << " unique, " << broken << " broken of "
+    << PRODUCERS * PRODUCER_RECORDS << std::endl;
+  Check(broken == 0 && lines == PRODUCERS * PRODUCER_RECORDS
+    && static_cast<int>(seen.size()) == lines,
+    "threaded records whole and once", &failed);
+
+  // The same sample as a formatted and as a typed record
+  recording_toolkit::FilePrintRecorder printf_test("test_printf.txt");
+  printf_test.StartRecord();
+  timer.start();
+  double producer_ns = ThreadCpuNs();
+  for (int i = 0; i < 100000; ++i) {
+    printf_test.RecordPrintf("%f, %s, %d, %d, %f, %f\n", i * 0.01,
+      "PLACE_3_1_005_state", i & 1, 0, 0.25, 0.5);
+  }
+  double printf_ns = (ThreadCpuNs() - producer_ns) / 100000;
+  timer.stop();
+  printf_test.StopRecord();
+  std::cout << "Printf Timing: " << timer.format() << std::endl;
+
+  recording_toolkit::RecordSchema schema;
+  schema.Field<double>("time")
+    .Field<std::string>("topic")
+    .Field<bool>("active")
+    .Field<bool>("done")
+    .Field<float>("activation_level")
+    .Field<float>("activation_potential");
+  recording_toolkit::FilePrintRecorder typed_test("test_typed.txt");
+  typed_test.SetSchema(schema);
+  typed_test.StartRecord();
+  std::string topic = "PLACE_3_1_005_state";
+  timer.start();
+  producer_ns = ThreadCpuNs();
+  for (int i = 0; i < 100000; ++i) {
+    typed_test.Record(i * 0.01, topic, static_cast<bool>(i & 1), false,
+      0.25f, 0.5f);
+  }
+  double typed_ns = (ThreadCpuNs() - producer_ns) / 100000;
+  timer.stop();
+  bool refused =
+    typed_test.Record(1.0) == recording_toolkit::SCHEMA_MISMATCH;
+  std::cout << "Typed schema mismatch: "
+    << (refused ? "refused" : "ACCEPTED") << std::endl;
+  Check(refused, "typed schema mismatch refused", &failed);
+  typed_test.StopRecord();
+  std::cout << "Typed Timing: " << timer.format() << std::endl;
+  // Process CPU above includes the worker formatting the records
+  std::cout << "Producer thread CPU per record: " << printf_ns
+    << " ns printf, " << typed_ns << " ns typed" << std::endl;
+
+  std::ifstream printf_in("test_printf.txt");
+  std::ifstream typed_in("test_typed.txt");
+  std::string printf_line, typed_line;
+  int compared = 0, differ = 0;
+  while (std::getline(printf_in, printf_line)
+      && std::getline(typed_in, typed_line)) {
+    compared++;
+    if (printf_line != typed_line)
+      differ++;
+  }
+  std::cout << "Typed records: " << compared << " compared, " << differ
+    << " differ from printf" << std::endl;
+  Check(compared == 100000 && differ == 0, "typed records match printf",
+    &failed);
+
+  // Segmented output: small segments, only the newest 256 KB kept
+  mkdir("test_segments", 0755);
+  recording_toolkit::SegmentPolicy policy;
+  policy.max_bytes = 64 << 10;
+  policy.retain_bytes = 256 << 10;
+  recording_toolkit::FilePrintRecorder segment_test("test_segments",
+    "segment", policy);
+  segment_test.StartRecord();
+  for (int i = 0; i < 100000; ++i)
+    segment_test.RecordPrintf("segment record %d\n", i);
+  segment_test.StopRecord();
+  std::vector<recording_toolkit::SegmentInfo> kept =
+    recording_toolkit::SegmentWriter::Segments("test_segments", "segment");
+  uint64_t kept_bytes = 0;
+  int kept_lines = 0, kept_broken = 0, last = -1;
+  for (size_t i = 0; i < kept.size(); ++i) {
+    kept_bytes += kept[i].bytes;
+    std::ifstream segment(("test_segments/" + kept[i].name).c_str());
+    while (std::getline(segment, line)) {
+      int record;
+      kept_lines++;
+      if (sscanf(line.c_str(), "segment record %d", &record) != 1
+          || (last >= 0 && record != last + 1))
+        kept_broken++;
+      last = record;
+    }
+  }
+  std::vector<recording_toolkit::SegmentInfo> window;
+  if (!kept.empty())
+    window = recording_toolkit::SegmentWriter::Segments("test_segments",
+      "segment", kept.back().first_ns, kept.back().last_ns);
+  std::cout << "Segments: " << kept.size() << " kept, " << kept_bytes
+    << " bytes, " << kept_lines << " lines, " << kept_broken
+    << " out of order, last record " << last << ", " << window.size()
+    << " in the window of the newest" << std::endl;
+  Check(!kept.empty() && kept_broken == 0 && last == 99999
+    && !window.empty(), "segments kept in order up to the last record",
+    &failed);
+
+  // Producers in shared memory, merged by a server draining them meanwhile
+  mkdir("test_shared", 0755);
+  recording_toolkit::SharedMemoryRecorder *shared_test =
+    new recording_toolkit::SharedMemoryRecorder("test_shared", 16 << 20);
+  shared_test->StartRecord();
+  recording_toolkit::RecordingServer *server =
+    new recording_toolkit::RecordingServer("test_shared",
+      recording_toolkit::SegmentPolicy(), 10000000);
+  boost::atomic<bool> stop_server(false);
+  boost::thread server_thread(boost::bind(&Serve, server, &stop_server));
+  timer.start();
+  for (int t = 0; t < PRODUCERS; ++t)
+    producers.create_thread(boost::bind(&Produce, shared_test, t));
+  producers.join_all();
+  timer.stop();
+  shared_test->StopRecord();
+  uint64_t shared_dropped = shared_test->Dropped();
+  // Closes the ring, the server takes it down once drained
+  delete shared_test;
+  boost::this_thread::sleep(boost::posix_time::millisec(100));
+  stop_server = true;
+  server_thread.join();
+  server->Flush();
+  std::cout << "Shared Timing: " << timer.format() << std::endl;
+  std::cout << "Shared server: " << server->Records() << " records, "
+    << server->Late() << " late, " << server->Dropped() << " dropped, "
+    << shared_dropped << " dropped by the recorder" << std::endl;
+  Check(server->Late() == 0, "no late records at the server", &failed);
+  delete server;
+  seen.clear();
+  lines = 0;
+  int out_of_order = 0;
+  CheckServerOutput("test_shared", "test_shared", &seen, &lines,
+    &out_of_order);
+  std::cout << "Shared records: " << lines << " lines, " << seen.size()
+    << " unique, " << out_of_order << " out of time order of "
+    << PRODUCERS * PRODUCER_RECORDS - shared_dropped << std::endl;
+  Check(static_cast<int>(seen.size()) == lines && out_of_order == 0
+    && lines + shared_dropped == PRODUCERS * PRODUCER_RECORDS,
+    "shared records merged in order and once", &failed);
+
+  // Nobody draining a small ring: it fills up, further records are dropped
+  // and the server accounts for them once it picks the ring up
+  mkdir("test_shared_full", 0755);
+  recording_toolkit::SharedMemoryRecorder *full_test =
+    new recording_toolkit::SharedMemoryRecorder("test_shared_full", 4096);
+  full_test->StartRecord();
+  for (int i = 0; i < PRODUCER_RECORDS; ++i)
+    full_test->RecordPrintf("thread %d record %d\n", 0, i);
+  full_test->StopRecord();
+  uint64_t full_dropped = full_test->Dropped();
+  delete full_test;
+  server = new recording_toolkit::RecordingServer("test_shared_full",
+    recording_toolkit::SegmentPolicy(), 0);
+  server->Poll();
+  uint64_t server_dropped = server->Dropped();
+  // The open segment is complete once the server is gone
+  delete server;
+  seen.clear();
+  lines = 0;
+  out_of_order = 0;
+  CheckServerOutput("test_shared_full", "test_shared_full", &seen, &lines,
+    &out_of_order);
+  std::cout << "Shared ring full: " << full_dropped << " dropped, "
+    << server_dropped << " reported by the server, " << lines
+    << " lines, " << out_of_order << " out of time order, "
+    << lines + full_dropped << " of " << PRODUCER_RECORDS << std::endl;
+  Check(full_dropped > 0 && server_dropped == full_dropped
+    && out_of_order == 0 && lines + full_dropped == PRODUCER_RECORDS,
+    "full ring drops accounted for", &failed);
+
   // timer.start();
   // for (int i = 0; i < 100000; ++i) {
   //   printf("Hello this is me printing a number really slow %d\n", i);
   // }
   // timer.stop();
   // fout << "Second Timing: " << timer.format() << std::endl;
+  if (failed) {
+    std::cout << failed << " checks FAILED" << std::endl;
+    return 1;
+  }
   return 0;
 }
\ No newline at end of file
@@ -0,0 +1,263 @@
+/*
+timeseries_recording_toolkit
+Copyright (C) 2015  Luke Fraser
+
+timeseries_recording_toolkit is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+timeseries_recording_toolkit is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with timeseries_recording_toolkit.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#include "timeseries_recording_server/recording_server.h"
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <algorithm>
+#include "timeseries_recording_toolkit/record_timeseries_data_to_file.h"
+
+#define SHARED_MEMORY_DIR "/dev/shm"
+// How often new rings are looked for
+#define SCAN_PERIOD_NS 1000000000ull
+// Longest "<seconds>, " prefix of an output line
+#define TIME_PREFIX_SIZE 32
+// Records handed to the segment writer at once
+#define RECORDS_PER_WRITE 256
+// A ring that delivered nothing for this long no longer holds the output
+// back
+#define RING_IDLE_NS 1000000000ull
+
+namespace recording_toolkit {
+
+bool RecordingServer::Entry_t::operator<(const Entry_t &other) const {
+  if (wall_ns != other.wall_ns)
+    return wall_ns < other.wall_ns;
+  return sequence < other.sequence;
+}
+
+RecordingServer::RecordingServer(const std::string &directory,
+    const SegmentPolicy &policy, uint64_t merge_window_ns)
+    : writer_(directory, "timeseries", "csv", policy),
+      merge_window_ns_(merge_window_ns), sequence_(0), records_(0),
+      dropped_(0), late_(0), written_ns_(0), last_scan_ns_(0) {}
+
+RecordingServer::~RecordingServer() {
+  Flush();
+  for (std::map<std::string, Ring_t>::iterator it = rings_.begin();
+      it != rings_.end(); ++it)
+    munmap(it->second.header, it->second.map_size);
+}
+
+uint32_t RecordingServer::Poll() {
+  uint64_t now = WallNs();
+  if (now - last_scan_ns_ >= SCAN_PERIOD_NS) {
+    Scan();
+    last_scan_ns_ = now;
+  }
+  uint32_t drained = 0;
+  uint64_t watermark = now > merge_window_ns_ ? now - merge_window_ns_ : 0;
+  for (std::map<std::string, Ring_t>::iterator it = rings_.begin();
+      it != rings_.end();) {
+    Ring_t &ring = it->second;
+    bool closed = ring.header->closed.load(boost::memory_order_acquire)
+      || (kill(ring.header->pid, 0) < 0 && errno == ESRCH);
+    drained += Drain(&ring, now);
+    if (closed && ring.header->tail.load(boost::memory_order_relaxed)
+        == ring.header->head.load(boost::memory_order_acquire)) {
+      Detach(it->first, &ring);
+      rings_.erase(it++);
+      continue;
+    }
+    // Its producer's worker may still hold records older than the newest
+    // one it delivered, but none older than that from the other rings
+    if (ring.active_ns && now - ring.active_ns < RING_IDLE_NS)
+      watermark = std::min(watermark, ring.newest_ns);
+    ++it;
+  }
+  Write(watermark);
+  return drained;
+}
+
+void RecordingServer::Flush() {
+  uint64_t now = WallNs();
+  for (std::map<std::string, Ring_t>::iterator it = rings_.begin();
+      it != rings_.end(); ++it)
+    Drain(&it->second, now);
+  Write(UINT64_MAX);
+  writer_.Sync();
+}
+
+uint64_t RecordingServer::Records() const {
+  return records_;
+}
+
+uint64_t RecordingServer::Dropped() const {
+  return dropped_;
+}
+
+uint64_t RecordingServer::Late() const {
+  return late_;
+}
+
+void RecordingServer::Scan() {
+  DIR *dir = opendir(SHARED_MEMORY_DIR);
+  if (!dir)
+    return;
+  struct dirent *entry;
+  size_t prefix = strlen(SHARED_RING_PREFIX);
+  while ((entry = readdir(dir)) != NULL) {
+    std::string name = std::string("/") + entry->d_name;
+    if (strncmp(entry->d_name, SHARED_RING_PREFIX, prefix) != 0
+        || rings_.count(name))
+      continue;
+    Attach(name);
+  }
+  closedir(dir);
+}
+
+bool RecordingServer::Attach(const std::string &name) {
+  int fd = shm_open(name.c_str(), O_RDWR, 0);
+  if (fd < 0)
+    return false;
+  struct stat st;
+  void *map = MAP_FAILED;
+  if (fstat(fd, &st) == 0
+      && static_cast<size_t>(st.st_size) > sizeof(SharedRingHeader))
+    map = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  close(fd);
+  if (map == MAP_FAILED)
+    return false;
+  SharedRingHeader *header = static_cast<SharedRingHeader *>(map);
+  // Still being set up by its producer, try again on the next scan
+  if (memcmp(header->magic, SHARED_RING_MAGIC, sizeof(header->magic)) != 0
+      || sizeof(SharedRingHeader) + header->capacity
+      > static_cast<uint64_t>(st.st_size)) {
+    munmap(map, st.st_size);
+    return false;
+  }
+  boost::atomic_thread_fence(boost::memory_order_acquire);
+  Ring_t ring;
+  ring.header = header;
+  ring.data = static_cast<char *>(map) + header->header_size;
+  ring.map_size = st.st_size;
+  ring.stream = std::string(header->stream,
+    strnlen(header->stream, SHARED_RING_STREAM_LENGTH));
+  ring.newest_ns = 0;
+  ring.active_ns = 0;
+  rings_[name] = ring;
+  fprintf(stderr, "timeseries_recording_server: recording %s (pid %d)\n",
+    ring.stream.c_str(), header->pid);
+  return true;
+}
+
+uint32_t RecordingServer::Drain(Ring_t *ring, uint64_t now) {
+  SharedRingHeader *header = ring->header;
+  uint64_t capacity = header->capacity;
+  uint64_t tail = header->tail.load(boost::memory_order_relaxed);
+  uint64_t head = header->head.load(boost::memory_order_acquire);
+  uint32_t drained = 0;
+  while (tail != head) {
+    uint64_t offset = tail & (capacity - 1);
+    const SharedRingRecord *record =
+      reinterpret_cast<const SharedRingRecord *>(ring->data + offset);
+    if (record->length == SHARED_RING_WRAP) {
+      tail += capacity - offset;
+      continue;
+    }
+    Entry_t entry;
+    entry.wall_ns = record->wall_ns;
+    entry.sequence = sequence_++;
+    entry.stream = ring->stream;
+    entry.payload.assign(reinterpret_cast<const char *>(record + 1),
+      record->length);
+    if (entry.payload.empty()
+        || entry.payload[entry.payload.size() - 1] != '\n')
+      entry.payload += '\n';
+    pending_.push_back(entry);
+    ring->newest_ns = std::max(ring->newest_ns, entry.wall_ns);
+    tail += SharedRingSpace(record->length);
+    drained++;
+  }
+  if (drained)
+    ring->active_ns = now;
+  header->tail.store(tail, boost::memory_order_release);
+  return drained;
+}
+
+void RecordingServer::Detach(const std::string &name, Ring_t *ring) {
+  uint64_t dropped = ring->header->dropped.load(boost::memory_order_relaxed);
+  dropped_ += dropped;
+  fprintf(stderr, "timeseries_recording_server: %s (pid %d) done, %lu "
+    "records dropped\n", ring->stream.c_str(), ring->header->pid,
+    static_cast<unsigned long>(dropped));
+  munmap(ring->header, ring->map_size);
+  shm_unlink(name.c_str());
+}
+
+void RecordingServer::Write(uint64_t watermark_ns) {
+  if (pending_.empty())
+    return;
+  std::sort(pending_.begin(), pending_.end());
+  size_t ready = 0;
+  while (ready < pending_.size() && pending_[ready].wall_ns <= watermark_ns)
+    ready++;
+  if (!ready)
+    return;
+  // Sorted, so the late ones are at the front
+  size_t late = 0;
+  while (late < ready && pending_[late].wall_ns < written_ns_)
+    late++;
+  if (late) {
+    late_ += late;
+    fprintf(stderr, "timeseries_recording_server: %lu records arrived "
+      "behind the output, written out of order\n",
+      static_cast<unsigned long>(late));
+  }
+  written_ns_ = std::max(written_ns_, pending_[ready - 1].wall_ns);
+
+  std::vector<char> prefixes(ready * TIME_PREFIX_SIZE);
+  std::vector<struct iovec> iov;
+  iov.reserve(std::min<size_t>(ready, RECORDS_PER_WRITE) * 3);
+  uint64_t bytes = 0;
+  size_t first = 0;
+  for (size_t i = 0; i < ready; ++i) {
+    char *prefix = &prefixes[i * TIME_PREFIX_SIZE];
+    int length = snprintf(prefix, TIME_PREFIX_SIZE, "%lu.%09lu, ",
+      static_cast<unsigned long>(pending_[i].wall_ns / 1000000000ull),
+      static_cast<unsigned long>(pending_[i].wall_ns % 1000000000ull));
+    struct iovec time = {prefix, static_cast<size_t>(length)};
+    // ", " after the stream name comes with it
+    pending_[i].stream += ", ";
+    struct iovec stream = {const_cast<char *>(pending_[i].stream.data()),
+      pending_[i].stream.size()};
+    struct iovec payload = {const_cast<char *>(pending_[i].payload.data()),
+      pending_[i].payload.size()};
+    iov.push_back(time);
+    iov.push_back(stream);
+    iov.push_back(payload);
+    bytes += time.iov_len + stream.iov_len + payload.iov_len;
+    // Writes of a few records each, so segments end close to their size
+    if (i + 1 - first == RECORDS_PER_WRITE || i + 1 == ready) {
+      writer_.Write(&iov[0], iov.size(), bytes, pending_[first].wall_ns,
+        pending_[i].wall_ns);
+      iov.clear();
+      bytes = 0;
+      first = i + 1;
+    }
+  }
+  records_ += ready;
+  pending_.erase(pending_.begin(), pending_.begin() + ready);
+}
+}  // namespace recording_toolkit
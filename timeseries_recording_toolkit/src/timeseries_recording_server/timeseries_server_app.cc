@@ -1,6 +1,85 @@
-#include "log.h"
+// Central recording server: drains the shared memory rings of every
+// SharedMemoryRecorder on this host into one time ordered stream of
+// segment files, until SIGINT or SIGTERM.
+//
+//   timeseries_recording_server <output_dir> [--segment_mb N]
+//     [--segment_age_s N] [--retain_mb N] [--merge_ms N] [--poll_ms N]
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <string>
+#include "timeseries_recording_server/recording_server.h"
+
+#define DEFAULT_SEGMENT_MB 64
+// Longer than the default max latency of a recorder, so records of all
+// producers are in before a time is written
+#define DEFAULT_MERGE_MS 250
+#define DEFAULT_POLL_MS 10
+
+static volatile sig_atomic_t running = 1;
+
+static void Stop(int signal) {
+  running = 0;
+}
+
+static void Usage(const char *name) {
+  fprintf(stderr, "usage: %s <output_dir> [--segment_mb N]"
+    " [--segment_age_s N] [--retain_mb N] [--merge_ms N] [--poll_ms N]\n",
+    name);
+}
 
-// Please Handle Command Line arguments
 int main(int argc, char *argv[]) {
+  if (argc < 2) {
+    Usage(argv[0]);
+    return 1;
+  }
+  uint64_t segment_mb = DEFAULT_SEGMENT_MB;
+  uint64_t segment_age_s = 0;
+  uint64_t retain_mb = 0;
+  uint64_t merge_ms = DEFAULT_MERGE_MS;
+  uint64_t poll_ms = DEFAULT_POLL_MS;
+  for (int i = 2; i < argc; ++i) {
+    std::string arg = argv[i];
+    if (i + 1 >= argc) {
+      Usage(argv[0]);
+      return 1;
+    }
+    uint64_t value = strtoull(argv[++i], NULL, 10);
+    if (arg == "--segment_mb") {
+      segment_mb = value;
+    } else if (arg == "--segment_age_s") {
+      segment_age_s = value;
+    } else if (arg == "--retain_mb") {
+      retain_mb = value;
+    } else if (arg == "--merge_ms") {
+      merge_ms = value;
+    } else if (arg == "--poll_ms") {
+      poll_ms = value;
+    } else {
+      Usage(argv[0]);
+      return 1;
+    }
+  }
+
+  signal(SIGINT, Stop);
+  signal(SIGTERM, Stop);
+  recording_toolkit::SegmentPolicy policy;
+  policy.max_bytes = segment_mb << 20;
+  policy.max_age_ns = segment_age_s * 1000000000ull;
+  policy.retain_bytes = retain_mb << 20;
+  recording_toolkit::RecordingServer server(argv[1], policy,
+    merge_ms * 1000000ull);
+  while (running) {
+    if (!server.Poll())
+      usleep(poll_ms * 1000);
+  }
+  server.Flush();
+  fprintf(stderr, "timeseries_recording_server: %lu records written, %lu "
+    "of them late, %lu dropped by producers\n",
+    static_cast<unsigned long>(server.Records()),
+    static_cast<unsigned long>(server.Late()),
+    static_cast<unsigned long>(server.Dropped()));
   return 0;
 }
@@ -0,0 +1,132 @@
+/*
+timeseries_recording_toolkit
+Copyright (C) 2015  Luke Fraser
+
+timeseries_recording_toolkit is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+timeseries_recording_toolkit is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with timeseries_recording_toolkit.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#include "timeseries_recording_toolkit/record_schema.h"
+#include <inttypes.h>
+#include <stdio.h>
+#include <algorithm>
+
+// Digits after the point of floats and doubles, as %f
+#define DEFAULT_PRECISION 6
+
+namespace recording_toolkit {
+
+RecordSchema &RecordSchema::Add(const std::string &name, FieldType_t type,
+    int precision) {
+  Field_t field = {name, type, precision < 0 ? DEFAULT_PRECISION : precision};
+  fields_.push_back(field);
+  return *this;
+}
+
+size_t RecordSchema::Size() const {
+  return fields_.size();
+}
+
+const std::string &RecordSchema::Name(size_t field) const {
+  return fields_[field].name;
+}
+
+FieldType_t RecordSchema::Type(size_t field) const {
+  return fields_[field].type;
+}
+
+template <typename T>
+static bool Take(const char **data, const char *end, T *value) {
+  if (static_cast<size_t>(end - *data) < sizeof(T))
+    return false;
+  memcpy(value, *data, sizeof(T));
+  *data += sizeof(T);
+  return true;
+}
+
+bool RecordSchema::Render(const char *data, size_t length,
+    std::string *out) const {
+  const char *end = data + length;
+  // Longest text of a fixed size field, a double with full precision
+  char text[384];
+  for (size_t i = 0; i < fields_.size(); ++i) {
+    if (i)
+      out->append(", ", 2);
+    int n = 0;
+    switch (fields_[i].type) {
+      case FIELD_BOOL: {
+        bool value;
+        if (!Take(&data, end, &value))
+          return false;
+        out->push_back(value ? '1' : '0');
+        break;
+      }
+      case FIELD_INT32: {
+        int32_t value;
+        if (!Take(&data, end, &value))
+          return false;
+        n = snprintf(text, sizeof(text), "%" PRId32, value);
+        break;
+      }
+      case FIELD_UINT32: {
+        uint32_t value;
+        if (!Take(&data, end, &value))
+          return false;
+        n = snprintf(text, sizeof(text), "%" PRIu32, value);
+        break;
+      }
+      case FIELD_INT64: {
+        int64_t value;
+        if (!Take(&data, end, &value))
+          return false;
+        n = snprintf(text, sizeof(text), "%" PRId64, value);
+        break;
+      }
+      case FIELD_UINT64: {
+        uint64_t value;
+        if (!Take(&data, end, &value))
+          return false;
+        n = snprintf(text, sizeof(text), "%" PRIu64, value);
+        break;
+      }
+      case FIELD_FLOAT: {
+        float value;
+        if (!Take(&data, end, &value))
+          return false;
+        n = snprintf(text, sizeof(text), "%.*f", fields_[i].precision,
+          value);
+        break;
+      }
+      case FIELD_DOUBLE: {
+        double value;
+        if (!Take(&data, end, &value))
+          return false;
+        n = snprintf(text, sizeof(text), "%.*f", fields_[i].precision,
+          value);
+        break;
+      }
+      case FIELD_STRING: {
+        uint16_t size;
+        if (!Take(&data, end, &size) || end - data < size)
+          return false;
+        out->append(data, size);
+        data += size;
+        break;
+      }
+    }
+    if (n > 0)
+      out->append(text, std::min<size_t>(n, sizeof(text) - 1));
+  }
+  out->push_back('\n');
+  return data == end;
+}
+}  // namespace recording_toolkit
@@ -17,112 +17,289 @@ along with timeseries_recording_toolkit.  If not, see <http://www.gnu.org/licens
 */
 #include "log.h"
 #include "timeseries_recording_toolkit/record_timeseries_data_to_file.h"
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <time.h>
+#include <unistd.h>
+#include <algorithm>
 
-#define BUFFER_SIZE 2048
-#define MAX_BUFFER_SLEEP 1024
-#define SLEEP_TIME 100
-#define MAX_EXPO_FALLOFF 80
-
-//  Swap macro  two swap the double buffer
-#define SWAP(A_PTR, B_PTR) do {                                                \
-  typeof(A_PTR) PTR = A_PTR;                                                   \
-  A_PTR = B_PTR;                                                               \
-  B_PTR = PTR;                                                                 \
-} while (0)                                                                    \
-
+// Bytes of one ring slot, a record takes as many slots as it needs
+#define RECORD_SLOT_SIZE 64
+// Default longest time a record waits for the worker
+#define DEFAULT_MAX_LATENCY_MS 100
+// Unless max batch is smaller, the worker is woken each time a quarter of
+// the ring has been filled
+#define WAKE_FRACTION 4
+#ifndef IOV_MAX
+#define IOV_MAX 1024
+#endif
 
 namespace recording_toolkit {
-typedef enum {
-  SUCCESS = 1,
-  NOT_RECORDING,
-} error_recording;
+uint64_t WallNs() {
+  struct timespec now;
+  clock_gettime(CLOCK_REALTIME, &now);
+  return static_cast<uint64_t>(now.tv_sec) * 1000000000ull + now.tv_nsec;
+}
 
-PrintRecorder::PrintRecorder(uint32_t queue_size) {
+struct PrintRecorder::FormatBuffer_t {
+  char data[MAX_RECORD_SIZE];
+};
+boost::thread_specific_ptr<PrintRecorder::FormatBuffer_t>
+  PrintRecorder::format_buffer_;
+
+PrintRecorder::PrintRecorder(uint32_t queue_size)
+    : recording_(false), stopping_(false), stamp_records_(false),
+      enqueue_pos_(0), dequeue_pos_(0),
+      max_latency_us_(DEFAULT_MAX_LATENCY_MS * 1000), records_(0), bytes_(0),
+      batches_(0), batch_us_total_(0), batch_us_max_(0) {
   printing_thread = NULL;
-  queue_size_ = queue_size;
-  thread_queue_ptr_ = &queues[0];
-  thread_queue_buffer_ptr_ = &queues[1];
+  // Power of two, with room for at least two of the longest records
+  capacity_ = 1;
+  while (capacity_ < queue_size
+      || capacity_ < 2 * MAX_RECORD_SIZE / RECORD_SLOT_SIZE)
+    capacity_ <<= 1;
+  mask_ = capacity_ - 1;
+  slots_ = new Slot_t[capacity_];
+  data_ = new char[capacity_ * RECORD_SLOT_SIZE];
+  for (uint64_t i = 0; i < capacity_; ++i)
+    slots_[i].sequence.store(i, boost::memory_order_relaxed);
+  segments_.reserve(2 * capacity_);
+  SetMaxBatch(capacity_);
 }
 PrintRecorder::~PrintRecorder() {
-  if (printing_thread)
-    delete printing_thread;
+  StopRecord();
+  delete [] slots_;
+  delete [] data_;
 }
 
 uint32_t PrintRecorder::RecordPrintf(const char *fmt, ...) {
   // Generate String to Add to file
-  if (!recording_)
+  if (!recording_.load(boost::memory_order_relaxed))
     return NOT_RECORDING;
-  // Static variable to avoid reallocation on each call
-  static char buffer[BUFFER_SIZE];
+  char *buffer = RecordBuffer();
 
-  // Generate buffer string to be pushed onto the queue
   va_list args;
   va_start(args, fmt);
-  vsnprintf(buffer, BUFFER_SIZE, fmt, args);
+  int length = vsnprintf(buffer, MAX_RECORD_SIZE, fmt, args);
   va_end(args);
+  if (length < 0)
+    return SUCCESS;
+  if (length >= MAX_RECORD_SIZE)
+    length = MAX_RECORD_SIZE - 1;
 
-  // Push message to queue for processing
-  thread_queue_ptr_->push(buffer);
+  Push(buffer, length, false);
   return SUCCESS;
 }
 
+char *PrintRecorder::RecordBuffer() {
+  // One buffer per thread, allocated on its first record
+  FormatBuffer_t *buffer = format_buffer_.get();
+  if (!buffer) {
+    buffer = new FormatBuffer_t;
+    format_buffer_.reset(buffer);
+  }
+  return buffer->data;
+}
+
+void PrintRecorder::SetSchema(const RecordSchema &schema) {
+  schema_ = schema;
+}
+
+void PrintRecorder::Push(const char *data, uint32_t length, bool typed) {
+  uint64_t count = length ? (length + RECORD_SLOT_SIZE - 1) / RECORD_SLOT_SIZE
+    : 1;
+  // Claim count slots. The worker frees slots in order, so once the last
+  // one is free all of them are.
+  uint64_t pos = enqueue_pos_.load(boost::memory_order_relaxed);
+  while (true) {
+    uint64_t last = pos + count - 1;
+    int64_t diff = static_cast<int64_t>(slots_[last & mask_].sequence.load(
+      boost::memory_order_acquire) - last);
+    if (diff == 0) {
+      if (enqueue_pos_.compare_exchange_weak(pos, pos + count,
+          boost::memory_order_relaxed))
+        break;
+    } else if (diff < 0) {
+      // Ring full, let the worker make room. Nobody will once recording
+      // stopped, the record is dropped then.
+      if (!recording_.load(boost::memory_order_relaxed))
+        return;
+      Wake();
+      boost::this_thread::yield();
+      pos = enqueue_pos_.load(boost::memory_order_relaxed);
+    } else {
+      pos = enqueue_pos_.load(boost::memory_order_relaxed);
+    }
+  }
+
+  uint64_t index = pos & mask_;
+  uint64_t first = std::min<uint64_t>(length,
+    (capacity_ - index) * RECORD_SLOT_SIZE);
+  memcpy(data_ + index * RECORD_SLOT_SIZE, data, first);
+  memcpy(data_, data + first, length - first);
+  Slot_t &slot = slots_[index];
+  slot.length = length;
+  slot.count = count;
+  slot.wall_ns = stamp_records_ ? WallNs() : 0;
+  slot.typed = typed;
+  slot.sequence.store(pos + 1, boost::memory_order_release);
+
+  uint64_t wake_every = wake_every_.load(boost::memory_order_relaxed);
+  if (pos / wake_every != (pos + count) / wake_every)
+    Wake();
+}
+
+void PrintRecorder::Wake() {
+  wake_.notify_one();
+}
+
 void PrintRecorder::Worker(PrintRecorder *object) {
-  uint32_t sleep;
   while (true) {
-    sleep = object->RecordingWorker();
-    boost::this_thread::sleep(boost::posix_time::milliseconds(sleep));
+    if (object->RecordingWorker())
+      continue;
+    if (object->stopping_.load(boost::memory_order_acquire)
+        && object->dequeue_pos_.load(boost::memory_order_acquire)
+        == object->enqueue_pos_.load(boost::memory_order_acquire))
+      return;
+    // Nothing ready: sleep until woken, at most the max latency, so no
+    // record waits longer than that
+    boost::unique_lock<boost::mutex> lock(object->wake_mut_);
+    object->wake_.timed_wait(lock, boost::posix_time::microseconds(
+      object->max_latency_us_.load(boost::memory_order_relaxed)));
   }
 }
 
 uint32_t PrintRecorder::RecordingWorker() {
-  static uint32_t count = 0;
-  uint32_t result;
-  uint32_t size = thread_queue_ptr_->size();
-  if (size >= queue_size_) {
-    SWAP(thread_queue_ptr_, thread_queue_buffer_ptr_);
-    ProcessBufferQueue(thread_queue_buffer_ptr_);
-    return SLEEP_TIME;
-  } else if (size > 0) {
-    count++;
-    if (count > MAX_BUFFER_SLEEP) {
-      SWAP(thread_queue_ptr_, thread_queue_buffer_ptr_);
-      ProcessBufferQueue(thread_queue_buffer_ptr_);
-      count = 0;
+  uint64_t start = dequeue_pos_.load(boost::memory_order_relaxed);
+  uint64_t pos = start;
+  uint32_t records = 0;
+  uint32_t max_batch = max_batch_.load(boost::memory_order_relaxed);
+  uint64_t bytes = 0;
+  segments_.clear();
+  rendered_.clear();
+  rendered_segments_.clear();
+  while (pos - start < capacity_ && records < max_batch) {
+    uint64_t index = pos & mask_;
+    Slot_t &slot = slots_[index];
+    if (slot.sequence.load(boost::memory_order_acquire) != pos + 1)
+      break;
+    uint64_t first = std::min<uint64_t>(slot.length,
+      (capacity_ - index) * RECORD_SLOT_SIZE);
+    if (slot.typed) {
+      // Rendered now, off the producer threads
+      const char *data = data_ + index * RECORD_SLOT_SIZE;
+      if (first < slot.length) {
+        char *joined = RecordBuffer();
+        memcpy(joined, data, first);
+        memcpy(joined + first, data_, slot.length - first);
+        data = joined;
+      }
+      size_t offset = rendered_.size();
+      if (!schema_.Render(data, slot.length, &rendered_))
+        rendered_.resize(offset);
+      if (rendered_.size() > offset) {
+        rendered_segments_.push_back(std::make_pair(segments_.size(),
+          offset));
+        RecordSegment segment = {NULL, rendered_.size() - offset,
+          slot.wall_ns, true};
+        segments_.push_back(segment);
+      }
+      pos += slot.count;
+      bytes += slot.length;
+      records++;
+      continue;
+    }
+    RecordSegment segment = {data_ + index * RECORD_SLOT_SIZE, first,
+      slot.wall_ns, first == slot.length};
+    segments_.push_back(segment);
+    if (first < slot.length) {
+      RecordSegment rest = {data_, slot.length - first, slot.wall_ns, true};
+      segments_.push_back(rest);
     }
-    return SLEEP_TIME;
-  } else {
-    if (count < MAX_EXPO_FALLOFF) {count++;}
-    return pow(1.1, count+1);
+    pos += slot.count;
+    bytes += slot.length;
+    records++;
   }
+  if (!records)
+    return 0;
+  // The rendered text only stays in place once the batch is complete
+  for (size_t i = 0; i < rendered_segments_.size(); ++i)
+    segments_[rendered_segments_[i].first].data =
+      rendered_.data() + rendered_segments_[i].second;
+  boost::posix_time::ptime begin =
+    boost::posix_time::microsec_clock::universal_time();
+  // Empty when no typed record of the batch matched the schema
+  if (!segments_.empty())
+    ProcessRecords(&segments_[0], segments_.size());
+  uint64_t took = (boost::posix_time::microsec_clock::universal_time()
+    - begin).total_microseconds();
+  records_.fetch_add(records, boost::memory_order_relaxed);
+  bytes_.fetch_add(bytes, boost::memory_order_relaxed);
+  batches_.fetch_add(1, boost::memory_order_relaxed);
+  batch_us_total_.fetch_add(took, boost::memory_order_relaxed);
+  if (took > batch_us_max_.load(boost::memory_order_relaxed))
+    batch_us_max_.store(took, boost::memory_order_relaxed);
+  // Hand the slots back for their next round of the ring
+  for (uint64_t p = start; p < pos; ++p)
+    slots_[p & mask_].sequence.store(p + capacity_,
+      boost::memory_order_release);
+  dequeue_pos_.store(pos, boost::memory_order_release);
+  return records;
 }
 
-void PrintRecorder::ProcessBufferQueue(std::queue<std::string> *buffer) {
-  std::string cat_str = "";
-  while (!buffer->empty()) {
-    cat_str += buffer->front();
-    // LOG_INFO("%s", buffer->front().c_str());
-    buffer->pop();
-  }
-  printf("%s", cat_str.c_str());
+void PrintRecorder::SetMaxLatency(boost::posix_time::time_duration latency) {
+  max_latency_us_ = std::max<int64_t>(latency.total_microseconds(), 1);
+}
+
+void PrintRecorder::SetMaxBatch(uint32_t records) {
+  max_batch_ = std::max<uint32_t>(records, 1);
+  wake_every_ = std::max<uint64_t>(std::min<uint64_t>(max_batch_,
+    capacity_ / WAKE_FRACTION), 1);
+}
+
+RecorderStats PrintRecorder::Stats() {
+  RecorderStats stats;
+  stats.records = records_.load(boost::memory_order_relaxed);
+  stats.bytes = bytes_.load(boost::memory_order_relaxed);
+  stats.batches = batches_.load(boost::memory_order_relaxed);
+  stats.batch_us_total = batch_us_total_.load(boost::memory_order_relaxed);
+  stats.batch_us_max = batch_us_max_.load(boost::memory_order_relaxed);
+  return stats;
+}
+
+void PrintRecorder::ProcessRecords(const RecordSegment *segments,
+    size_t count) {
+  for (size_t i = 0; i < count; ++i)
+    fwrite(segments[i].data, 1, segments[i].length, stdout);
 }
 
 uint32_t PrintRecorder::StartRecord() {
-  printing_thread = new boost::thread(PrintRecorder::Worker, this);
+  stopping_ = false;
   recording_ = true;
+  if (!printing_thread)
+    printing_thread = new boost::thread(PrintRecorder::Worker, this);
+  return SUCCESS;
 }
 uint32_t PrintRecorder::StopRecord() {
+  recording_ = false;
   if (printing_thread) {
-    printing_thread->interrupt();
+    stopping_ = true;
+    Wake();
+    printing_thread->join();
     delete printing_thread;
     printing_thread = NULL;
   }
-  recording_ = false;
+  return SUCCESS;
 }
 
 void PrintRecorder::WaitUntilFinishedWriting() {
   if (printing_thread) {
-    while (!(queues[0].empty() && queues[1].empty())) {
-      boost::this_thread::sleep(boost::posix_time::milliseconds(100));
+    while (dequeue_pos_.load(boost::memory_order_acquire)
+        != enqueue_pos_.load(boost::memory_order_acquire)) {
+      Wake();
+      boost::this_thread::sleep(boost::posix_time::milliseconds(1));
     }
   }
 }
@@ -130,22 +307,93 @@ void PrintRecorder::WaitUntilFinishedWriting() {
 FilePrintRecorder::FilePrintRecorder(
     const char* filename,
     uint32_t queue_size)
-    : PrintRecorder(queue_size) {
+    : PrintRecorder(queue_size), writer_(NULL), iov_(IOV_MAX) {
   filename_ = filename;
-  fout.open(filename);
+  // O_APPEND: every batch goes to the end in one write call
+  fd_ = open(filename, O_WRONLY | O_CREAT | O_TRUNC | O_APPEND, 0644);
+  if (fd_ < 0)
+    fprintf(stderr, "FilePrintRecorder: cannot open %s: %s\n", filename,
+      strerror(errno));
+}
+
+FilePrintRecorder::FilePrintRecorder(const std::string &directory,
+    const std::string &prefix, const SegmentPolicy &policy,
+    uint32_t queue_size)
+    : PrintRecorder(queue_size), fd_(-1), iov_(IOV_MAX) {
+  filename_ = directory + "/" + prefix;
+  // The segment index needs the time of every record
+  stamp_records_ = true;
+  writer_ = new SegmentWriter(directory, prefix, "csv", policy);
+}
+
+uint32_t FilePrintRecorder::StopRecord() {
+  uint32_t result = PrintRecorder::StopRecord();
+  // Everything recorded is on disk once recording stopped
+  if (writer_)
+    writer_->Close();
+  if (fd_ >= 0)
+    fdatasync(fd_);
+  return result;
 }
 
 FilePrintRecorder::~FilePrintRecorder() {
-  fout.close();
+  // The worker writes to fout, stop it first
+  StopRecord();
+  delete writer_;
+  if (fd_ >= 0)
+    close(fd_);
 }
 
-void FilePrintRecorder::ProcessBufferQueue(std::queue<std::string> *buffer) {
-  std::string cat_str = "";
-  while (!buffer->empty()) {
-    cat_str += buffer->front();
-    // LOG_INFO("%s", buffer->front().c_str());
-    buffer->pop();
+void FilePrintRecorder::ProcessRecords(const RecordSegment *segments,
+    size_t count) {
+  if (writer_) {
+    // One write per batch, a segment never ends inside a batch
+    if (iov_.size() < count)
+      iov_.resize(count);
+    uint64_t bytes = 0;
+    uint64_t first_ns = UINT64_MAX;
+    uint64_t last_ns = 0;
+    for (size_t i = 0; i < count; ++i) {
+      iov_[i].iov_base = const_cast<char *>(segments[i].data);
+      iov_[i].iov_len = segments[i].length;
+      bytes += segments[i].length;
+      first_ns = std::min(first_ns, segments[i].wall_ns);
+      last_ns = std::max(last_ns, segments[i].wall_ns);
+    }
+    writer_->Write(&iov_[0], count, bytes, first_ns, last_ns);
+    return;
+  }
+  if (fd_ < 0)
+    return;
+  while (count > 0) {
+    int n = std::min<size_t>(count, IOV_MAX);
+    for (int i = 0; i < n; ++i) {
+      iov_[i].iov_base = const_cast<char *>(segments[i].data);
+      iov_[i].iov_len = segments[i].length;
+    }
+    segments += n;
+    count -= n;
+    struct iovec *iov = &iov_[0];
+    while (n > 0) {
+      ssize_t written = writev(fd_, iov, n);
+      if (written < 0) {
+        if (errno == EINTR)
+          continue;
+        fprintf(stderr, "FilePrintRecorder: write to %s failed: %s\n",
+          filename_.c_str(), strerror(errno));
+        return;
+      }
+      // A short write stops inside a segment, go on from there
+      while (n > 0 && static_cast<size_t>(written) >= iov->iov_len) {
+        written -= iov->iov_len;
+        ++iov;
+        --n;
+      }
+      if (n > 0) {
+        iov->iov_base = static_cast<char *>(iov->iov_base) + written;
+        iov->iov_len -= written;
+      }
+    }
   }
-  fout.write(cat_str.c_str(), cat_str.length());
 }
 }  // namespace recording_toolkit
@@ -0,0 +1,273 @@
+/*
+timeseries_recording_toolkit
+Copyright (C) 2015  Luke Fraser
+
+timeseries_recording_toolkit is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+timeseries_recording_toolkit is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with timeseries_recording_toolkit.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#include "timeseries_recording_toolkit/segment_writer.h"
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <algorithm>
+#include <fstream>
+#include <sstream>
+
+#define DEFAULT_SEGMENT_BYTES (64ull << 20)
+#define PARTIAL_SUFFIX ".partial"
+#ifndef IOV_MAX
+#define IOV_MAX 1024
+#endif
+
+namespace recording_toolkit {
+
+SegmentPolicy::SegmentPolicy()
+    : max_bytes(DEFAULT_SEGMENT_BYTES), max_age_ns(0), retain_bytes(0) {}
+
+SegmentWriter::SegmentWriter(const std::string &directory,
+    const std::string &prefix, const std::string &extension,
+    const SegmentPolicy &policy)
+    : directory_(directory), prefix_(prefix), extension_(extension),
+      policy_(policy), number_(0), fd_(-1), open_failed_(false), size_(0), first_ns_(0),
+      last_ns_(0) {
+  ReadIndex(IndexPath(directory_, prefix_), &index_);
+  // Number on after every segment of earlier runs, finished or not
+  std::string start = prefix_ + "_";
+  DIR *dir = opendir(directory_.c_str());
+  if (!dir)
+    return;
+  while (struct dirent *entry = readdir(dir)) {
+    std::string name = entry->d_name;
+    if (name.compare(0, start.size(), start) != 0)
+      continue;
+    char *end;
+    unsigned long number = strtoul(name.c_str() + start.size(), &end, 10);
+    if (end == name.c_str() + start.size() || *end != '.')
+      continue;
+    number_ = std::max<uint32_t>(number_, number + 1);
+    if (name.size() > strlen(PARTIAL_SUFFIX) && name.compare(name.size()
+        - strlen(PARTIAL_SUFFIX), std::string::npos, PARTIAL_SUFFIX) == 0)
+      fprintf(stderr, "SegmentWriter: %s/%s was not finished, left as it "
+        "is\n", directory_.c_str(), name.c_str());
+  }
+  closedir(dir);
+}
+
+SegmentWriter::~SegmentWriter() {
+  Close();
+}
+
+std::string SegmentWriter::Path(const std::string &name) const {
+  return directory_ + "/" + name;
+}
+
+std::string SegmentWriter::IndexPath(const std::string &directory,
+    const std::string &prefix) {
+  return directory + "/" + prefix + ".index";
+}
+
+bool SegmentWriter::Usable(const std::string &directory) {
+  struct stat st;
+  return stat(directory.c_str(), &st) == 0 && S_ISDIR(st.st_mode)
+    && access(directory.c_str(), W_OK | X_OK) == 0;
+}
+
+bool SegmentWriter::Open() {
+  char number[32];
+  snprintf(number, sizeof(number), "_%06u.", number_);
+  name_ = prefix_ + number + extension_;
+  filename_ = Path(name_);
+  std::string partial = filename_ + PARTIAL_SUFFIX;
+  fd_ = open(partial.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_APPEND,
+    0644);
+  size_ = 0;
+  first_ns_ = 0;
+  last_ns_ = 0;
+  if (fd_ < 0) {
+    // Tried again on every write, reported once
+    if (!open_failed_)
+      fprintf(stderr, "SegmentWriter: cannot open %s: %s\n",
+        partial.c_str(), strerror(errno));
+    open_failed_ = true;
+    return false;
+  }
+  open_failed_ = false;
+  number_++;
+  return true;
+}
+
+bool SegmentWriter::Write(const struct iovec *iov, int count,
+    uint64_t bytes, uint64_t first_ns, uint64_t last_ns) {
+  if (fd_ >= 0 && size_ > 0
+      && ((policy_.max_bytes && size_ + bytes > policy_.max_bytes)
+      || (policy_.max_age_ns && last_ns >= first_ns_ + policy_.max_age_ns)))
+    Close();
+  if (fd_ < 0 && !Open())
+    return false;
+  if (size_ == 0 || first_ns < first_ns_)
+    first_ns_ = first_ns;
+  last_ns_ = std::max(last_ns_, last_ns);
+  size_ += bytes;
+  while (count > 0) {
+    int n = std::min(count, IOV_MAX);
+    ssize_t written = writev(fd_, iov, n);
+    if (written < 0) {
+      if (errno == EINTR)
+        continue;
+      return Failed();
+    }
+    // Skip what went out; a short write stops inside a buffer, the rest
+    // of it goes out on its own
+    while (n > 0 && static_cast<size_t>(written) >= iov->iov_len) {
+      written -= iov->iov_len;
+      ++iov;
+      --n;
+      --count;
+    }
+    if (n > 0 && written > 0) {
+      const char *rest = static_cast<const char *>(iov->iov_base) + written;
+      size_t left = iov->iov_len - written;
+      while (left > 0) {
+        ssize_t part = write(fd_, rest, left);
+        if (part < 0 && errno == EINTR)
+          continue;
+        if (part < 0)
+          return Failed();
+        rest += part;
+        left -= part;
+      }
+      ++iov;
+      --count;
+    }
+  }
+  return true;
+}
+
+bool SegmentWriter::Failed() {
+  fprintf(stderr, "SegmentWriter: write to %s%s failed: %s\n",
+    filename_.c_str(), PARTIAL_SUFFIX, strerror(errno));
+  return false;
+}
+
+void SegmentWriter::Sync() {
+  if (fd_ >= 0)
+    fdatasync(fd_);
+}
+
+void SegmentWriter::Close() {
+  if (fd_ < 0)
+    return;
+  fdatasync(fd_);
+  close(fd_);
+  fd_ = -1;
+  std::string partial = filename_ + PARTIAL_SUFFIX;
+  if (rename(partial.c_str(), filename_.c_str()) < 0) {
+    fprintf(stderr, "SegmentWriter: cannot finish %s: %s\n",
+      partial.c_str(), strerror(errno));
+    return;
+  }
+  SegmentInfo info = {name_, first_ns_, last_ns_, size_};
+  index_.push_back(info);
+  Retain();
+  WriteIndex();
+}
+
+void SegmentWriter::Retain() {
+  if (!policy_.retain_bytes)
+    return;
+  uint64_t total = 0;
+  for (size_t i = 0; i < index_.size(); ++i)
+    total += index_[i].bytes;
+  size_t removed = 0;
+  while (removed + 1 < index_.size() && total > policy_.retain_bytes) {
+    if (unlink(Path(index_[removed].name).c_str()) < 0 && errno != ENOENT)
+      fprintf(stderr, "SegmentWriter: cannot remove %s: %s\n",
+        Path(index_[removed].name).c_str(), strerror(errno));
+    total -= index_[removed].bytes;
+    removed++;
+  }
+  index_.erase(index_.begin(), index_.begin() + removed);
+}
+
+void SegmentWriter::WriteIndex() {
+  std::stringstream text;
+  for (size_t i = 0; i < index_.size(); ++i)
+    text << index_[i].name << " " << index_[i].first_ns << " "
+      << index_[i].last_ns << " " << index_[i].bytes << "\n";
+  std::string contents = text.str();
+  // Written aside and renamed over the index, readers never see half of it
+  std::string path = IndexPath(directory_, prefix_);
+  std::string temporary = path + ".tmp";
+  int fd = open(temporary.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  if (fd < 0) {
+    fprintf(stderr, "SegmentWriter: cannot write %s: %s\n",
+      temporary.c_str(), strerror(errno));
+    return;
+  }
+  const char *data = contents.data();
+  size_t left = contents.size();
+  while (left > 0) {
+    ssize_t written = write(fd, data, left);
+    if (written < 0 && errno == EINTR)
+      continue;
+    if (written < 0)
+      break;
+    data += written;
+    left -= written;
+  }
+  fdatasync(fd);
+  close(fd);
+  if (left > 0 || rename(temporary.c_str(), path.c_str()) < 0) {
+    fprintf(stderr, "SegmentWriter: cannot write %s: %s\n", path.c_str(),
+      strerror(errno));
+    return;
+  }
+  // The renames of the segment and the index are durable with the
+  // directory
+  int dir = open(directory_.c_str(), O_RDONLY | O_DIRECTORY);
+  if (dir >= 0) {
+    fsync(dir);
+    close(dir);
+  }
+}
+
+void SegmentWriter::ReadIndex(const std::string &path,
+    std::vector<SegmentInfo> *index) {
+  std::ifstream in(path.c_str());
+  SegmentInfo info;
+  while (in >> info.name >> info.first_ns >> info.last_ns >> info.bytes)
+    index->push_back(info);
+}
+
+std::vector<SegmentInfo> SegmentWriter::Segments(
+    const std::string &directory, const std::string &prefix,
+    uint64_t begin_ns, uint64_t end_ns) {
+  std::vector<SegmentInfo> index, found;
+  ReadIndex(IndexPath(directory, prefix), &index);
+  for (size_t i = 0; i < index.size(); ++i) {
+    if (index[i].last_ns >= begin_ns && index[i].first_ns <= end_ns)
+      found.push_back(index[i]);
+  }
+  return found;
+}
+
+const std::string& SegmentWriter::Filename() const {
+  return filename_;
+}
+}  // namespace recording_toolkit
@@ -0,0 +1,146 @@
+/*
+timeseries_recording_toolkit
+Copyright (C) 2015  Luke Fraser
+
+timeseries_recording_toolkit is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+timeseries_recording_toolkit is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with timeseries_recording_toolkit.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#include "timeseries_recording_toolkit/shared_memory_recorder.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#include <algorithm>
+#include <new>
+#include <sstream>
+
+namespace recording_toolkit {
+
+std::string SharedRingName(const std::string &stream, int pid) {
+  std::string clean = stream;
+  std::replace(clean.begin(), clean.end(), '/', '_');
+  std::stringstream ss;
+  ss << "/" << SHARED_RING_PREFIX << clean << "." << pid;
+  return ss.str();
+}
+
+SharedMemoryRecorder::SharedMemoryRecorder(const std::string &stream,
+    uint64_t ring_bytes, uint32_t queue_size)
+    : PrintRecorder(queue_size), header_(NULL), ring_(NULL), map_size_(0) {
+  stamp_records_ = true;
+  uint64_t capacity = 4096;
+  while (capacity < ring_bytes)
+    capacity <<= 1;
+  name_ = SharedRingName(stream, getpid());
+  int fd = shm_open(name_.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+  if (fd < 0) {
+    fprintf(stderr, "SharedMemoryRecorder: cannot create %s: %s\n",
+      name_.c_str(), strerror(errno));
+    return;
+  }
+  map_size_ = sizeof(SharedRingHeader) + capacity;
+  void *map = MAP_FAILED;
+  if (ftruncate(fd, map_size_) == 0)
+    map = mmap(NULL, map_size_, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  close(fd);
+  if (map == MAP_FAILED) {
+    fprintf(stderr, "SharedMemoryRecorder: cannot map %s: %s\n",
+      name_.c_str(), strerror(errno));
+    shm_unlink(name_.c_str());
+    return;
+  }
+  header_ = new (map) SharedRingHeader;
+  header_->header_size = sizeof(SharedRingHeader);
+  header_->pid = getpid();
+  header_->capacity = capacity;
+  strncpy(header_->stream, stream.c_str(), SHARED_RING_STREAM_LENGTH - 1);
+  header_->stream[SHARED_RING_STREAM_LENGTH - 1] = '\0';
+  header_->head.store(0, boost::memory_order_relaxed);
+  header_->tail.store(0, boost::memory_order_relaxed);
+  header_->dropped.store(0, boost::memory_order_relaxed);
+  header_->closed.store(0, boost::memory_order_relaxed);
+  ring_ = static_cast<char *>(map) + sizeof(SharedRingHeader);
+  // The magic goes in last, the server skips rings without it
+  boost::atomic_thread_fence(boost::memory_order_release);
+  memcpy(header_->magic, SHARED_RING_MAGIC, sizeof(header_->magic));
+}
+
+SharedMemoryRecorder::~SharedMemoryRecorder() {
+  // The worker writes to the ring, stop it first
+  StopRecord();
+  if (header_) {
+    // The server unlinks the ring once it drained it
+    header_->closed.store(1, boost::memory_order_release);
+    munmap(header_, map_size_);
+  }
+}
+
+bool SharedMemoryRecorder::Connected() const {
+  return header_ != NULL;
+}
+
+uint64_t SharedMemoryRecorder::Dropped() const {
+  return header_ ? header_->dropped.load(boost::memory_order_relaxed) : 0;
+}
+
+void SharedMemoryRecorder::ProcessRecords(const RecordSegment *segments,
+    size_t count) {
+  // Segments up to the end of a record make one ring record
+  size_t first = 0;
+  uint32_t length = 0;
+  for (size_t i = 0; i < count; ++i) {
+    length += segments[i].length;
+    if (!segments[i].end)
+      continue;
+    Write(segments + first, i + 1 - first, length);
+    first = i + 1;
+    length = 0;
+  }
+}
+
+void SharedMemoryRecorder::Write(const RecordSegment *segments, size_t count,
+    uint32_t length) {
+  if (!header_)
+    return;
+  uint64_t capacity = header_->capacity;
+  uint64_t head = header_->head.load(boost::memory_order_relaxed);
+  uint64_t tail = header_->tail.load(boost::memory_order_acquire);
+  uint64_t offset = head & (capacity - 1);
+  uint64_t space = SharedRingSpace(length);
+  // A record that does not fit before the end starts over at the front
+  uint64_t skip = offset + space > capacity ? capacity - offset : 0;
+  if (space + skip > capacity - (head - tail)) {
+    header_->dropped.fetch_add(1, boost::memory_order_relaxed);
+    return;
+  }
+  if (skip) {
+    reinterpret_cast<SharedRingRecord *>(ring_ + offset)->length =
+      SHARED_RING_WRAP;
+    head += skip;
+    offset = 0;
+  }
+  SharedRingRecord *record = reinterpret_cast<SharedRingRecord *>(
+    ring_ + offset);
+  record->length = length;
+  record->reserved = 0;
+  record->wall_ns = segments[0].wall_ns;
+  char *payload = reinterpret_cast<char *>(record + 1);
+  for (size_t i = 0; i < count; ++i) {
+    memcpy(payload, segments[i].data, segments[i].length);
+    payload += segments[i].length;
+  }
+  header_->head.store(head + space, boost::memory_order_release);
+}
+}  // namespace recording_toolkit